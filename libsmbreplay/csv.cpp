@@ -0,0 +1,333 @@
+#include "csv.hpp"
+#include "metrics.hpp"
+#include "stage-stats.hpp"
+#include "trajectory.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+
+// Powers of ten up to 10^cPowerRange, enough to scale any float to 9 digits and back
+const int cPowerRange = 64;
+
+struct PowersOf10
+{
+	PowersOf10()
+	{
+		for (int i = 0; i <= cPowerRange; ++i)
+		{
+			values[i] = std::pow(10., i);
+		}
+	}
+
+	double get(int exponent) const
+	{
+		return values[exponent];
+	}
+
+	double values[cPowerRange + 1];
+};
+
+const PowersOf10 &getPowersOf10()
+{
+	static const PowersOf10 powers;
+	return powers;
+}
+
+char *writeUnsignedText(char *text, uint64_t value)
+{
+	char digits[20];
+	size_t count = 0;
+	do
+	{
+		digits[count++] = static_cast<char>('0' + value % 10);
+		value /= 10;
+	} while (value);
+	while (count)
+	{
+		*text++ = digits[--count];
+	}
+	return text;
+}
+
+char *writeFieldText(char *text, uint8_t value) { return writeUnsignedText(text, value); }
+char *writeFieldText(char *text, uint16_t value) { return writeUnsignedText(text, value); }
+char *writeFieldText(char *text, uint32_t value) { return writeUnsignedText(text, value); }
+char *writeFieldText(char *text, float value) { return writeFloatText(text, value); }
+
+char *writeText(char *text, const char *value)
+{
+	while (*value)
+	{
+		*text++ = *value++;
+	}
+	return text;
+}
+
+// Missing values of a JSON input are written as 0, so every row has every column
+char *writeColumnText(char *text, const std::vector<float> &values, size_t frame, size_t)
+{
+	*text++ = ',';
+	return writeFloatText(text, frame < values.size() ? values[frame] : 0.f);
+}
+
+char *writeColumnText(char *text, const std::vector<uint32_t> &values, size_t frame, size_t)
+{
+	*text++ = ',';
+	return writeUnsignedText(text, frame < values.size() ? values[frame] : 0);
+}
+
+char *writeColumnText(char *text, const std::vector<std::vector<float>> &values, size_t frame, size_t dimensions)
+{
+	for (size_t i = 0; i < dimensions; ++i)
+	{
+		*text++ = ',';
+		text = writeFloatText(text, frame < values.size() && i < values[frame].size() ? values[frame][i] : 0.f);
+	}
+	return text;
+}
+
+void appendText(std::vector<uint8_t> &buffer, const std::string &text)
+{
+	buffer.insert(buffer.end(), text.begin(), text.end());
+}
+
+}
+
+char *writeFloatText(char *text, float value)
+{
+	if (std::isnan(value))
+	{
+		return writeText(text, "nan");
+	}
+	if (value < 0)
+	{
+		*text++ = '-';
+		value = -value;
+	}
+	if (std::isinf(value))
+	{
+		return writeText(text, "inf");
+	}
+	if (value == 0)
+	{
+		*text++ = '0';
+		return text;
+	}
+
+	// value is digits * 10^(exponent - precision + 1) for the fewest digits that read back as
+	// value. Doubles hold a float's 9 digits with room to spare, so scaling and rounding in double
+	// finds them without any of printf's machinery.
+	const auto &powers = getPowersOf10();
+	double exact = value;
+	int exponent = static_cast<int>(std::floor(std::log10(exact)));
+	// log10 may be off by one right at powers of ten
+	double power = exponent >= 0 ? powers.get(exponent) : 1. / powers.get(-exponent);
+	if (exact >= power * 10.)
+	{
+		++exponent;
+	}
+	else if (exact < power)
+	{
+		--exponent;
+	}
+	uint64_t digits = 0;
+	int precision = 1;
+	for (; precision <= 9; ++precision)
+	{
+		// Only ever scaled by positive powers, 10^-k isn't exact in double but 10^k up to 10^22 is
+		int shift = precision - 1 - exponent;
+		digits = static_cast<uint64_t>(std::llround(shift >= 0 ? exact * powers.get(shift) : exact / powers.get(-shift)));
+		double candidate = shift >= 0 ? digits / powers.get(shift) : digits * powers.get(-shift);
+		if (precision == 9 || static_cast<float>(candidate) == value)
+		{
+			break;
+		}
+	}
+	// Rounded up to the next power of ten, e.g. 9.9999999 to 10
+	if (digits >= static_cast<uint64_t>(powers.get(precision)))
+	{
+		digits /= 10;
+		++exponent;
+	}
+	while (precision > 1 && digits % 10 == 0)
+	{
+		digits /= 10;
+		--precision;
+	}
+
+	char digitText[9];
+	writeUnsignedText(digitText, digits);
+	if (exponent >= -5 && exponent < 9)
+	{
+		if (exponent < 0)
+		{
+			*text++ = '0';
+			*text++ = '.';
+			for (int i = -1; i > exponent; --i)
+			{
+				*text++ = '0';
+			}
+			memcpy(text, digitText, precision);
+			return text + precision;
+		}
+		for (int i = 0; i <= exponent; ++i)
+		{
+			*text++ = i < precision ? digitText[i] : '0';
+		}
+		if (precision > exponent + 1)
+		{
+			*text++ = '.';
+			memcpy(text, digitText + exponent + 1, precision - exponent - 1);
+			text += precision - exponent - 1;
+		}
+		return text;
+	}
+
+	*text++ = digitText[0];
+	if (precision > 1)
+	{
+		*text++ = '.';
+		memcpy(text, digitText + 1, precision - 1);
+		text += precision - 1;
+	}
+	*text++ = 'e';
+	*text++ = exponent < 0 ? '-' : '+';
+	if (std::abs(exponent) < 10)
+	{
+		*text++ = '0';
+	}
+	return writeUnsignedText(text, std::abs(exponent));
+}
+
+void serializeCSVHeader(std::vector<uint8_t> &buffer, bool corpus, const EncodeOptions &options)
+{
+	std::string header;
+	if (corpus)
+	{
+		header += "replay,";
+		// Named by their JSON path, the header's flags would clash with the flags column
+		forEachField<ReplayFileHeader>([&header](const auto &field)
+		{
+			header += "header.";
+			header += field.name;
+			header += ',';
+		});
+	}
+	header += "frame";
+	forEachColumn([&header](const auto &column, auto)
+	{
+		for (size_t i = 0; i < column.dimensions; ++i)
+		{
+			header += ',';
+			header += column.name;
+			if (column.dimensions > 1)
+			{
+				header += '_' + std::to_string(i);
+			}
+		}
+	});
+	if (options.positions)
+	{
+		header += ",playerPosition_x,playerPosition_y,playerPosition_z";
+	}
+	if (options.speeds)
+	{
+		header += ",playerSpeed";
+	}
+	header += '\n';
+	appendText(buffer, header);
+}
+
+void serializeCSVRows(std::vector<uint8_t> &buffer, const ReplayFile &replay, const std::string *name, const EncodeOptions &options)
+{
+	Trajectory trajectory;
+	if (options.positions)
+	{
+		reconstructTrajectory(replay, options.doublePrecisionPositions, trajectory);
+	}
+	std::vector<float> speeds;
+	if (options.speeds)
+	{
+		ReplayMetrics metrics;
+		computeReplayMetrics(replay, metrics, &speeds);
+	}
+
+	StageScope scope(Stage::EncodeCSV);
+	size_t start = buffer.size();
+
+	// Corpus columns are the same on every row of a replay, so they are only formatted once.
+	// Names are quoted so commas in paths don't shift the columns.
+	std::string prefix;
+	if (name)
+	{
+		prefix += '"';
+		for (char c : *name)
+		{
+			prefix += c;
+			if (c == '"')
+			{
+				prefix += c;
+			}
+		}
+		prefix += "\",";
+		char fieldText[cMaxFloatTextSize + 1];
+		forEachField<ReplayFileHeader>([&prefix, &fieldText, &replay](const auto &field)
+		{
+			char *end = writeFieldText(fieldText, replay.header.*field.member);
+			*end++ = ',';
+			prefix.append(fieldText, end);
+		});
+	}
+
+	// The longest column, the others are padded with zeros
+	size_t frames = 0;
+	size_t valueCount = (options.positions ? 3 : 0) + (options.speeds ? 1 : 0);
+	forEachColumn([&frames, &valueCount, &replay](const auto &column, auto)
+	{
+		frames = std::max(frames, (replay.*column.member).size());
+		valueCount += column.dimensions;
+	});
+
+	// Rows are written straight into the buffer, grown once to what they can take at most
+	size_t maxRowSize = prefix.size() + 20 + valueCount * (1 + cMaxFloatTextSize) + 1;
+	buffer.resize(start + frames * maxRowSize);
+	char *begin = reinterpret_cast<char *>(buffer.data() + start);
+	char *text = begin;
+	for (size_t frame = 0; frame < frames; ++frame)
+	{
+		memcpy(text, prefix.data(), prefix.size());
+		text = writeUnsignedText(text + prefix.size(), frame);
+		forEachColumn([&text, &replay, frame](const auto &column, auto)
+		{
+			text = writeColumnText(text, replay.*column.member, frame, column.dimensions);
+		});
+		if (options.positions)
+		{
+			bool known = frame < trajectory.x.size();
+			*text++ = ',';
+			text = writeFloatText(text, known ? trajectory.x[frame] : 0.f);
+			*text++ = ',';
+			text = writeFloatText(text, known ? trajectory.y[frame] : 0.f);
+			*text++ = ',';
+			text = writeFloatText(text, known ? trajectory.z[frame] : 0.f);
+		}
+		if (options.speeds)
+		{
+			*text++ = ',';
+			text = writeFloatText(text, frame < speeds.size() ? speeds[frame] : 0.f);
+		}
+		*text++ = '\n';
+	}
+	buffer.resize(start + (text - begin));
+	scope.setBytes(0, buffer.size() - start);
+}
+
+void serializeCSV(std::vector<uint8_t> &buffer, const ReplayFile &replay, const EncodeOptions &options)
+{
+	serializeCSVHeader(buffer, false, options);
+	serializeCSVRows(buffer, replay, nullptr, options);
+}
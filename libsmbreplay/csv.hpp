@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "smb-replay.hpp"
+
+// Comma separated text with one row per frame: "frame", then every ReplayColumns value, columns
+// with more dimensions suffixed _0, _1..., and with options.positions playerPosition_x, _y and _z.
+// Floats are written as the shortest text that reads back as the same float.
+//
+// A corpus puts many replays in one file under a single column header. Each row then starts with
+// the quoted replay name and every header field as header.<field>, see serializeCSVRows.
+void serializeCSV(std::vector<uint8_t> &buffer, const ReplayFile &replay, const EncodeOptions &options);
+
+// The column header line, with the "replay" and header field columns if corpus is set
+void serializeCSVHeader(std::vector<uint8_t> &buffer, bool corpus, const EncodeOptions &options);
+// The rows of one replay, corpus rows if name is not null
+void serializeCSVRows(std::vector<uint8_t> &buffer, const ReplayFile &replay, const std::string *name, const EncodeOptions &options);
+
+// Writes value at text and returns the end, at most cMaxFloatTextSize characters
+char *writeFloatText(char *text, float value);
+static const size_t cMaxFloatTextSize = 16;
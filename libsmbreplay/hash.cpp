@@ -0,0 +1,106 @@
+#include "hash.hpp"
+
+#include <algorithm>
+
+namespace
+{
+
+inline uint64_t rotateLeft(uint64_t value, int bits)
+{
+	return (value << bits) | (value >> (64 - bits));
+}
+
+inline uint64_t finalMix(uint64_t value)
+{
+	value ^= value >> 33;
+	value *= 0xFF51AFD7ED558CCDull;
+	value ^= value >> 33;
+	value *= 0xC4CEB9FE1A85EC53ull;
+	value ^= value >> 33;
+	return value;
+}
+
+// Blocks are read as little endian regardless of the host so hashes match across machines
+inline uint64_t readBlock(const uint8_t *data)
+{
+	uint64_t value = 0;
+	for (int i = 7; i >= 0; --i)
+	{
+		value = (value << 8) | data[i];
+	}
+	return value;
+}
+
+}
+
+Hash128 hashBuffer128(const uint8_t *data, size_t size, uint64_t seed)
+{
+	const uint64_t c1 = 0x87C37B91114253D5ull;
+	const uint64_t c2 = 0x4CF5AD432745937Full;
+	uint64_t h1 = seed;
+	uint64_t h2 = seed;
+
+	size_t blocks = size / 16;
+	for (size_t i = 0; i < blocks; ++i)
+	{
+		uint64_t k1 = readBlock(data + i * 16);
+		uint64_t k2 = readBlock(data + i * 16 + 8);
+
+		k1 *= c1; k1 = rotateLeft(k1, 31); k1 *= c2; h1 ^= k1;
+		h1 = rotateLeft(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52DCE729;
+		k2 *= c2; k2 = rotateLeft(k2, 33); k2 *= c1; h2 ^= k2;
+		h2 = rotateLeft(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495AB5;
+	}
+
+	const uint8_t *tail = data + blocks * 16;
+	uint64_t k1 = 0;
+	uint64_t k2 = 0;
+	size_t remaining = size & 15;
+	for (size_t i = remaining; i > 8; --i)
+	{
+		k2 ^= uint64_t(tail[i - 1]) << ((i - 9) * 8);
+	}
+	if (remaining > 8)
+	{
+		k2 *= c2; k2 = rotateLeft(k2, 33); k2 *= c1; h2 ^= k2;
+	}
+	for (size_t i = std::min<size_t>(remaining, 8); i > 0; --i)
+	{
+		k1 ^= uint64_t(tail[i - 1]) << ((i - 1) * 8);
+	}
+	if (remaining)
+	{
+		k1 *= c1; k1 = rotateLeft(k1, 31); k1 *= c2; h1 ^= k1;
+	}
+
+	h1 ^= size;
+	h2 ^= size;
+	h1 += h2;
+	h2 += h1;
+	h1 = finalMix(h1);
+	h2 = finalMix(h2);
+	h1 += h2;
+	h2 += h1;
+
+	Hash128 hash;
+	hash.low = h1;
+	hash.high = h2;
+	return hash;
+}
+
+Hash128 hashBuffer128(const std::vector<uint8_t> &buffer, uint64_t seed)
+{
+	return hashBuffer128(buffer.data(), buffer.size(), seed);
+}
+
+std::string getHashString(const Hash128 &hash)
+{
+	static const char digits[] = "0123456789abcdef";
+	std::string text(32, '0');
+	for (int i = 0; i < 16; ++i)
+	{
+		text[15 - i] = digits[(hash.high >> (i * 4)) & 0xF];
+		text[31 - i] = digits[(hash.low >> (i * 4)) & 0xF];
+	}
+	return text;
+}
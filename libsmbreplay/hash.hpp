@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct Hash128
+{
+	uint64_t low = 0;
+	uint64_t high = 0;
+
+	bool operator==(const Hash128 &other) const { return low == other.low && high == other.high; }
+	bool operator!=(const Hash128 &other) const { return !(*this == other); }
+	bool operator<(const Hash128 &other) const { return high != other.high ? high < other.high : low < other.low; }
+};
+
+// MurmurHash3 x64 128, fast and well distributed but not meant to withstand attackers
+Hash128 hashBuffer128(const uint8_t *data, size_t size, uint64_t seed = 0);
+Hash128 hashBuffer128(const std::vector<uint8_t> &buffer, uint64_t seed = 0);
+
+// 32 lowercase hex digits, high half first
+std::string getHashString(const Hash128 &hash);
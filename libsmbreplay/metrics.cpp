@@ -0,0 +1,147 @@
+#include "metrics.hpp"
+#include "stage-stats.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+
+const std::vector<std::string> &getReplayMetricsColumns()
+{
+	static const std::vector<std::string> columns = { "playerPositionDelta", "flags" };
+	return columns;
+}
+
+void computeReplayMetrics(const ReplayFile &replay, ReplayMetrics &metrics, std::vector<float> *speeds)
+{
+	StageScope scope(Stage::Metrics);
+	size_t frames = std::min<size_t>({ replay.header.replayTotalTime, replay.playerPositionDelta.size(), replay.flags.size() });
+	metrics = ReplayMetrics();
+	metrics.frames = static_cast<uint32_t>(frames);
+	if (speeds)
+	{
+		speeds->resize(frames);
+	}
+
+	// Everything in one sweep so each frame's data is touched once. The flag counts are a fixed
+	// 32 lane loop without branches, which compilers turn into vector adds.
+	float previous[3] = {};
+	float topSpeed = 0.f;
+	float topDeltaChange = 0.f;
+	double pathLength = 0.;
+	uint32_t flagFrames[32] = {};
+	for (size_t i = 0; i < frames; ++i)
+	{
+		const auto &delta = replay.playerPositionDelta[i];
+		float current[3] = {
+			delta.size() > 0 ? delta[0] : 0.f,
+			delta.size() > 1 ? delta[1] : 0.f,
+			delta.size() > 2 ? delta[2] : 0.f,
+		};
+		float speed = std::sqrt(current[0] * current[0] + current[1] * current[1] + current[2] * current[2]);
+		pathLength += speed;
+		topSpeed = std::max(topSpeed, speed);
+		if (speeds)
+		{
+			(*speeds)[i] = speed * cFramesPerSecond;
+		}
+
+		if (i)
+		{
+			float change[3] = { current[0] - previous[0], current[1] - previous[1], current[2] - previous[2] };
+			topDeltaChange = std::max(topDeltaChange, std::sqrt(change[0] * change[0] + change[1] * change[1] + change[2] * change[2]));
+		}
+		std::copy(current, current + 3, previous);
+
+		uint32_t flags = replay.flags[i];
+		for (uint32_t bit = 0; bit < 32; ++bit)
+		{
+			flagFrames[bit] += (flags >> bit) & 1;
+		}
+	}
+
+	metrics.pathLength = pathLength;
+	metrics.topSpeed = topSpeed * cFramesPerSecond;
+	metrics.meanSpeed = frames ? pathLength / frames * cFramesPerSecond : 0.;
+	metrics.topAcceleration = topDeltaChange * cFramesPerSecond * cFramesPerSecond;
+	std::copy(flagFrames, flagFrames + 32, metrics.flagFrames);
+	scope.setBytes(frames * (3 * sizeof(float) + sizeof(uint32_t)), 0);
+}
+
+void printReplayMetricsTable(std::ostream &stream, const std::vector<ReplayMetricsRow> &rows, uint32_t flagMask)
+{
+	if (!flagMask)
+	{
+		for (const auto &row : rows)
+		{
+			for (uint32_t bit = 0; bit < 32; ++bit)
+			{
+				if (row.valid && row.metrics.flagFrames[bit])
+				{
+					flagMask |= 1u << bit;
+				}
+			}
+		}
+	}
+
+	auto flags = stream.flags();
+	auto precision = stream.precision();
+
+	stream << "replay,frames,seconds,path_length,top_speed,mean_speed,top_acceleration";
+	for (uint32_t bit = 0; bit < 32; ++bit)
+	{
+		if (flagMask & (1u << bit))
+		{
+			stream << ",seconds_flag_0x" << std::hex << (1u << bit) << std::dec;
+		}
+	}
+	stream << "\n";
+
+	stream << std::fixed;
+	for (const auto &row : rows)
+	{
+		// Quote names so commas in paths don't shift the columns
+		stream << '"';
+		for (char c : row.name)
+		{
+			stream << c;
+			if (c == '"')
+			{
+				stream << c;
+			}
+		}
+		stream << '"';
+
+		const auto &metrics = row.metrics;
+		if (!row.valid)
+		{
+			stream << ",,,,,,";
+			for (uint32_t bit = 0; bit < 32; ++bit)
+			{
+				if (flagMask & (1u << bit))
+				{
+					stream << ',';
+				}
+			}
+			stream << "\n";
+			continue;
+		}
+		stream << ',' << metrics.frames
+			<< std::setprecision(3) << ',' << metrics.frames / cFramesPerSecond
+			<< std::setprecision(4) << ',' << metrics.pathLength
+			<< ',' << metrics.topSpeed
+			<< ',' << metrics.meanSpeed
+			<< ',' << metrics.topAcceleration;
+		for (uint32_t bit = 0; bit < 32; ++bit)
+		{
+			if (flagMask & (1u << bit))
+			{
+				stream << std::setprecision(3) << ',' << metrics.flagFrames[bit] / cFramesPerSecond;
+			}
+		}
+		stream << "\n";
+	}
+	stream.flush();
+
+	stream.flags(flags);
+	stream.precision(precision);
+}
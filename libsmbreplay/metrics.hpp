@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "smb-replay.hpp"
+
+// The game runs at a fixed 60 frames per second, deltas are per frame
+static const float cFramesPerSecond = 60.f;
+
+// Kinematics of the played part of a replay, positions in stage units
+struct ReplayMetrics
+{
+	uint32_t frames = 0;
+	double pathLength = 0.;
+	// Units per second
+	double topSpeed = 0.;
+	double meanSpeed = 0.;
+	// Units per second squared, between consecutive frames
+	double topAcceleration = 0.;
+	// Frames with each bit of flags set, bit i at index i
+	uint32_t flagFrames[32] = {};
+};
+
+// Computes all metrics in one pass over the first replayTotalTime frames. If speeds is not null it
+// receives the speed of every one of those frames, which EncodeOptions::speeds writes out.
+void computeReplayMetrics(const ReplayFile &replay, ReplayMetrics &metrics, std::vector<float> *speeds = nullptr);
+// The columns computeReplayMetrics reads besides the header, all a replay needs for its metrics
+// when decoded with decodeReplayColumns
+const std::vector<std::string> &getReplayMetricsColumns();
+
+struct ReplayMetricsRow
+{
+	std::string name;
+	bool valid = false;
+	ReplayMetrics metrics;
+};
+
+// CSV with one row per replay. Only flag bits in flagMask get a column, with 0 meaning every bit
+// that is set in any replay. Rows that aren't valid keep their name and leave the rest empty.
+void printReplayMetricsTable(std::ostream &stream, const std::vector<ReplayMetricsRow> &rows, uint32_t flagMask = 0);
@@ -0,0 +1,280 @@
+#include "npz.hpp"
+#include "metrics.hpp"
+#include "stage-stats.hpp"
+#include "trajectory.hpp"
+
+#include <string>
+
+namespace
+{
+
+// Zip's CRC-32, reflected polynomial 0xEDB88320. Not the GCI checksum.
+struct ZipCRCTable
+{
+	ZipCRCTable()
+	{
+		for (uint32_t byte = 0; byte < 256; ++byte)
+		{
+			uint32_t checksum = byte;
+			for (size_t i = 0; i < 8; ++i)
+			{
+				checksum = (checksum >> 1) ^ ((checksum & 1) ? 0xEDB88320u : 0);
+			}
+			entries[byte] = checksum;
+		}
+	}
+
+	uint32_t entries[256];
+};
+
+uint32_t getZipCRC(const uint8_t *data, size_t size)
+{
+	static const ZipCRCTable table;
+	uint32_t checksum = 0xFFFFFFFF;
+	for (size_t i = 0; i < size; ++i)
+	{
+		checksum = table.entries[(checksum ^ data[i]) & 0xFF] ^ (checksum >> 8);
+	}
+	return ~checksum;
+}
+
+const char *getNumPyType(uint8_t) { return "|u1"; }
+const char *getNumPyType(uint16_t) { return "<u2"; }
+const char *getNumPyType(uint32_t) { return "<u4"; }
+const char *getNumPyType(float) { return "<f4"; }
+
+const size_t cArrayAlignment = 64;
+// 1980-01-01 00:00 in DOS format, so the same replay always gives the same archive
+const uint16_t cZipTime = 0;
+const uint16_t cZipDate = (1 << 5) | 1;
+
+// Stored zip members written straight into the output. The data of each member is appended by
+// the caller between beginArray and endArray.
+class NPZWriter
+{
+public:
+	explicit NPZWriter(std::vector<uint8_t> &buffer)
+		: mBuffer(buffer), mStart(buffer.size())
+	{}
+
+	// descr and shape are Python literals as .npy headers have them, e.g. "'<f4'" and "(3840, 3)"
+	void beginArray(const std::string &name, const std::string &descr, const std::string &shape)
+	{
+		Member member;
+		member.name = name + ".npy";
+		member.headerOffset = mBuffer.size();
+
+		// Pad the local header's extra field so the .npy starts aligned, an extra field record
+		// needs at least its 4 byte id and size
+		size_t npyStart = member.headerOffset - mStart + 30 + member.name.size();
+		size_t padding = (cArrayAlignment - npyStart % cArrayAlignment) % cArrayAlignment;
+		if (padding && padding < 4)
+		{
+			padding += cArrayAlignment;
+		}
+
+		appendLittleEndian(mBuffer, static_cast<uint32_t>(0x04034B50));
+		appendLittleEndian(mBuffer, static_cast<uint16_t>(20)); // version needed
+		appendLittleEndian(mBuffer, static_cast<uint16_t>(0)); // flags
+		appendLittleEndian(mBuffer, static_cast<uint16_t>(0)); // stored
+		appendLittleEndian(mBuffer, cZipTime);
+		appendLittleEndian(mBuffer, cZipDate);
+		// CRC and sizes, filled in by endArray
+		mBuffer.resize(mBuffer.size() + 12, 0);
+		appendLittleEndian(mBuffer, static_cast<uint16_t>(member.name.size()));
+		appendLittleEndian(mBuffer, static_cast<uint16_t>(padding));
+		mBuffer.insert(mBuffer.end(), member.name.begin(), member.name.end());
+		if (padding)
+		{
+			appendLittleEndian(mBuffer, static_cast<uint16_t>(0xCAFE)); // unregistered id, readers skip it
+			appendLittleEndian(mBuffer, static_cast<uint16_t>(padding - 4));
+			mBuffer.resize(mBuffer.size() + padding - 4, 0);
+		}
+
+		// .npy 1.0: magic, version, header length, then the header dict padded with spaces to the
+		// alignment and ended by a newline
+		member.dataOffset = mBuffer.size();
+		std::string header = "{'descr': " + descr + ", 'fortran_order': False, 'shape': " + shape + ", }";
+		size_t preambleSize = 10 + header.size() + 1;
+		header.append((cArrayAlignment - preambleSize % cArrayAlignment) % cArrayAlignment, ' ');
+		header.push_back('\n');
+		const char magic[] = "\x93NUMPY\x01\x00";
+		mBuffer.insert(mBuffer.end(), magic, magic + 8);
+		appendLittleEndian(mBuffer, static_cast<uint16_t>(header.size()));
+		mBuffer.insert(mBuffer.end(), header.begin(), header.end());
+		mMembers.push_back(member);
+	}
+
+	void endArray()
+	{
+		Member &member = mMembers.back();
+		size_t size = mBuffer.size() - member.dataOffset;
+		member.crc = getZipCRC(&mBuffer[member.dataOffset], size);
+		member.size = static_cast<uint32_t>(size);
+		uint8_t *header = &mBuffer[member.headerOffset];
+		writeLittleEndian(header + 14, member.crc);
+		writeLittleEndian(header + 18, member.size);
+		writeLittleEndian(header + 22, member.size);
+	}
+
+	// Central directory and end record
+	void finish()
+	{
+		size_t directoryStart = mBuffer.size();
+		for (const auto &member : mMembers)
+		{
+			appendLittleEndian(mBuffer, static_cast<uint32_t>(0x02014B50));
+			appendLittleEndian(mBuffer, static_cast<uint16_t>(20)); // version made by
+			appendLittleEndian(mBuffer, static_cast<uint16_t>(20)); // version needed
+			appendLittleEndian(mBuffer, static_cast<uint16_t>(0)); // flags
+			appendLittleEndian(mBuffer, static_cast<uint16_t>(0)); // stored
+			appendLittleEndian(mBuffer, cZipTime);
+			appendLittleEndian(mBuffer, cZipDate);
+			appendLittleEndian(mBuffer, member.crc);
+			appendLittleEndian(mBuffer, member.size);
+			appendLittleEndian(mBuffer, member.size);
+			appendLittleEndian(mBuffer, static_cast<uint16_t>(member.name.size()));
+			// Extra field, comment, disk, internal attributes, external attributes
+			mBuffer.resize(mBuffer.size() + 2 + 2 + 2 + 2 + 4, 0);
+			appendLittleEndian(mBuffer, static_cast<uint32_t>(member.headerOffset - mStart));
+			mBuffer.insert(mBuffer.end(), member.name.begin(), member.name.end());
+		}
+		size_t directorySize = mBuffer.size() - directoryStart;
+
+		appendLittleEndian(mBuffer, static_cast<uint32_t>(0x06054B50));
+		appendLittleEndian(mBuffer, static_cast<uint16_t>(0)); // disk
+		appendLittleEndian(mBuffer, static_cast<uint16_t>(0)); // directory disk
+		appendLittleEndian(mBuffer, static_cast<uint16_t>(mMembers.size()));
+		appendLittleEndian(mBuffer, static_cast<uint16_t>(mMembers.size()));
+		appendLittleEndian(mBuffer, static_cast<uint32_t>(directorySize));
+		appendLittleEndian(mBuffer, static_cast<uint32_t>(directoryStart - mStart));
+		appendLittleEndian(mBuffer, static_cast<uint16_t>(0)); // comment
+	}
+
+private:
+	struct Member
+	{
+		std::string name;
+		size_t headerOffset = 0;
+		size_t dataOffset = 0;
+		uint32_t crc = 0;
+		uint32_t size = 0;
+	};
+
+	std::vector<uint8_t> &mBuffer;
+	size_t mStart;
+	std::vector<Member> mMembers;
+};
+
+std::string getShape(size_t frames, size_t dimensions)
+{
+	if (dimensions == 1)
+	{
+		return "(" + std::to_string(frames) + ",)";
+	}
+	return "(" + std::to_string(frames) + ", " + std::to_string(dimensions) + ")";
+}
+
+template<typename T>
+const char *getColumnType(const std::vector<T> &)
+{
+	return getNumPyType(T());
+}
+
+template<typename T>
+const char *getColumnType(const std::vector<std::vector<T>> &)
+{
+	return getNumPyType(T());
+}
+
+template<typename T>
+void appendColumn(std::vector<uint8_t> &buffer, const std::vector<T> &values, size_t)
+{
+	for (const auto &value : values)
+	{
+		appendLittleEndian(buffer, value);
+	}
+}
+
+// Exactly dimensions values per frame so the data matches the shape, whatever a JSON input held
+template<typename T>
+void appendColumn(std::vector<uint8_t> &buffer, const std::vector<std::vector<T>> &frames, size_t dimensions)
+{
+	for (const auto &frame : frames)
+	{
+		for (size_t i = 0; i < dimensions; ++i)
+		{
+			appendLittleEndian(buffer, i < frame.size() ? frame[i] : T());
+		}
+	}
+}
+
+}
+
+void serializeNPZ(std::vector<uint8_t> &buffer, const ReplayFile &replay, const EncodeOptions &options)
+{
+	Trajectory trajectory;
+	if (options.positions)
+	{
+		reconstructTrajectory(replay, options.doublePrecisionPositions, trajectory);
+	}
+	std::vector<float> speeds;
+	if (options.speeds)
+	{
+		ReplayMetrics metrics;
+		computeReplayMetrics(replay, metrics, &speeds);
+	}
+
+	StageScope scope(Stage::EncodeColumns);
+	size_t start = buffer.size();
+	size_t positionsSize = (trajectory.x.size() * 3 + speeds.size()) * sizeof(float);
+	buffer.reserve(start + ReplayFile::cBinarySize * 2 + positionsSize + 4096);
+	NPZWriter writer(buffer);
+
+	std::string headerDescr = "[";
+	forEachField<ReplayFileHeader>([&headerDescr](const auto &field)
+	{
+		using Type = typename std::decay_t<decltype(field)>::Type;
+		headerDescr += std::string(headerDescr.size() > 1 ? ", " : "") + "('" + field.name + "', '" + getNumPyType(Type()) + "')";
+	});
+	headerDescr += "]";
+	writer.beginArray("header", headerDescr, "()");
+	forEachField<ReplayFileHeader>([&buffer, &replay](const auto &field)
+	{
+		appendLittleEndian(buffer, replay.header.*field.member);
+	});
+	writer.endArray();
+
+	// Frames as stored in the replay, JSON input may have a different count than cChunkSize
+	forEachColumn([&writer, &buffer, &replay](const auto &column, auto)
+	{
+		const auto &values = replay.*column.member;
+		writer.beginArray(column.name, std::string("'") + getColumnType(values) + "'", getShape(values.size(), column.dimensions));
+		appendColumn(buffer, values, column.dimensions);
+		writer.endArray();
+	});
+
+	if (options.positions)
+	{
+		writer.beginArray("playerPosition", "'<f4'", getShape(trajectory.x.size(), 3));
+		for (size_t i = 0; i < trajectory.x.size(); ++i)
+		{
+			appendLittleEndian(buffer, trajectory.x[i]);
+			appendLittleEndian(buffer, trajectory.y[i]);
+			appendLittleEndian(buffer, trajectory.z[i]);
+		}
+		writer.endArray();
+	}
+	if (options.speeds)
+	{
+		writer.beginArray("playerSpeed", "'<f4'", getShape(speeds.size(), 1));
+		for (float speed : speeds)
+		{
+			appendLittleEndian(buffer, speed);
+		}
+		writer.endArray();
+	}
+
+	writer.finish();
+	scope.setBytes(0, buffer.size() - start);
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "smb-replay.hpp"
+
+// NumPy export: an uncompressed .npz (a zip of stored .npy members), one array per column of
+// ReplayColumns in float32 (flags uint32), shaped (frames,) or (frames, dimensions). "header" is a
+// 0-d structured array with every header field. With options.positions "playerPosition" holds
+// the (frames, 3) absolute positions. Every array starts on a 64 byte boundary of the file, so
+// it can be mapped straight from the archive instead of being parsed.
+void serializeNPZ(std::vector<uint8_t> &buffer, const ReplayFile &replay, const EncodeOptions &options);
@@ -0,0 +1,1033 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "smb-replay.hpp"
+#include "stage-stats.hpp"
+#include "trajectory.hpp"
+#include "metrics.hpp"
+#include "npz.hpp"
+#include "csv.hpp"
+
+#include <chrono>
+#include <cctype>
+#include <cstdio>
+#include <iomanip>
+#include <ostream>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+const std::vector<FileFormatInfo> &getFileFormats()
+{
+	static const std::vector<FileFormatInfo> fileFormats = {
+		{ FileFormat::Binary, "binary", ".bin", true, true },
+		{ FileFormat::JSON, "json", ".json", true, true },
+		{ FileFormat::GCI, "gci", ".gci", true, true },
+		{ FileFormat::NPZ, "npz", ".npz", false, true },
+		{ FileFormat::CSV, "csv", ".csv", false, true },
+		{ FileFormat::JSONL, "jsonl", ".jsonl", false, true },
+	};
+	return fileFormats;
+}
+
+FileFormat getFileFormatByName(const std::string &name)
+{
+	for (const auto &info : getFileFormats())
+	{
+		if (name == info.name)
+		{
+			return info.format;
+		}
+	}
+	return FileFormat::Unknown;
+}
+
+FileFormat getFileFormatByExtension(const std::string &filename)
+{
+	auto dot = filename.find_last_of('.');
+	if (dot == std::string::npos)
+	{
+		return FileFormat::Unknown;
+	}
+	std::string extension = filename.substr(dot);
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](char c)
+	{
+		return static_cast<char>(tolower(static_cast<unsigned char>(c)));
+	});
+	for (const auto &info : getFileFormats())
+	{
+		if (extension == info.extension)
+		{
+			return info.format;
+		}
+	}
+	return FileFormat::Unknown;
+}
+
+const char *getFileFormatName(FileFormat format)
+{
+	for (const auto &info : getFileFormats())
+	{
+		if (format == info.format)
+		{
+			return info.name;
+		}
+	}
+	return "unknown";
+}
+
+const FileFormatInfo *getFileFormatInfo(FileFormat format)
+{
+	for (const auto &info : getFileFormats())
+	{
+		if (format == info.format)
+		{
+			return &info;
+		}
+	}
+	return nullptr;
+}
+
+// "-" reads standard input
+std::vector<uint8_t> loadFile(const std::string &filename)
+{
+	std::vector<uint8_t> buffer;
+	loadFile(filename, buffer);
+	return buffer;
+}
+
+bool loadFile(const std::string &filename, std::vector<uint8_t> &buf)
+{
+	buf.clear();
+	bool standardInput = filename == "-";
+	FILE *file = standardInput ? stdin : fopen(filename.c_str(), "rb");
+	if (!file)
+	{
+		return false;
+	}
+#ifdef _WIN32
+	if (standardInput)
+	{
+		_setmode(_fileno(stdin), _O_BINARY);
+	}
+#endif
+
+	bool seekable = !standardInput && fseek(file, 0, SEEK_END) == 0;
+	if (seekable)
+	{
+		long size = ftell(file);
+		fseek(file, 0, SEEK_SET);
+		if (size > 0)
+		{
+			buf.resize(size);
+			buf.resize(fread(buf.data(), 1, buf.size(), file));
+		}
+	}
+	// Pipes and files that don't know their size up front are read in chunks
+	if (!seekable || buf.empty())
+	{
+		const size_t cChunkSize = 64 * 1024;
+		size_t used = 0;
+		for (;;)
+		{
+			buf.resize(used + cChunkSize);
+			size_t count = fread(buf.data() + used, 1, cChunkSize, file);
+			used += count;
+			if (count < cChunkSize)
+			{
+				break;
+			}
+		}
+		buf.resize(used);
+	}
+
+	if (!standardInput)
+	{
+		fclose(file);
+	}
+	return true;
+}
+
+// "-" writes to standard output
+bool saveFile(const std::string &filename, BufferView buffer)
+{
+	bool standardOutput = filename == "-";
+	FILE *file = standardOutput ? stdout : fopen(filename.c_str(), "wb");
+	if (!file)
+	{
+		return false;
+	}
+#ifdef _WIN32
+	if (standardOutput)
+	{
+		_setmode(_fileno(stdout), _O_BINARY);
+	}
+#endif
+	bool written = fwrite(buffer.data, 1, buffer.size, file) == buffer.size;
+	return (standardOutput ? fflush(file) : fclose(file)) == 0 && written;
+}
+
+std::vector<uint8_t> stringToBuffer(const std::string &buffer)
+{
+	return std::vector<uint8_t>(buffer.begin(), buffer.end());
+}
+
+std::string bufferToString(BufferView buffer)
+{
+	return std::string(reinterpret_cast<const char *>(buffer.data), buffer.size);
+}
+
+std::vector<uint8_t> compressBufferRLE(BufferView buffer)
+{
+	std::vector<uint8_t> compressedBuffer;
+	compressBufferRLE(buffer, compressedBuffer);
+	return compressedBuffer;
+}
+
+void compressBufferRLE(BufferView buffer, std::vector<uint8_t> &compressedBuffer)
+{
+	// First, find sequences worth compressing
+	struct RepeatingRegion
+	{
+		RepeatingRegion(size_t offset, uint8_t value)
+			: offset(offset), value(value), count(0)
+		{}
+
+		size_t offset;
+		uint8_t value;
+		size_t count;
+	};
+	// Kept per thread so that batches don't reallocate it for every replay
+	thread_local std::vector<RepeatingRegion> repeatList;
+	repeatList.clear();
+	for (size_t i = 0; i < buffer.size; ++i)
+	{
+		if (repeatList.empty() || repeatList.back().count >= 0x7F || buffer.data[i] != repeatList.back().value)
+		{
+			repeatList.emplace_back(i, buffer.data[i]);
+		}
+		++repeatList.back().count;
+	}
+	// Remove regions not worth compressing
+	repeatList.erase(std::remove_if(repeatList.begin(), repeatList.end(), [](const auto &val)
+	{
+		return val.count <= 2;
+	}), repeatList.end());
+	// Write out compressed binary
+	size_t nextRegion = 0;
+	for (size_t i = 0; i < buffer.size; )
+	{
+		if (nextRegion < repeatList.size() && repeatList[nextRegion].offset == i)
+		{
+			const auto &region = repeatList[nextRegion];
+			compressedBuffer.emplace_back(static_cast<uint8_t>(region.count | 0x80));
+			compressedBuffer.emplace_back(region.value);
+			i += region.count;
+			++nextRegion;
+		}
+		else
+		{
+			// Write to end of buffer or to next compressed region
+			size_t length = nextRegion == repeatList.size() ? buffer.size - i : repeatList[nextRegion].offset - i;
+			// Can only write up to 0x7F bytes contiguously
+			for (size_t j = 0; j < length; j += 0x7F)
+			{
+				size_t tagLength = std::min(static_cast<size_t>(length - j), static_cast<size_t>(0x7Fu));
+				compressedBuffer.emplace_back(static_cast<uint8_t>(tagLength));
+				const uint8_t *sourceIt = buffer.data + i + j;
+				compressedBuffer.insert(compressedBuffer.end(), sourceIt, sourceIt + tagLength);
+			}
+			i += length;
+		}
+	}
+}
+
+std::vector<uint8_t> compressBufferRLEOptimal(BufferView buffer)
+{
+	std::vector<uint8_t> compressedBuffer;
+	compressBufferRLEOptimal(buffer, compressedBuffer);
+	return compressedBuffer;
+}
+
+void compressBufferRLEOptimal(BufferView buffer, std::vector<uint8_t> &compressedBuffer)
+{
+	// cost[i] is the smallest encoded size of the first i bytes. A run tag costs 2 bytes, a literal
+	// tag 1 plus its bytes, and both cover at most 0x7F bytes. cost never decreases with i, so the
+	// best run ending at i is the longest one, and the best literal ending at i starts where
+	// cost[j] - j is smallest among the last 0x7F positions.
+	const size_t cMaxTagLength = 0x7F;
+	size_t size = buffer.size;
+	// Kept per thread so that batches don't reallocate them for every replay
+	thread_local std::vector<size_t> cost;
+	// Length of the tag ending at i, runs have the high bit set
+	thread_local std::vector<uint8_t> tag;
+	cost.resize(size + 1);
+	tag.resize(size + 1);
+	// Never more than cMaxTagLength + 1 candidates, so a ring buffer indexed by ever increasing
+	// front and back positions holds them
+	const size_t cRingMask = 0x7F;
+	size_t literalStarts[cRingMask + 1];
+	size_t front = 0;
+	size_t back = 0;
+	size_t runLength = 0;
+	cost[0] = 0;
+	for (size_t i = 1; i <= size; ++i)
+	{
+		// Candidate starts are kept with increasing cost[j] - j
+		size_t start = i - 1;
+		while (front != back && cost[literalStarts[(back - 1) & cRingMask]] + start >= cost[start] + literalStarts[(back - 1) & cRingMask])
+		{
+			--back;
+		}
+		literalStarts[back++ & cRingMask] = start;
+		while (literalStarts[front & cRingMask] + cMaxTagLength < i)
+		{
+			++front;
+		}
+		size_t literalStart = literalStarts[front & cRingMask];
+		cost[i] = cost[literalStart] + (i - literalStart) + 1;
+		tag[i] = static_cast<uint8_t>(i - literalStart);
+
+		runLength = (i > 1 && buffer.data[i - 1] == buffer.data[i - 2]) ? runLength + 1 : 1;
+		size_t runStart = i - std::min(runLength, cMaxTagLength);
+		if (cost[runStart] + 2 < cost[i])
+		{
+			cost[i] = cost[runStart] + 2;
+			tag[i] = static_cast<uint8_t>((i - runStart) | 0x80);
+		}
+	}
+
+	size_t compressedStart = compressedBuffer.size();
+	compressedBuffer.resize(compressedStart + cost[size]);
+	size_t out = compressedBuffer.size();
+	for (size_t i = size; i > 0; )
+	{
+		size_t length = tag[i] & 0x7F;
+		i -= length;
+		if (tag[i + length] & 0x80)
+		{
+			out -= 2;
+			compressedBuffer[out] = tag[i + length];
+			compressedBuffer[out + 1] = buffer.data[i];
+		}
+		else
+		{
+			out -= length + 1;
+			compressedBuffer[out] = static_cast<uint8_t>(length);
+			std::copy(buffer.data + i, buffer.data + i + length, compressedBuffer.begin() + out + 1);
+		}
+	}
+}
+
+std::vector<uint8_t> decompressBufferRLE(BufferView buffer, size_t decompressedSize)
+{
+	std::vector<uint8_t> decompressedBuffer;
+	decompressBufferRLE(buffer, decompressedSize, decompressedBuffer);
+	return decompressedBuffer;
+}
+
+void decompressBufferRLE(BufferView buffer, size_t decompressedSize, std::vector<uint8_t> &decompressedBuffer)
+{
+	// The size comes from the file, only room for what buffer can actually produce is reserved
+	decompressedSize = std::min(decompressedSize, buffer.size * cMaxRLEExpansion);
+	size_t end = decompressedBuffer.size() + decompressedSize;
+	decompressedBuffer.reserve(end);
+	for (size_t i = 0; i < buffer.size && decompressedBuffer.size() < end; )
+	{
+		if (buffer.data[i] & 0x80)
+		{
+			// Truncated input, the value byte is missing
+			if (i + 1 >= buffer.size)
+			{
+				break;
+			}
+			decompressedBuffer.insert(decompressedBuffer.end(), buffer.data[i] & ~0x80, buffer.data[i + 1]);
+			i += 2;
+		}
+		else
+		{
+			// Make room
+			size_t length = std::min(static_cast<size_t>(buffer.data[i]), buffer.size - i - 1);
+			const uint8_t *sourceIt = buffer.data + i + 1;
+			decompressedBuffer.insert(decompressedBuffer.end(), sourceIt, sourceIt + length);
+			i += buffer.data[i] + 1;
+		}
+	}
+}
+
+namespace
+{
+
+struct CRCTable
+{
+	CRCTable()
+	{
+		const uint16_t polynomial = 0x1021;
+		for (unsigned byte = 0; byte < 256; ++byte)
+		{
+			uint16_t checksum = static_cast<uint16_t>(byte << 8);
+			for (size_t i = 0; i < 8; ++i)
+			{
+				checksum = (checksum & 0x8000) ? static_cast<uint16_t>((checksum << 1) ^ polynomial) : static_cast<uint16_t>(checksum << 1);
+			}
+			entries[byte] = checksum;
+		}
+	}
+
+	uint16_t entries[256];
+};
+
+const CRCTable cCRCTable;
+
+inline uint16_t updateCRC(uint16_t checksum, uint8_t value)
+{
+	return static_cast<uint16_t>((checksum << 8) ^ cCRCTable.entries[(checksum >> 8) ^ value]);
+}
+
+}
+
+void CRCState::update(const uint8_t *data, size_t size)
+{
+	uint16_t checksum = mState;
+	for (size_t i = 0; i < size; ++i)
+	{
+		checksum = updateCRC(checksum, data[i]);
+	}
+	mState = checksum;
+}
+
+uint16_t getCRCForBuffer(BufferView buffer)
+{
+	uint16_t checksum;
+	getCRCForBuffers(&buffer.data, &buffer.size, 1, &checksum);
+	return checksum;
+}
+
+void getCRCForBuffers(const uint8_t *const *buffers, const size_t *sizes, size_t count, uint16_t *checksums)
+{
+	// Every byte waits on the previous one's table lookup, so one buffer leaves the core idle most
+	// of the time. Four independent chains keep it busy.
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		uint16_t checksum0 = 0xFFFF, checksum1 = 0xFFFF, checksum2 = 0xFFFF, checksum3 = 0xFFFF;
+		size_t common = std::min(std::min(sizes[i], sizes[i + 1]), std::min(sizes[i + 2], sizes[i + 3]));
+		for (size_t j = 0; j < common; ++j)
+		{
+			checksum0 = updateCRC(checksum0, buffers[i][j]);
+			checksum1 = updateCRC(checksum1, buffers[i + 1][j]);
+			checksum2 = updateCRC(checksum2, buffers[i + 2][j]);
+			checksum3 = updateCRC(checksum3, buffers[i + 3][j]);
+		}
+		uint16_t lanes[4] = { checksum0, checksum1, checksum2, checksum3 };
+		for (size_t lane = 0; lane < 4; ++lane)
+		{
+			for (size_t j = common; j < sizes[i + lane]; ++j)
+			{
+				lanes[lane] = updateCRC(lanes[lane], buffers[i + lane][j]);
+			}
+			checksums[i + lane] = static_cast<uint16_t>(~lanes[lane]);
+		}
+	}
+	for (; i < count; ++i)
+	{
+		uint16_t checksum = 0xFFFF;
+		for (size_t j = 0; j < sizes[i]; ++j)
+		{
+			checksum = updateCRC(checksum, buffers[i][j]);
+		}
+		checksums[i] = static_cast<uint16_t>(~checksum);
+	}
+}
+
+template<>
+void serializeBinary<ReplayFileHeader>(std::vector<uint8_t> &buffer, const ReplayFileHeader &value)
+{
+	size_t start = buffer.size();
+	buffer.resize(start + FieldTable<ReplayFileHeader>::cSize);
+	writeFields(&buffer[start], value);
+}
+
+template<>
+void deserializeBinary<ReplayFileHeader>(BufferView &buffer, ReplayFileHeader &value)
+{
+	readFields(buffer.data, value);
+	buffer.skip(FieldTable<ReplayFileHeader>::cSize);
+}
+
+template<>
+void serializeJSON<ReplayFileHeader>(nlohmann::json &buffer, const std::string &name, const ReplayFileHeader &value)
+{
+	writeFieldsJSON(buffer[name], value);
+}
+
+template<>
+void deserializeJSON<ReplayFileHeader>(const nlohmann::json &buffer, const std::string &name, ReplayFileHeader &value)
+{
+	readFieldsJSON(buffer.at(name), value);
+}
+
+constexpr float ReplayFile::cPlayerPositionDeltaScale;
+constexpr float ReplayFile::cPlayerTiltScale;
+constexpr float ReplayFile::cData567Scale;
+constexpr float ReplayFile::cData8Scale;
+constexpr float ReplayFile::cStageTiltScale;
+
+template<>
+void serializeBinary<ReplayFile>(std::vector<uint8_t> &buffer, const ReplayFile &value)
+{
+	size_t start = buffer.size();
+	buffer.resize(start + ReplayFile::cBinarySize);
+	uint8_t *data = &buffer[start];
+	writeFields(data, value.header);
+	forEachColumn([data, &value](const auto &column, auto offset)
+	{
+		encodeColumn(data + offset, column, value);
+	});
+}
+
+template<>
+void deserializeBinary<ReplayFile>(BufferView &buffer, ReplayFile &value)
+{
+	const uint8_t *data = buffer.data;
+	readFields(data, value.header);
+	forEachColumn([data, &value](const auto &column, auto offset)
+	{
+		decodeColumn(data + offset, column, value);
+	});
+	buffer.skip(ReplayFile::cBinarySize);
+}
+
+bool deserializeBinaryColumn(BufferView buffer, const std::string &name, ReplayFile &value)
+{
+	if (buffer.size < ReplayFile::cBinarySize)
+	{
+		return false;
+	}
+	bool found = false;
+	forEachColumn([&buffer, &name, &value, &found](const auto &column, auto offset)
+	{
+		if (!found && name == column.name)
+		{
+			decodeColumn(buffer.data + offset, column, value);
+			found = true;
+		}
+	});
+	return found;
+}
+
+template<>
+void serializeJSON<ReplayFile>(nlohmann::json &buffer, const std::string &name, const ReplayFile &value)
+{
+	serializeJSON(buffer[name], "header", value.header);
+	serializeJSON(buffer[name], "playerPositionDelta", value.playerPositionDelta);
+	serializeJSON(buffer[name], "playerTilt", value.playerTilt);
+	serializeJSON(buffer[name], "data567", value.data567);
+	serializeJSON(buffer[name], "data8", value.data8);
+	serializeJSON(buffer[name], "stageTilt", value.stageTilt);
+	serializeJSON(buffer[name], "flags", value.flags);
+}
+
+template<>
+void deserializeJSON<ReplayFile>(const nlohmann::json &buffer, const std::string &name, ReplayFile &value)
+{
+	const auto &root = buffer.at(name);
+	deserializeJSON(root, "header", value.header);
+	deserializeJSON(root, "playerPositionDelta", value.playerPositionDelta);
+	deserializeJSON(root, "playerTilt", value.playerTilt);
+	deserializeJSON(root, "data567", value.data567);
+	// Short arrays only fill the front, zero the rest so a reused replay decodes like a fresh one
+	value.data8.assign(ReplayFile::cChunkSize, 0.f);
+	deserializeJSON(root, "data8", value.data8);
+	deserializeJSON(root, "stageTilt", value.stageTilt);
+	value.flags.assign(ReplayFile::cChunkSize, 0);
+	deserializeJSON(root, "flags", value.flags);
+}
+
+const std::string GCIFile::cGameName = "Super Monkey Ball";
+
+template<>
+void serializeBinary<GCIFile>(std::vector<uint8_t> &buffer, const GCIFile &value)
+{
+	size_t start = buffer.size();
+	buffer.resize(start + FieldTable<GCIFile>::cSize);
+	writeFields(&buffer[start], value);
+}
+
+
+std::string getReplayComment(const ReplayFileHeader &header, const std::string &comment, int padFloorNumber)
+{
+	std::string replayName;
+	switch (header.levelDifficulty)
+	{
+	case 0:
+		replayName.append("B");
+		break;
+	case 1:
+		replayName.append("A");
+		break;
+	case 2:
+		replayName.append("E");
+		break;
+	case 8:
+		replayName.append("W");
+		break;
+	case 9:
+		replayName.append("D");
+		break;
+	case 14:
+		replayName.append("Y");
+		break;
+	case 16:
+		replayName.append("N");
+		break;
+	default:
+		replayName.append("U");
+		break;
+	}
+	std::string floorStringPadded = std::to_string(header.levelFloor);
+	if (static_cast<int>(floorStringPadded.size()) < padFloorNumber)
+	{
+		floorStringPadded.insert(0, padFloorNumber - static_cast<int>(floorStringPadded.size()), '0');
+	}
+	replayName.append(floorStringPadded).append(" ");
+	replayName.append(comment);
+
+	if (replayName.size() >= GCIFile::cCommentFieldSize)
+	{
+		// #todo-smb-build-replay: Is null termination required?
+		replayName.resize(GCIFile::cCommentFieldSize - 1);
+	}
+	return replayName;
+}
+
+std::string getGCIFilename()
+{
+	// We fill out this one so that files don't collide.
+	// Not accurate since the GC epoch is 2000 and not 1970, but unique.
+	uint64_t timestamp;
+	{
+		using namespace std::chrono;
+		timestamp = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count() * 40500;
+	}
+	char filename[21];
+	snprintf(filename, sizeof(filename), "smkb%016llx", static_cast<unsigned long long>(timestamp));
+	return std::string(filename);
+}
+
+size_t getGCIBlockCount(size_t compressedSize)
+{
+	size_t finalSize = compressedSize + GCIFile::cReplayDataOffset + sizeof(uint64_t);
+	return ((finalSize + GCIFile::cBlockSize - 1) & ~(GCIFile::cBlockSize - 1)) / 0x2000;
+}
+
+namespace
+{
+
+// Uncompressed payload of the GCI being encoded or decoded. Kept per thread, so batch conversions
+// stop allocating it once it has grown to the size of a replay.
+thread_local std::vector<uint8_t> tPayloadBuffer;
+
+}
+
+void serializeGCI(std::vector<uint8_t> &buffer, const ReplayFile &replay, const EncodeOptions &options)
+{
+	auto &uncompressedBuffer = tPayloadBuffer;
+	uncompressedBuffer.clear();
+	{
+		StageScope scope(Stage::EncodeColumns);
+		serializeBinary(uncompressedBuffer, replay);
+		scope.setBytes(0, uncompressedBuffer.size());
+	}
+
+	// Everything goes straight into buffer, sized for the worst case compression up front. The block
+	// count and CRC come before the data they depend on and are filled in at the end.
+	size_t start = buffer.size();
+	size_t maxCompressedSize = uncompressedBuffer.size() + (uncompressedBuffer.size() + 0x7E) / 0x7F;
+	buffer.reserve(start + getGCIBlockCount(maxCompressedSize) * GCIFile::cBlockSize + GCIFile::cHeaderSize);
+
+	GCIFile gci;
+	gci.filename = options.gciFilename;
+	serializeBinary(buffer, gci);
+	serializeBinary(buffer, static_cast<uint16_t>(0));
+	size_t dataStart = buffer.size();
+
+	serializeBinary(buffer, replay.header.flags);
+	serializeBinary(buffer, replay.header.levelID);
+	serializeBinary(buffer, replay.header.levelDifficulty);
+	serializeBinary(buffer, replay.header.levelFloor);
+	serializeBinary(buffer, static_cast<uint8_t>(0));
+	serializeBinary(buffer, replay.header.scorePoints);
+	serializeBinary(buffer, static_cast<uint32_t>(0)); // timestamp
+	buffer.insert(buffer.end(), ((96 * 32) + (32 * 32)) * 2, 0xCC); // some color
+
+	auto appendComment = [&buffer](const std::string &comment)
+	{
+		size_t length = std::min(comment.size(), static_cast<size_t>(GCIFile::cCommentFieldSize));
+		buffer.insert(buffer.end(), comment.begin(), comment.begin() + length);
+		buffer.insert(buffer.end(), GCIFile::cCommentFieldSize - length, 0);
+	};
+	appendComment(GCIFile::cGameName);
+	appendComment(options.replayComment);
+	serializeBinary(buffer, static_cast<uint64_t>(uncompressedBuffer.size()));
+
+	CRCState checksum;
+	{
+		StageScope scope(Stage::CRC);
+		checksum.update(&buffer[dataStart], buffer.size() - dataStart);
+		scope.setBytes(buffer.size() - dataStart, 0);
+	}
+
+	size_t compressedStart = buffer.size();
+	{
+		StageScope scope(Stage::Compress);
+		if (options.optimalRLE)
+		{
+			compressBufferRLEOptimal(uncompressedBuffer, buffer);
+		}
+		else
+		{
+			compressBufferRLE(uncompressedBuffer, buffer);
+		}
+		scope.setBytes(uncompressedBuffer.size(), buffer.size() - compressedStart);
+	}
+
+	size_t blockCount = getGCIBlockCount(buffer.size() - compressedStart);
+	if (options.savedBlocks)
+	{
+		*options.savedBlocks = options.optimalRLE ? getGCIBlockCount(compressBufferRLE(uncompressedBuffer).size()) - blockCount : 0;
+	}
+	buffer.resize(start + GCIFile::cHeaderSize + blockCount * GCIFile::cBlockSize, 0);
+
+	{
+		StageScope scope(Stage::CRC);
+		checksum.update(&buffer[compressedStart], buffer.size() - compressedStart);
+		scope.setBytes(buffer.size() - compressedStart, 0);
+	}
+	writeBigEndian(&buffer[start + GCIFile::cBlockCountOffset], static_cast<uint16_t>(blockCount));
+	writeBigEndian(&buffer[start + GCIFile::cHeaderSize], checksum.get());
+}
+
+void serializeGCI(std::vector<uint8_t> &buffer, const ReplayFile &replay, const std::string &replayComment, const std::string &filename)
+{
+	EncodeOptions options;
+	options.replayComment = replayComment;
+	options.gciFilename = filename;
+	serializeGCI(buffer, replay, options);
+}
+
+namespace
+{
+
+// Into tPayloadBuffer, false unless that holds a whole binary replay
+bool decompressGCIPayload(BufferView buffer)
+{
+	if (buffer.size < GCIFile::cReplayDataOffset + sizeof(uint64_t))
+	{
+		return false;
+	}
+	auto &decompressedData = tPayloadBuffer;
+	decompressedData.clear();
+	StageScope scope(Stage::Decompress);
+	size_t gciSize = buffer.size;
+	buffer.skip(GCIFile::cReplayDataOffset);
+	uint64_t decompressedSize;
+	deserializeBinary(buffer, decompressedSize);
+	// More than the payload can expand to, the file is corrupt
+	if (decompressedSize > buffer.size * cMaxRLEExpansion)
+	{
+		return false;
+	}
+	decompressBufferRLE(buffer, static_cast<size_t>(decompressedSize), decompressedData);
+	scope.setBytes(gciSize, decompressedData.size());
+	return decompressedData.size() >= ReplayFile::cBinarySize;
+}
+
+}
+
+bool deserializeGCI(BufferView buffer, ReplayFile &replay)
+{
+	if (!decompressGCIPayload(buffer))
+	{
+		return false;
+	}
+	auto &decompressedData = tPayloadBuffer;
+	{
+		StageScope scope(Stage::DecodeColumns);
+		scope.setBytes(decompressedData.size(), 0);
+		BufferView decompressedView(decompressedData);
+		deserializeBinary(decompressedView, replay);
+	}
+	return true;
+}
+
+bool deserializeGCIHeader(BufferView buffer, ReplayFileHeader &header)
+{
+	if (buffer.size < GCIFile::cReplayDataOffset + sizeof(uint64_t))
+	{
+		return false;
+	}
+	// Only the first few bytes of the payload need to be decompressed
+	buffer.skip(GCIFile::cReplayDataOffset + sizeof(uint64_t));
+	auto &headerData = tPayloadBuffer;
+	headerData.clear();
+	decompressBufferRLE(buffer, ReplayFile::cHeaderSize, headerData);
+	if (headerData.size() < ReplayFile::cHeaderSize)
+	{
+		return false;
+	}
+	BufferView headerView(headerData);
+	deserializeBinary(headerView, header);
+	return true;
+}
+
+bool decodeReplay(FileFormat format, BufferView buffer, ReplayFile &replay)
+{
+	if (format == FileFormat::Binary)
+	{
+		if (buffer.size < ReplayFile::cBinarySize)
+		{
+			return false;
+		}
+		StageScope scope(Stage::DecodeColumns);
+		scope.setBytes(buffer.size, 0);
+		deserializeBinary(buffer, replay);
+	}
+	else if (format == FileFormat::JSON)
+	{
+		nlohmann::json inputJSON;
+		{
+			StageScope scope(Stage::ParseJSON);
+			scope.setBytes(buffer.size, 0);
+			inputJSON = nlohmann::json::parse(buffer.data, buffer.data + buffer.size);
+		}
+		StageScope scope(Stage::DecodeJSON);
+		deserializeJSON(inputJSON, "root", replay);
+	}
+	else if (format == FileFormat::GCI)
+	{
+		return deserializeGCI(buffer, replay);
+	}
+	else
+	{
+		return false;
+	}
+	return true;
+}
+
+bool decodeReplayColumns(FileFormat format, BufferView buffer, const std::vector<std::string> &columns, ReplayFile &replay)
+{
+	if (format == FileFormat::JSON)
+	{
+		return decodeReplay(format, buffer, replay);
+	}
+	if (format == FileFormat::GCI)
+	{
+		if (!decompressGCIPayload(buffer))
+		{
+			return false;
+		}
+		buffer = BufferView(tPayloadBuffer);
+	}
+	else if (format != FileFormat::Binary || buffer.size < ReplayFile::cBinarySize)
+	{
+		return false;
+	}
+
+	StageScope scope(Stage::DecodeColumns);
+	scope.setBytes(buffer.size, 0);
+	for (const auto &column : columns)
+	{
+		if (!deserializeBinaryColumn(buffer, column, replay))
+		{
+			return false;
+		}
+	}
+	deserializeBinary(buffer, replay.header);
+	return true;
+}
+
+bool decodeReplayJSON(std::istream &stream, ReplayFile &replay)
+{
+	nlohmann::json inputJSON;
+	{
+		// Reading the stream is part of parsing here
+		StageScope scope(Stage::ParseJSON);
+		inputJSON = nlohmann::json::parse(stream);
+	}
+	StageScope scope(Stage::DecodeJSON);
+	deserializeJSON(inputJSON, "root", replay);
+	return true;
+}
+
+bool decodeReplayHeader(FileFormat format, BufferView buffer, ReplayFileHeader &header)
+{
+	if (format == FileFormat::Binary)
+	{
+		if (buffer.size < ReplayFile::cHeaderSize)
+		{
+			return false;
+		}
+		deserializeBinary(buffer, header);
+	}
+	else if (format == FileFormat::JSON)
+	{
+		nlohmann::json inputJSON = nlohmann::json::parse(buffer.data, buffer.data + buffer.size);
+		deserializeJSON(inputJSON.at("root"), "header", header);
+	}
+	else if (format == FileFormat::GCI)
+	{
+		return deserializeGCIHeader(buffer, header);
+	}
+	else
+	{
+		return false;
+	}
+	return true;
+}
+
+namespace
+{
+
+// Lets the JSON library write straight into the output instead of building a string first
+class AppendBuffer : public std::streambuf
+{
+public:
+	explicit AppendBuffer(std::vector<uint8_t> &buffer) : mBuffer(buffer)
+	{
+	}
+
+protected:
+	int_type overflow(int_type c) override
+	{
+		if (!traits_type::eq_int_type(c, traits_type::eof()))
+		{
+			mBuffer.push_back(static_cast<uint8_t>(c));
+		}
+		return traits_type::not_eof(c);
+	}
+
+	std::streamsize xsputn(const char *data, std::streamsize count) override
+	{
+		mBuffer.insert(mBuffer.end(), data, data + count);
+		return count;
+	}
+
+private:
+	std::vector<uint8_t> &mBuffer;
+};
+
+// The document of FileFormat::JSON, the replay under "root"
+void buildReplayJSON(nlohmann::json &outputJSON, const ReplayFile &replay, const EncodeOptions &options)
+{
+	Trajectory trajectory;
+	if (options.positions)
+	{
+		reconstructTrajectory(replay, options.doublePrecisionPositions, trajectory);
+	}
+	std::vector<float> speeds;
+	if (options.speeds)
+	{
+		ReplayMetrics metrics;
+		computeReplayMetrics(replay, metrics, &speeds);
+	}
+	StageScope scope(Stage::EncodeJSON);
+	serializeJSON(outputJSON, "root", replay);
+	if (options.positions)
+	{
+		auto &positions = outputJSON["root"]["playerPosition"];
+		positions = nlohmann::json::array();
+		for (size_t i = 0; i < trajectory.x.size(); ++i)
+		{
+			positions.push_back({ trajectory.x[i], trajectory.y[i], trajectory.z[i] });
+		}
+	}
+	if (options.speeds)
+	{
+		outputJSON["root"]["playerSpeed"] = speeds;
+	}
+}
+
+}
+
+void serializeJSONLine(std::vector<uint8_t> &buffer, const ReplayFile &replay, const std::string *name, const EncodeOptions &options)
+{
+	nlohmann::json outputJSON;
+	if (options.headerOnly)
+	{
+		StageScope scope(Stage::EncodeJSON);
+		// Same shape as a full line, just without the frames
+		serializeJSON(outputJSON["root"], "header", replay.header);
+	}
+	else
+	{
+		buildReplayJSON(outputJSON, replay, options);
+	}
+
+	StageScope scope(Stage::DumpJSON);
+	size_t startSize = buffer.size();
+	AppendBuffer output(buffer);
+	std::ostream stream(&output);
+	if (name)
+	{
+		// Keys are written sorted, the name goes in front by hand so stream parsers see it first
+		stream << "{\"replay\":" << nlohmann::json(*name) << ',';
+		size_t objectStart = buffer.size();
+		stream << outputJSON["root"];
+		buffer.erase(buffer.begin() + objectStart);
+	}
+	else
+	{
+		stream << outputJSON["root"];
+	}
+	buffer.push_back('\n');
+	scope.setBytes(0, buffer.size() - startSize);
+}
+
+bool encodeReplay(FileFormat format, const ReplayFile &replay, const EncodeOptions &options, std::vector<uint8_t> &buffer)
+{
+	if (format == FileFormat::Binary)
+	{
+		StageScope scope(Stage::EncodeColumns);
+		size_t startSize = buffer.size();
+		serializeBinary(buffer, replay);
+		scope.setBytes(0, buffer.size() - startSize);
+	}
+	else if (format == FileFormat::JSON)
+	{
+		nlohmann::json outputJSON;
+		buildReplayJSON(outputJSON, replay, options);
+		StageScope scope(Stage::DumpJSON);
+		size_t startSize = buffer.size();
+		AppendBuffer output(buffer);
+		std::ostream stream(&output);
+		if (options.prettyJSON)
+		{
+			stream << std::setw(2);
+		}
+		stream << outputJSON;
+		scope.setBytes(0, buffer.size() - startSize);
+	}
+	else if (format == FileFormat::GCI)
+	{
+		serializeGCI(buffer, replay, options);
+	}
+	else if (format == FileFormat::NPZ)
+	{
+		serializeNPZ(buffer, replay, options);
+	}
+	else if (format == FileFormat::CSV)
+	{
+		serializeCSV(buffer, replay, options);
+	}
+	else if (format == FileFormat::JSONL)
+	{
+		serializeJSONLine(buffer, replay, nullptr, options);
+	}
+	else
+	{
+		return false;
+	}
+	return true;
+}
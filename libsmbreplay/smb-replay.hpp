@@ -0,0 +1,776 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <istream>
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "json.hpp"
+
+enum class FileFormat
+{
+	Unknown,
+	Binary,
+	JSON,
+	GCI,
+	// NumPy arrays for analysis, encode only, see serializeNPZ
+	NPZ,
+	// A row per frame, encode only, see serializeCSV
+	CSV,
+	// A compact replay object per line, encode only, see serializeJSONLine
+	JSONL,
+};
+
+struct FileFormatInfo
+{
+	FileFormat format;
+	const char *name;
+	const char *extension;
+	bool canDecode;
+	bool canEncode;
+};
+
+// Every format the tools know about, in the order they are listed in help texts
+const std::vector<FileFormatInfo> &getFileFormats();
+FileFormat getFileFormatByName(const std::string &name);
+// Guesses the format from the file extension, used when walking corpora
+FileFormat getFileFormatByExtension(const std::string &filename);
+const char *getFileFormatName(FileFormat format);
+// Null for FileFormat::Unknown
+const FileFormatInfo *getFileFormatInfo(FileFormat format);
+
+// Bytes owned by someone else. The decoders take their input this way and read it from the front
+// by advancing the view, so nothing is copied until a format actually transforms the data.
+struct BufferView
+{
+	BufferView() = default;
+	BufferView(const uint8_t *data, size_t size) : data(data), size(size) {}
+	BufferView(const std::vector<uint8_t> &buffer) : data(buffer.data()), size(buffer.size()) {}
+
+	void skip(size_t count)
+	{
+		data += count;
+		size -= count;
+	}
+
+	const uint8_t *data = nullptr;
+	size_t size = 0;
+};
+
+// "-" is standard input/output. Inputs that can't seek are read in chunks.
+std::vector<uint8_t> loadFile(const std::string &filename);
+// Into buffer instead, reusing its capacity. False if the file can't be opened.
+bool loadFile(const std::string &filename, std::vector<uint8_t> &buffer);
+bool saveFile(const std::string &filename, BufferView buffer);
+
+std::vector<uint8_t> stringToBuffer(const std::string &buffer);
+std::string bufferToString(BufferView buffer);
+
+std::vector<uint8_t> compressBufferRLE(BufferView buffer);
+// Append to compressedBuffer instead
+void compressBufferRLE(BufferView buffer, std::vector<uint8_t> &compressedBuffer);
+// Smallest encoding the decoder accepts, for when a byte decides the GCI block count. About 1.5x slower.
+std::vector<uint8_t> compressBufferRLEOptimal(BufferView buffer);
+void compressBufferRLEOptimal(BufferView buffer, std::vector<uint8_t> &compressedBuffer);
+// A 2 byte run is at most 127 bytes, so RLE data never decompresses to more than this many times its size
+static const size_t cMaxRLEExpansion = 64;
+// Decompresses up to decompressedSize bytes, less if buffer ends first
+std::vector<uint8_t> decompressBufferRLE(BufferView buffer, size_t decompressedSize);
+void decompressBufferRLE(BufferView buffer, size_t decompressedSize, std::vector<uint8_t> &decompressedBuffer);
+
+uint16_t getCRCForBuffer(BufferView buffer);
+// The same checksum fed piece by piece, e.g. while the data is being written
+class CRCState
+{
+public:
+	void update(const uint8_t *data, size_t size);
+	uint16_t get() const { return static_cast<uint16_t>(~mState); }
+
+private:
+	uint16_t mState = 0xFFFF;
+};
+// Checksums of count buffers, same as getCRCForBuffer for each but several times faster on batches of four
+void getCRCForBuffers(const uint8_t *const *buffers, const size_t *sizes, size_t count, uint16_t *checksums);
+
+template<typename T>
+void serializeBinary(std::vector<uint8_t> &buffer, const T &value)
+{
+	for (size_t i = sizeof(T); i > 0; --i)
+	{
+		buffer.emplace_back(static_cast<uint8_t>((value >> (i - 1) * 8) & 0xFF));
+	}
+}
+
+// Patches a value serializeBinary wrote earlier
+template<typename T>
+void writeBigEndian(uint8_t *data, const T &value)
+{
+	for (size_t i = sizeof(T); i > 0; --i)
+	{
+		*data++ = static_cast<uint8_t>((value >> (i - 1) * 8) & 0xFF);
+	}
+}
+
+// Counterpart of writeBigEndian for fixed offset reads
+template<typename T>
+void readBigEndian(const uint8_t *data, T &value)
+{
+	value = 0;
+	for (size_t i = 0; i < sizeof(T); ++i)
+	{
+		value |= static_cast<T>(data[i]) << ((sizeof(T) - 1 - i) * 8);
+	}
+}
+
+inline void writeBigEndian(uint8_t *data, const float &value)
+{
+	uint32_t rawValue;
+	memcpy(&rawValue, &value, sizeof(rawValue));
+	writeBigEndian(data, rawValue);
+}
+
+inline void readBigEndian(const uint8_t *data, float &value)
+{
+	uint32_t rawValue;
+	readBigEndian(data, rawValue);
+	memcpy(&value, &rawValue, sizeof(value));
+}
+
+// Zip, .npy and Arrow are little endian no matter the host
+template<typename T>
+void writeLittleEndian(uint8_t *data, const T &value)
+{
+	for (size_t i = 0; i < sizeof(T); ++i)
+	{
+		data[i] = static_cast<uint8_t>((value >> (i * 8)) & 0xFF);
+	}
+}
+
+inline void writeLittleEndian(uint8_t *data, const float &value)
+{
+	uint32_t rawValue;
+	memcpy(&rawValue, &value, sizeof(rawValue));
+	writeLittleEndian(data, rawValue);
+}
+
+template<typename T>
+void appendLittleEndian(std::vector<uint8_t> &buffer, const T &value)
+{
+	size_t offset = buffer.size();
+	buffer.resize(offset + sizeof(T));
+	writeLittleEndian(&buffer[offset], value);
+}
+
+template<typename T>
+void deserializeBinary(BufferView &buffer, T &value)
+{
+	value = 0;
+	for (size_t i = 0; i < sizeof(T); ++i)
+	{
+		value |= static_cast<T>(buffer.data[i]) << ((sizeof(T) - 1 - i) * 8);
+	}
+	buffer.skip(sizeof(T));
+}
+
+template<typename T>
+void serializeJSON(nlohmann::json &buffer, const std::string &name, const T &value)
+{
+	buffer[name] = value;
+}
+
+template<typename T>
+void deserializeJSON(const nlohmann::json &buffer, const std::string &name, T &value)
+{
+	value = buffer.at(name);
+}
+
+template<typename T>
+void serializeBinary(std::vector<uint8_t> &buffer, const std::vector<T> &vector)
+{
+	for (const auto &element : vector)
+	{
+		serializeBinary(buffer, element);
+	}
+}
+
+template<typename T>
+void deserializeBinary(BufferView &buffer, std::vector<T> &vector)
+{
+	for (auto &element : vector)
+	{
+		deserializeBinary(buffer, element);
+	}
+}
+
+template<typename T>
+void serializeJSON(nlohmann::json &buffer, const std::string &name, const std::vector<T> &vector)
+{
+	for (const auto &element : vector)
+	{
+		buffer[name].emplace_back(element);
+	}
+}
+
+template<typename T>
+void deserializeJSON(const nlohmann::json &buffer, const std::string &name, std::vector<T> &vector)
+{
+	const auto &array = buffer.at(name);
+	for (size_t i = 0; i < vector.size() && i < array.size(); ++i)
+	{
+		vector[i] = static_cast<T>(array[i]);
+	}
+}
+
+// Frames of differing length, e.g. the per-frame vectors of a replay. Existing elements are
+// overwritten rather than reallocated.
+template<typename T>
+void deserializeJSON(const nlohmann::json &buffer, const std::string &name, std::vector<std::vector<T>> &vector)
+{
+	const auto &array = buffer.at(name);
+	vector.resize(array.size());
+	for (size_t i = 0; i < array.size(); ++i)
+	{
+		const auto &element = array[i];
+		vector[i].resize(element.size());
+		for (size_t j = 0; j < element.size(); ++j)
+		{
+			vector[i][j] = static_cast<T>(element[j]);
+		}
+	}
+}
+
+template<>
+inline void serializeBinary(std::vector<uint8_t> &buffer, const float &value)
+{
+	const uint32_t &rawValue = reinterpret_cast<const uint32_t &>(value);
+	for (size_t i = 4; i > 0; --i)
+	{
+		buffer.emplace_back((rawValue >> (i - 1) * 8) & 0xFF);
+	}
+}
+
+template<>
+inline void deserializeBinary(BufferView &buffer, float &value)
+{
+	uint32_t rawValue;
+	deserializeBinary(buffer, rawValue);
+	value = *reinterpret_cast<float *>(&rawValue);
+}
+
+// Entry of a FieldTable: JSON key, member, byte offset in the serialized struct and its size there
+template<typename S, typename T>
+struct FieldDescriptor
+{
+	using Type = T;
+	const char *name;
+	T S::*member;
+	size_t offset;
+	size_t size;
+};
+
+template<typename S, typename T>
+constexpr FieldDescriptor<S, T> makeField(const char *name, T S::*member, size_t offset, size_t size = sizeof(T))
+{
+	return { name, member, offset, size };
+}
+
+// Specialized for every struct with a fixed big endian layout: cSize bytes serialized, and a
+// constexpr get() returning a tuple of FieldDescriptors in file order. The visitors below expand
+// over the tuple at compile time, so a new field only needs its line in the table.
+template<typename S>
+struct FieldTable;
+
+template<typename Visitor, typename Fields, size_t... I>
+void forEachField(Visitor &&visitor, const Fields &fields, std::index_sequence<I...>)
+{
+	int expand[] = { 0, (visitor(std::get<I>(fields)), 0)... };
+	(void)expand;
+}
+
+template<typename S, typename Visitor>
+void forEachField(Visitor &&visitor)
+{
+	constexpr auto fields = FieldTable<S>::get();
+	forEachField(visitor, fields, std::make_index_sequence<std::tuple_size<decltype(fields)>::value>());
+}
+
+// True if the fields cover [0, size) in order without gaps or overlaps
+template<typename Fields, size_t... I>
+constexpr bool areFieldsContiguous(const Fields &fields, size_t size, std::index_sequence<I...>)
+{
+	const size_t offsets[] = { std::get<I>(fields).offset... };
+	const size_t sizes[] = { std::get<I>(fields).size... };
+	size_t end = 0;
+	for (size_t i = 0; i < sizeof...(I); ++i)
+	{
+		if (offsets[i] != end)
+		{
+			return false;
+		}
+		end += sizes[i];
+	}
+	return end == size;
+}
+
+template<typename S>
+constexpr bool areFieldsContiguous()
+{
+	return areFieldsContiguous(FieldTable<S>::get(), FieldTable<S>::cSize,
+		std::make_index_sequence<std::tuple_size<decltype(FieldTable<S>::get())>::value>());
+}
+
+template<typename S, typename T>
+void writeField(uint8_t *data, const FieldDescriptor<S, T> &field, const S &value)
+{
+	writeBigEndian(data + field.offset, value.*field.member);
+}
+
+// Strings are stored zero padded to the field size
+template<typename S>
+void writeField(uint8_t *data, const FieldDescriptor<S, std::string> &field, const S &value)
+{
+	const std::string &text = value.*field.member;
+	size_t length = std::min(text.size(), field.size);
+	memcpy(data + field.offset, text.data(), length);
+	memset(data + field.offset + length, 0, field.size - length);
+}
+
+template<typename S, typename T>
+void readField(const uint8_t *data, const FieldDescriptor<S, T> &field, S &value)
+{
+	readBigEndian(data + field.offset, value.*field.member);
+}
+
+template<typename S>
+void readField(const uint8_t *data, const FieldDescriptor<S, std::string> &field, S &value)
+{
+	const char *text = reinterpret_cast<const char *>(data + field.offset);
+	(value.*field.member).assign(text, std::find(text, text + field.size, '\0'));
+}
+
+// Writes value to the FieldTable<S>::cSize bytes at data
+template<typename S>
+void writeFields(uint8_t *data, const S &value)
+{
+	forEachField<S>([data, &value](const auto &field) { writeField(data, field, value); });
+}
+
+template<typename S>
+void readFields(const uint8_t *data, S &value)
+{
+	forEachField<S>([data, &value](const auto &field) { readField(data, field, value); });
+}
+
+template<typename S>
+void writeFieldsJSON(nlohmann::json &object, const S &value)
+{
+	forEachField<S>([&object, &value](const auto &field) { object[field.name] = value.*field.member; });
+}
+
+template<typename S>
+void readFieldsJSON(const nlohmann::json &object, S &value)
+{
+	forEachField<S>([&object, &value](const auto &field) { value.*field.member = object.at(field.name); });
+}
+
+struct ReplayFileHeader
+{
+	uint16_t flags;
+	uint8_t levelID;
+	uint8_t levelDifficulty;
+	uint8_t levelFloor;
+	uint8_t  monkeyType;
+	uint16_t unk_06;
+	uint32_t unk_08;
+	uint32_t unk_0c;
+	uint32_t scorePoints;
+	uint32_t unk_14;
+	uint16_t levelMaxTime;
+	uint16_t replayTotalTime;
+	uint16_t scoreTimeRemaining;
+	uint16_t unk_1E;
+	uint32_t timeWithScore;
+	float	 unk_24;
+	float	 unk_28;
+	float	 unk_2c;
+	uint32_t unk_30;
+	uint32_t unk_34; // same as replayTotalTime in all examples
+	float	 startPositionX;
+	float	 startPositionY;
+	float	 startPositionZ;
+};
+
+template<>
+struct FieldTable<ReplayFileHeader>
+{
+	static const size_t cSize = 0x44;
+
+	static constexpr auto get()
+	{
+		using H = ReplayFileHeader;
+		return std::make_tuple(
+			makeField("flags", &H::flags, 0x00),
+			makeField("levelID", &H::levelID, 0x02),
+			makeField("levelDifficulty", &H::levelDifficulty, 0x03),
+			makeField("levelFloor", &H::levelFloor, 0x04),
+			makeField("monkeyType", &H::monkeyType, 0x05),
+			makeField("unk_06", &H::unk_06, 0x06),
+			makeField("unk_08", &H::unk_08, 0x08),
+			makeField("unk_0c", &H::unk_0c, 0x0C),
+			makeField("scorePoints", &H::scorePoints, 0x10),
+			makeField("unk_14", &H::unk_14, 0x14),
+			makeField("levelMaxTime", &H::levelMaxTime, 0x18),
+			makeField("replayTotalTime", &H::replayTotalTime, 0x1A),
+			makeField("scoreTimeRemaining", &H::scoreTimeRemaining, 0x1C),
+			makeField("unk_1E", &H::unk_1E, 0x1E),
+			makeField("timeWithScore", &H::timeWithScore, 0x20),
+			makeField("unk_24", &H::unk_24, 0x24),
+			makeField("unk_28", &H::unk_28, 0x28),
+			makeField("unk_2c", &H::unk_2c, 0x2C),
+			makeField("unk_30", &H::unk_30, 0x30),
+			makeField("unk_34", &H::unk_34, 0x34),
+			makeField("startPositionX", &H::startPositionX, 0x38),
+			makeField("startPositionY", &H::startPositionY, 0x3C),
+			makeField("startPositionZ", &H::startPositionZ, 0x40));
+	}
+};
+static_assert(areFieldsContiguous<ReplayFileHeader>(), "ReplayFileHeader field table has gaps");
+
+template<>
+void serializeBinary<ReplayFileHeader>(std::vector<uint8_t> &buffer, const ReplayFileHeader &value);
+template<>
+void deserializeBinary<ReplayFileHeader>(BufferView &buffer, ReplayFileHeader &value);
+template<>
+void serializeJSON<ReplayFileHeader>(nlohmann::json &buffer, const std::string &name, const ReplayFileHeader &value);
+template<>
+void deserializeJSON<ReplayFileHeader>(const nlohmann::json &buffer, const std::string &name, ReplayFileHeader &value);
+
+struct ReplayFile
+{
+	ReplayFileHeader header;
+	std::vector<std::vector<float>> playerPositionDelta;
+	std::vector<std::vector<float>> playerTilt;
+	std::vector<std::vector<float>> data567;
+	std::vector<float> data8;
+	std::vector<uint32_t> flags;
+	std::vector<std::vector<float>> stageTilt;
+
+	static const size_t cChunkSize = 0xF00;
+	static const size_t cHeaderSize = 0x44;
+	// Header plus every column: 3x int16, 3x int16, 3x int8, int8, uint32, 2x int16 per frame
+	static const size_t cBinarySize = cHeaderSize + cChunkSize * 24;
+	static constexpr float cPlayerPositionDeltaScale = 1.f / 16383.f;
+	static constexpr float cPlayerTiltScale = 180.f / 32767.f;
+	static constexpr float cData567Scale = 256.f;
+	static constexpr float cData8Scale = 1.f / 127.f;
+	static constexpr float cStageTiltScale = 110.f / 32767.f;
+};
+
+// Column of the replay body: cChunkSize frames of dimensions values, stored as Storage. Each
+// dimension is a block of sizeof(Storage) byte planes, least significant first, so every byte
+// plane is cChunkSize bytes. Stored values decode to raw * scale, integer columns are unscaled.
+template<typename Storage, typename Column>
+struct ColumnDescriptor
+{
+	using StorageType = Storage;
+	const char *name;
+	Column ReplayFile::*member;
+	size_t dimensions;
+	float scale;
+};
+
+template<typename Storage, typename Column>
+constexpr ColumnDescriptor<Storage, Column> makeColumn(const char *name, Column ReplayFile::*member, size_t dimensions, float scale = 1.f)
+{
+	return { name, member, dimensions, scale };
+}
+
+// The replay body in file order, right behind the header
+struct ReplayColumns
+{
+	static constexpr auto get()
+	{
+		using R = ReplayFile;
+		return std::make_tuple(
+			makeColumn<int16_t>("playerPositionDelta", &R::playerPositionDelta, 3, R::cPlayerPositionDeltaScale),
+			makeColumn<int16_t>("playerTilt", &R::playerTilt, 3, R::cPlayerTiltScale),
+			makeColumn<int8_t>("data567", &R::data567, 3, R::cData567Scale),
+			makeColumn<int8_t>("data8", &R::data8, 1, R::cData8Scale),
+			makeColumn<uint32_t>("flags", &R::flags, 1),
+			makeColumn<int16_t>("stageTilt", &R::stageTilt, 2, R::cStageTiltScale));
+	}
+};
+
+static const size_t cReplayColumnCount = std::tuple_size<decltype(ReplayColumns::get())>::value;
+
+template<size_t... I>
+constexpr size_t getColumnOffset(size_t index, std::index_sequence<I...>)
+{
+	constexpr auto columns = ReplayColumns::get();
+	const size_t sizes[] = { sizeof(typename std::tuple_element<I, decltype(columns)>::type::StorageType) * std::get<I>(columns).dimensions * ReplayFile::cChunkSize... };
+	size_t offset = ReplayFile::cHeaderSize;
+	for (size_t i = 0; i < index; ++i)
+	{
+		offset += sizes[i];
+	}
+	return offset;
+}
+
+// Byte offset of column index in a binary replay, cReplayColumnCount gives the end of the body
+constexpr size_t getColumnOffset(size_t index)
+{
+	return getColumnOffset(index, std::make_index_sequence<cReplayColumnCount>());
+}
+static_assert(getColumnOffset(cReplayColumnCount) == ReplayFile::cBinarySize, "replay columns don't add up to cBinarySize");
+
+template<typename Visitor, size_t... I>
+void forEachColumn(Visitor &&visitor, std::index_sequence<I...>)
+{
+	constexpr auto columns = ReplayColumns::get();
+	int expand[] = { 0, (visitor(std::get<I>(columns), std::integral_constant<size_t, getColumnOffset(I)>()), 0)... };
+	(void)expand;
+}
+
+// Calls visitor(column, offset) for every column, offset as a std::integral_constant
+template<typename Visitor>
+void forEachColumn(Visitor &&visitor)
+{
+	forEachColumn(visitor, std::make_index_sequence<cReplayColumnCount>());
+}
+
+template<typename Storage>
+Storage readColumnValue(const uint8_t *planes, size_t frame)
+{
+	using Raw = typename std::make_unsigned<Storage>::type;
+	Raw raw = 0;
+	for (size_t i = 0; i < sizeof(Storage); ++i)
+	{
+		raw |= static_cast<Raw>(static_cast<Raw>(planes[i * ReplayFile::cChunkSize + frame]) << (i * 8));
+	}
+	return static_cast<Storage>(raw);
+}
+
+template<typename Storage>
+void writeColumnValue(uint8_t *planes, size_t frame, Storage value)
+{
+	using Raw = typename std::make_unsigned<Storage>::type;
+	Raw raw = static_cast<Raw>(value);
+	for (size_t i = 0; i < sizeof(Storage); ++i)
+	{
+		planes[i * ReplayFile::cChunkSize + frame] = static_cast<uint8_t>(raw >> (i * 8));
+	}
+}
+
+template<typename Storage>
+void decodeColumnValue(Storage raw, float scale, float &value)
+{
+	value = static_cast<float>(raw) * scale;
+}
+
+template<typename Storage>
+void decodeColumnValue(Storage raw, float, uint32_t &value)
+{
+	value = raw;
+}
+
+template<typename Storage>
+Storage encodeColumnValue(float value, float scale)
+{
+	// Round instead of truncating, otherwise values that were decoded as raw * scale can come
+	// back as raw - 1 and every binary -> binary pass drifts a little further
+	float scaled = std::round(value / scale);
+	scaled = std::min(std::max(scaled, static_cast<float>(std::numeric_limits<Storage>::min())), static_cast<float>(std::numeric_limits<Storage>::max()));
+	return static_cast<Storage>(scaled);
+}
+
+template<typename Storage>
+Storage encodeColumnValue(uint32_t value, float)
+{
+	return static_cast<Storage>(value);
+}
+
+// Decodes the column starting at data into replay, replacing what it held
+template<typename Storage, typename T>
+void decodeColumn(const uint8_t *data, const ColumnDescriptor<Storage, std::vector<T>> &column, ReplayFile &replay)
+{
+	auto &values = replay.*column.member;
+	values.resize(ReplayFile::cChunkSize);
+	for (size_t i = 0; i < ReplayFile::cChunkSize; ++i)
+	{
+		decodeColumnValue(readColumnValue<Storage>(data, i), column.scale, values[i]);
+	}
+}
+
+template<typename Storage, typename T>
+void decodeColumn(const uint8_t *data, const ColumnDescriptor<Storage, std::vector<std::vector<T>>> &column, ReplayFile &replay)
+{
+	auto &frames = replay.*column.member;
+	frames.resize(ReplayFile::cChunkSize);
+	for (auto &frame : frames)
+	{
+		frame.resize(column.dimensions);
+	}
+	for (size_t j = 0; j < column.dimensions; ++j)
+	{
+		const uint8_t *planes = data + j * sizeof(Storage) * ReplayFile::cChunkSize;
+		for (size_t i = 0; i < ReplayFile::cChunkSize; ++i)
+		{
+			decodeColumnValue(readColumnValue<Storage>(planes, i), column.scale, frames[i][j]);
+		}
+	}
+}
+
+// Encodes a column of replay to data, which must be zeroed. Frames past cChunkSize are dropped,
+// missing ones and missing values of short JSON frames are zero.
+template<typename Storage, typename T>
+void encodeColumn(uint8_t *data, const ColumnDescriptor<Storage, std::vector<T>> &column, const ReplayFile &replay)
+{
+	const auto &values = replay.*column.member;
+	size_t frameCount = std::min(values.size(), static_cast<size_t>(ReplayFile::cChunkSize));
+	for (size_t i = 0; i < frameCount; ++i)
+	{
+		writeColumnValue(data, i, encodeColumnValue<Storage>(values[i], column.scale));
+	}
+}
+
+template<typename Storage, typename T>
+void encodeColumn(uint8_t *data, const ColumnDescriptor<Storage, std::vector<std::vector<T>>> &column, const ReplayFile &replay)
+{
+	const auto &frames = replay.*column.member;
+	size_t frameCount = std::min(frames.size(), static_cast<size_t>(ReplayFile::cChunkSize));
+	for (size_t j = 0; j < column.dimensions; ++j)
+	{
+		uint8_t *planes = data + j * sizeof(Storage) * ReplayFile::cChunkSize;
+		for (size_t i = 0; i < frameCount; ++i)
+		{
+			writeColumnValue(planes, i, j < frames[i].size() ? encodeColumnValue<Storage>(frames[i][j], column.scale) : Storage());
+		}
+	}
+}
+
+template<>
+void serializeBinary<ReplayFile>(std::vector<uint8_t> &buffer, const ReplayFile &value);
+template<>
+void deserializeBinary<ReplayFile>(BufferView &buffer, ReplayFile &value);
+template<>
+void serializeJSON<ReplayFile>(nlohmann::json &buffer, const std::string &name, const ReplayFile &value);
+template<>
+void deserializeJSON<ReplayFile>(const nlohmann::json &buffer, const std::string &name, ReplayFile &value);
+
+// Decodes only the named column (as in ReplayColumns) of a binary replay, leaving the rest of
+// value alone. False if the name is unknown or buffer is too short.
+bool deserializeBinaryColumn(BufferView buffer, const std::string &name, ReplayFile &value);
+
+struct GCIFile
+{
+	uint32_t gameCode = 0x474D4245; // "GMBE" #todo-smb-build-replay: Support multiple regions
+	uint16_t makerCode = 0x3850; // "8P"
+	uint8_t unused_06 = 0xFF;
+	uint8_t bannerFlags = 0x2; // RGB5A3 format
+	std::string filename = "";
+	uint32_t modifiedTime = 0x0;
+	uint32_t imageOffset = 0x10; // Constant for SMB replays
+	uint16_t iconFormat = 0x2; // RGB5A3 format
+	uint16_t animationSpeed = 0x3; // 12 frames
+	uint8_t permissions = 0x4; // no move
+	uint8_t copyCounter = 0x0;
+	uint16_t firstBlockNumber = 0x0;
+	uint16_t blockCount = 0x0;
+	uint16_t unused_3A = 0xFFFF;
+	uint32_t commentsAddress = 0x2010;
+
+	const static size_t cHeaderSize = 0x40;
+	const static size_t cBlockCountOffset = 0x38;
+	const static size_t cReplayDataOffset = 0x2090;
+	const static size_t cBlockSize = 0x2000;
+	const static size_t cCommentFieldSize = 0x20;
+	const static std::string cGameName;
+};
+
+template<>
+struct FieldTable<GCIFile>
+{
+	static const size_t cSize = GCIFile::cHeaderSize;
+
+	static constexpr auto get()
+	{
+		using G = GCIFile;
+		return std::make_tuple(
+			makeField("gameCode", &G::gameCode, 0x00),
+			makeField("makerCode", &G::makerCode, 0x04),
+			makeField("unused_06", &G::unused_06, 0x06),
+			makeField("bannerFlags", &G::bannerFlags, 0x07),
+			makeField("filename", &G::filename, 0x08, 0x20),
+			makeField("modifiedTime", &G::modifiedTime, 0x28),
+			makeField("imageOffset", &G::imageOffset, 0x2C),
+			makeField("iconFormat", &G::iconFormat, 0x30),
+			makeField("animationSpeed", &G::animationSpeed, 0x32),
+			makeField("permissions", &G::permissions, 0x34),
+			makeField("copyCounter", &G::copyCounter, 0x35),
+			makeField("firstBlockNumber", &G::firstBlockNumber, 0x36),
+			makeField("blockCount", &G::blockCount, GCIFile::cBlockCountOffset),
+			makeField("unused_3A", &G::unused_3A, 0x3A),
+			makeField("commentsAddress", &G::commentsAddress, 0x3C));
+	}
+};
+static_assert(areFieldsContiguous<GCIFile>(), "GCIFile field table has gaps");
+
+template<>
+void serializeBinary<GCIFile>(std::vector<uint8_t> &buffer, const GCIFile &value);
+
+// Builds the second comment line shown on the memory card screen, e.g. "A12 <comment>"
+std::string getReplayComment(const ReplayFileHeader &header, const std::string &comment, int padFloorNumber);
+
+// Timestamp based GCI filename so that files written in succession don't collide
+std::string getGCIFilename();
+
+void serializeGCI(std::vector<uint8_t> &buffer, const ReplayFile &replay, const std::string &replayComment, const std::string &filename);
+// Returns false if the file is too short to hold a replay
+bool deserializeGCI(BufferView buffer, ReplayFile &replay);
+bool deserializeGCIHeader(BufferView buffer, ReplayFileHeader &header);
+
+struct EncodeOptions
+{
+	bool prettyJSON = false;
+	// Full second comment line, see getReplayComment
+	std::string replayComment = "";
+	std::string gciFilename = "";
+	// JSON, NPZ and CSV: add absolute playerPosition per frame, see reconstructTrajectory
+	bool positions = false;
+	bool doublePrecisionPositions = true;
+	// JSON, NPZ and CSV: add playerSpeed in units per second for every played frame, see
+	// computeReplayMetrics
+	bool speeds = false;
+	// GCI: compress with compressBufferRLEOptimal. savedBlocks, if not null, receives how many card
+	// blocks that saved over compressBufferRLE.
+	bool optimalRLE = false;
+	size_t *savedBlocks = nullptr;
+	// JSONL: leave out everything but the header, e.g. to index a corpus
+	bool headerOnly = false;
+};
+
+// Uses replayComment, gciFilename and the RLE options
+void serializeGCI(std::vector<uint8_t> &buffer, const ReplayFile &replay, const EncodeOptions &options);
+
+// Format dispatch shared by the tools. The decoders only read buffer and return false for unknown
+// formats and truncated input. Malformed JSON throws.
+bool decodeReplay(FileFormat format, BufferView buffer, ReplayFile &replay);
+// Parses JSON as it is read instead of loading the whole text first, for pipes
+bool decodeReplayJSON(std::istream &stream, ReplayFile &replay);
+// The header and only the named columns, see deserializeBinaryColumn. Binary and GCI leave the
+// other columns alone, JSON is decoded whole.
+bool decodeReplayColumns(FileFormat format, BufferView buffer, const std::vector<std::string> &columns, ReplayFile &replay);
+// Decodes just the header, GCI payloads are only decompressed as far as needed
+bool decodeReplayHeader(FileFormat format, BufferView buffer, ReplayFileHeader &header);
+bool encodeReplay(FileFormat format, const ReplayFile &replay, const EncodeOptions &options, std::vector<uint8_t> &buffer);
+
+// The "root" object of the JSON format on a single line, ended by a newline. With a name it is
+// a corpus line, with the name under "replay" as the first key.
+void serializeJSONLine(std::vector<uint8_t> &buffer, const ReplayFile &replay, const std::string *name, const EncodeOptions &options);
@@ -0,0 +1,436 @@
+#include "smbreplay.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <new>
+
+#include "smb-replay.hpp"
+#include "trajectory.hpp"
+
+struct smbreplay_replay
+{
+	ReplayFile replay;
+};
+
+namespace
+{
+
+FileFormat toFileFormat(smbreplay_format format)
+{
+	switch (format)
+	{
+	case SMBREPLAY_FORMAT_BINARY:
+		return FileFormat::Binary;
+	case SMBREPLAY_FORMAT_GCI:
+		return FileFormat::GCI;
+	case SMBREPLAY_FORMAT_JSON:
+		return FileFormat::JSON;
+	default:
+		return FileFormat::Unknown;
+	}
+}
+
+void toCHeader(const ReplayFileHeader &header, smbreplay_header &out)
+{
+	out.flags = header.flags;
+	out.level_id = header.levelID;
+	out.level_difficulty = header.levelDifficulty;
+	out.level_floor = header.levelFloor;
+	out.monkey_type = header.monkeyType;
+	out.unk_06 = header.unk_06;
+	out.unk_08 = header.unk_08;
+	out.unk_0c = header.unk_0c;
+	out.score_points = header.scorePoints;
+	out.unk_14 = header.unk_14;
+	out.level_max_time = header.levelMaxTime;
+	out.replay_total_time = header.replayTotalTime;
+	out.score_time_remaining = header.scoreTimeRemaining;
+	out.unk_1e = header.unk_1E;
+	out.time_with_score = header.timeWithScore;
+	out.unk_24 = header.unk_24;
+	out.unk_28 = header.unk_28;
+	out.unk_2c = header.unk_2c;
+	out.unk_30 = header.unk_30;
+	out.unk_34 = header.unk_34;
+	out.start_position_x = header.startPositionX;
+	out.start_position_y = header.startPositionY;
+	out.start_position_z = header.startPositionZ;
+}
+
+// Copies out of the library's buffer, or reports how much room is needed
+smbreplay_status copyOut(const std::vector<uint8_t> &data, uint8_t *out, size_t capacity, size_t *outSize)
+{
+	if (outSize)
+	{
+		*outSize = data.size();
+	}
+	if (!out || capacity < data.size())
+	{
+		return SMBREPLAY_BUFFER_TOO_SMALL;
+	}
+	memcpy(out, data.data(), data.size());
+	return SMBREPLAY_OK;
+}
+
+smbreplay_status decode(smbreplay_format format, const uint8_t *data, size_t size, ReplayFile &replay)
+{
+	FileFormat fileFormat = toFileFormat(format);
+	if (fileFormat == FileFormat::Unknown)
+	{
+		return SMBREPLAY_UNSUPPORTED_FORMAT;
+	}
+	if (!data && size)
+	{
+		return SMBREPLAY_INVALID_ARGUMENT;
+	}
+	try
+	{
+		return decodeReplay(fileFormat, BufferView(data, size), replay) ? SMBREPLAY_OK : SMBREPLAY_MALFORMED_INPUT;
+	}
+	catch (const std::bad_alloc &)
+	{
+		throw;
+	}
+	catch (const std::exception &)
+	{
+		// JSON parse and type errors
+		return SMBREPLAY_MALFORMED_INPUT;
+	}
+}
+
+smbreplay_status encode(const ReplayFile &replay, smbreplay_format format, const smbreplay_encode_options *options,
+	uint8_t *out, size_t capacity, size_t *outSize)
+{
+	FileFormat fileFormat = toFileFormat(format);
+	if (fileFormat == FileFormat::Unknown)
+	{
+		return SMBREPLAY_UNSUPPORTED_FORMAT;
+	}
+
+	// Fields past struct_size come from a caller built against an older header and keep their defaults
+	smbreplay_encode_options effective = {};
+	effective.struct_size = sizeof(effective);
+	if (options)
+	{
+		if (options->struct_size < offsetof(smbreplay_encode_options, pretty_json))
+		{
+			return SMBREPLAY_INVALID_ARGUMENT;
+		}
+		memcpy(&effective, options, std::min(options->struct_size, sizeof(effective)));
+	}
+
+	// Binary replays are all the same size, so asking for it needs no encoding
+	if (fileFormat == FileFormat::Binary && (!out || capacity < ReplayFile::cBinarySize))
+	{
+		if (outSize)
+		{
+			*outSize = ReplayFile::cBinarySize;
+		}
+		return SMBREPLAY_BUFFER_TOO_SMALL;
+	}
+
+	EncodeOptions encodeOptions;
+	encodeOptions.prettyJSON = effective.pretty_json != 0;
+	if (effective.positions != SMBREPLAY_POSITIONS_NONE)
+	{
+		if (effective.positions != SMBREPLAY_POSITIONS_FLOAT && effective.positions != SMBREPLAY_POSITIONS_DOUBLE)
+		{
+			return SMBREPLAY_INVALID_ARGUMENT;
+		}
+		encodeOptions.positions = true;
+		encodeOptions.doublePrecisionPositions = effective.positions == SMBREPLAY_POSITIONS_DOUBLE;
+	}
+	if (fileFormat == FileFormat::GCI)
+	{
+		encodeOptions.replayComment = getReplayComment(replay.header, effective.comment ? effective.comment : "<UNTAGGED>", effective.pad_floor_number);
+		encodeOptions.gciFilename = effective.gci_filename ? effective.gci_filename : getGCIFilename();
+	}
+
+	std::vector<uint8_t> buffer;
+	if (!encodeReplay(fileFormat, replay, encodeOptions, buffer))
+	{
+		return SMBREPLAY_UNSUPPORTED_FORMAT;
+	}
+	return copyOut(buffer, out, capacity, outSize);
+}
+
+template<typename Function>
+smbreplay_status guard(Function function)
+{
+	try
+	{
+		return function();
+	}
+	catch (const std::bad_alloc &)
+	{
+		return SMBREPLAY_OUT_OF_MEMORY;
+	}
+	catch (...)
+	{
+		return SMBREPLAY_INTERNAL_ERROR;
+	}
+}
+
+const std::vector<std::vector<float>> *getVectorColumn(const ReplayFile &replay, smbreplay_column column)
+{
+	switch (column)
+	{
+	case SMBREPLAY_COLUMN_PLAYER_POSITION_DELTA:
+		return &replay.playerPositionDelta;
+	case SMBREPLAY_COLUMN_PLAYER_TILT:
+		return &replay.playerTilt;
+	case SMBREPLAY_COLUMN_DATA567:
+		return &replay.data567;
+	case SMBREPLAY_COLUMN_STAGE_TILT:
+		return &replay.stageTilt;
+	default:
+		return nullptr;
+	}
+}
+
+}
+
+uint32_t smbreplay_api_version(void)
+{
+	return SMBREPLAY_API_VERSION;
+}
+
+const char *smbreplay_status_string(smbreplay_status status)
+{
+	switch (status)
+	{
+	case SMBREPLAY_OK:
+		return "ok";
+	case SMBREPLAY_INVALID_ARGUMENT:
+		return "invalid argument";
+	case SMBREPLAY_UNSUPPORTED_FORMAT:
+		return "unsupported format";
+	case SMBREPLAY_MALFORMED_INPUT:
+		return "malformed input";
+	case SMBREPLAY_BUFFER_TOO_SMALL:
+		return "buffer too small";
+	case SMBREPLAY_OUT_OF_MEMORY:
+		return "out of memory";
+	case SMBREPLAY_INTERNAL_ERROR:
+		return "internal error";
+	default:
+		return "unknown status";
+	}
+}
+
+smbreplay_status smbreplay_decode(smbreplay_format format, const uint8_t *data, size_t size, smbreplay_replay **out_replay)
+{
+	if (!out_replay)
+	{
+		return SMBREPLAY_INVALID_ARGUMENT;
+	}
+	*out_replay = nullptr;
+	return guard([&]()
+	{
+		std::unique_ptr<smbreplay_replay> replay(new smbreplay_replay());
+		smbreplay_status status = decode(format, data, size, replay->replay);
+		if (status == SMBREPLAY_OK)
+		{
+			*out_replay = replay.release();
+		}
+		return status;
+	});
+}
+
+void smbreplay_free(smbreplay_replay *replay)
+{
+	delete replay;
+}
+
+smbreplay_status smbreplay_encode(const smbreplay_replay *replay, smbreplay_format format, const smbreplay_encode_options *options,
+	uint8_t *out, size_t capacity, size_t *out_size)
+{
+	if (!replay)
+	{
+		return SMBREPLAY_INVALID_ARGUMENT;
+	}
+	return guard([&]()
+	{
+		return encode(replay->replay, format, options, out, capacity, out_size);
+	});
+}
+
+smbreplay_status smbreplay_convert(smbreplay_format in_format, const uint8_t *data, size_t size,
+	smbreplay_format out_format, const smbreplay_encode_options *options,
+	uint8_t *out, size_t capacity, size_t *out_size)
+{
+	return guard([&]()
+	{
+		ReplayFile replay;
+		smbreplay_status status = decode(in_format, data, size, replay);
+		if (status != SMBREPLAY_OK)
+		{
+			return status;
+		}
+		return encode(replay, out_format, options, out, capacity, out_size);
+	});
+}
+
+smbreplay_status smbreplay_read_header(smbreplay_format format, const uint8_t *data, size_t size, smbreplay_header *out_header)
+{
+	if (!out_header || (!data && size))
+	{
+		return SMBREPLAY_INVALID_ARGUMENT;
+	}
+	return guard([&]()
+	{
+		FileFormat fileFormat = toFileFormat(format);
+		if (fileFormat == FileFormat::Unknown)
+		{
+			return SMBREPLAY_UNSUPPORTED_FORMAT;
+		}
+		ReplayFileHeader header;
+		try
+		{
+			if (!decodeReplayHeader(fileFormat, BufferView(data, size), header))
+			{
+				return SMBREPLAY_MALFORMED_INPUT;
+			}
+		}
+		catch (const std::bad_alloc &)
+		{
+			throw;
+		}
+		catch (const std::exception &)
+		{
+			return SMBREPLAY_MALFORMED_INPUT;
+		}
+		toCHeader(header, *out_header);
+		return SMBREPLAY_OK;
+	});
+}
+
+smbreplay_status smbreplay_get_header(const smbreplay_replay *replay, smbreplay_header *out_header)
+{
+	if (!replay || !out_header)
+	{
+		return SMBREPLAY_INVALID_ARGUMENT;
+	}
+	toCHeader(replay->replay.header, *out_header);
+	return SMBREPLAY_OK;
+}
+
+size_t smbreplay_frame_count(const smbreplay_replay *replay)
+{
+	return replay ? replay->replay.playerPositionDelta.size() : 0;
+}
+
+size_t smbreplay_column_components(smbreplay_column column)
+{
+	switch (column)
+	{
+	case SMBREPLAY_COLUMN_PLAYER_POSITION_DELTA:
+	case SMBREPLAY_COLUMN_PLAYER_TILT:
+	case SMBREPLAY_COLUMN_DATA567:
+		return 3;
+	case SMBREPLAY_COLUMN_DATA8:
+		return 1;
+	case SMBREPLAY_COLUMN_STAGE_TILT:
+		return 2;
+	default:
+		return 0;
+	}
+}
+
+smbreplay_status smbreplay_get_column(const smbreplay_replay *replay, smbreplay_column column, float *out, size_t capacity, size_t *out_size)
+{
+	size_t components = smbreplay_column_components(column);
+	if (!replay || !components)
+	{
+		return SMBREPLAY_INVALID_ARGUMENT;
+	}
+	size_t frames = smbreplay_frame_count(replay);
+	size_t size = frames * components;
+	if (out_size)
+	{
+		*out_size = size;
+	}
+	if (!out || capacity < size)
+	{
+		return SMBREPLAY_BUFFER_TOO_SMALL;
+	}
+
+	// Replays decoded from hand edited JSON can have short columns, those frames read as zero
+	const auto &source = replay->replay;
+	if (column == SMBREPLAY_COLUMN_DATA8)
+	{
+		for (size_t i = 0; i < frames; ++i)
+		{
+			out[i] = i < source.data8.size() ? source.data8[i] : 0.f;
+		}
+		return SMBREPLAY_OK;
+	}
+	const auto &vectors = *getVectorColumn(source, column);
+	for (size_t i = 0; i < frames; ++i)
+	{
+		for (size_t j = 0; j < components; ++j)
+		{
+			out[i * components + j] = i < vectors.size() && j < vectors[i].size() ? vectors[i][j] : 0.f;
+		}
+	}
+	return SMBREPLAY_OK;
+}
+
+smbreplay_status smbreplay_get_positions(const smbreplay_replay *replay, smbreplay_positions precision, float *out, size_t capacity, size_t *out_size)
+{
+	if (!replay || (precision != SMBREPLAY_POSITIONS_FLOAT && precision != SMBREPLAY_POSITIONS_DOUBLE))
+	{
+		return SMBREPLAY_INVALID_ARGUMENT;
+	}
+	size_t frames = smbreplay_frame_count(replay);
+	if (out_size)
+	{
+		*out_size = frames * 3;
+	}
+	if (!out || capacity < frames * 3)
+	{
+		return SMBREPLAY_BUFFER_TOO_SMALL;
+	}
+	return guard([&]()
+	{
+		Trajectory trajectory;
+		reconstructTrajectory(replay->replay, precision == SMBREPLAY_POSITIONS_DOUBLE, trajectory);
+		for (size_t i = 0; i < frames; ++i)
+		{
+			out[i * 3] = trajectory.x[i];
+			out[i * 3 + 1] = trajectory.y[i];
+			out[i * 3 + 2] = trajectory.z[i];
+		}
+		return SMBREPLAY_OK;
+	});
+}
+
+smbreplay_status smbreplay_get_flags(const smbreplay_replay *replay, uint32_t *out, size_t capacity, size_t *out_size)
+{
+	if (!replay)
+	{
+		return SMBREPLAY_INVALID_ARGUMENT;
+	}
+	size_t frames = smbreplay_frame_count(replay);
+	if (out_size)
+	{
+		*out_size = frames;
+	}
+	if (!out || capacity < frames)
+	{
+		return SMBREPLAY_BUFFER_TOO_SMALL;
+	}
+	const auto &flags = replay->replay.flags;
+	for (size_t i = 0; i < frames; ++i)
+	{
+		out[i] = i < flags.size() ? flags[i] : 0;
+	}
+	return SMBREPLAY_OK;
+}
+
+uint16_t smbreplay_crc(const uint8_t *data, size_t size)
+{
+	return getCRCForBuffer(BufferView(data, data ? size : 0));
+}
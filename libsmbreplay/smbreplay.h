@@ -0,0 +1,154 @@
+#ifndef SMBREPLAY_H
+#define SMBREPLAY_H
+
+/*
+ * C interface to the Super Monkey Ball replay codec.
+ *
+ * All input is passed as pointer + length and never retained. All output goes into buffers owned
+ * by the caller; functions that produce variable sized output report the size they need through
+ * out_size and return SMBREPLAY_BUFFER_TOO_SMALL if the buffer was too small (or NULL), so they
+ * can be called once to query the size and once more to fill the buffer.
+ *
+ * Functions are thread safe as long as a replay handle is not modified concurrently.
+ * Types in this header only ever grow at the end; structs passed in carry their own size.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(SMBREPLAY_SHARED)
+	#if defined(_WIN32)
+		#if defined(SMBREPLAY_BUILDING)
+			#define SMBREPLAY_API __declspec(dllexport)
+		#else
+			#define SMBREPLAY_API __declspec(dllimport)
+		#endif
+	#else
+		#define SMBREPLAY_API __attribute__((visibility("default")))
+	#endif
+#else
+	#define SMBREPLAY_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SMBREPLAY_API_VERSION 2
+
+/* Fixed width instead of enums so the ABI does not depend on the compiler's enum size */
+typedef int32_t smbreplay_status;
+#define SMBREPLAY_OK 0
+#define SMBREPLAY_INVALID_ARGUMENT -1
+#define SMBREPLAY_UNSUPPORTED_FORMAT -2
+#define SMBREPLAY_MALFORMED_INPUT -3
+#define SMBREPLAY_BUFFER_TOO_SMALL -4
+#define SMBREPLAY_OUT_OF_MEMORY -5
+#define SMBREPLAY_INTERNAL_ERROR -6
+
+typedef int32_t smbreplay_format;
+#define SMBREPLAY_FORMAT_BINARY 1
+#define SMBREPLAY_FORMAT_GCI 2
+#define SMBREPLAY_FORMAT_JSON 3
+
+/* How absolute player positions are summed up from the deltas */
+typedef int32_t smbreplay_positions;
+#define SMBREPLAY_POSITIONS_NONE 0
+#define SMBREPLAY_POSITIONS_FLOAT 1
+#define SMBREPLAY_POSITIONS_DOUBLE 2
+
+/* Per-frame columns, values are interleaved per frame (x, y, z, x, y, z, ...) */
+typedef int32_t smbreplay_column;
+#define SMBREPLAY_COLUMN_PLAYER_POSITION_DELTA 1 /* 3 components */
+#define SMBREPLAY_COLUMN_PLAYER_TILT 2 /* 3 components */
+#define SMBREPLAY_COLUMN_DATA567 3 /* 3 components */
+#define SMBREPLAY_COLUMN_DATA8 4 /* 1 component */
+#define SMBREPLAY_COLUMN_STAGE_TILT 5 /* 2 components */
+
+typedef struct smbreplay_header
+{
+	uint16_t flags;
+	uint8_t level_id;
+	uint8_t level_difficulty;
+	uint8_t level_floor;
+	uint8_t monkey_type;
+	uint16_t unk_06;
+	uint32_t unk_08;
+	uint32_t unk_0c;
+	uint32_t score_points;
+	uint32_t unk_14;
+	uint16_t level_max_time;
+	uint16_t replay_total_time;
+	uint16_t score_time_remaining;
+	uint16_t unk_1e;
+	uint32_t time_with_score;
+	float unk_24;
+	float unk_28;
+	float unk_2c;
+	uint32_t unk_30;
+	uint32_t unk_34;
+	float start_position_x;
+	float start_position_y;
+	float start_position_z;
+} smbreplay_header;
+
+typedef struct smbreplay_encode_options
+{
+	/* sizeof(smbreplay_encode_options), lets later versions add fields */
+	size_t struct_size;
+	/* JSON: indent output */
+	int32_t pretty_json;
+	/* GCI: comment after the difficulty and floor, NULL for "<UNTAGGED>" */
+	const char *comment;
+	/* GCI: number of digits to pad the floor number in the comment to */
+	int32_t pad_floor_number;
+	/* GCI: file name on the memory card, NULL for one derived from the current time */
+	const char *gci_filename;
+	/* JSON: add a playerPosition column (API version 2) */
+	smbreplay_positions positions;
+} smbreplay_encode_options;
+
+typedef struct smbreplay_replay smbreplay_replay;
+
+SMBREPLAY_API uint32_t smbreplay_api_version(void);
+SMBREPLAY_API const char *smbreplay_status_string(smbreplay_status status);
+
+/* Decodes a whole replay. Free the result with smbreplay_free. */
+SMBREPLAY_API smbreplay_status smbreplay_decode(smbreplay_format format, const uint8_t *data, size_t size, smbreplay_replay **out_replay);
+SMBREPLAY_API void smbreplay_free(smbreplay_replay *replay);
+
+/* Encodes a replay into out. options may be NULL for defaults. Binary output always has the same
+ * size, but GCI and JSON are encoded again by every call, so querying the size first costs a
+ * second encode. Keeping one buffer grown to the largest output so far avoids that for most
+ * replays. */
+SMBREPLAY_API smbreplay_status smbreplay_encode(const smbreplay_replay *replay, smbreplay_format format, const smbreplay_encode_options *options,
+	uint8_t *out, size_t capacity, size_t *out_size);
+
+/* decode + encode in one call without a handle, both done again by every call */
+SMBREPLAY_API smbreplay_status smbreplay_convert(smbreplay_format in_format, const uint8_t *data, size_t size,
+	smbreplay_format out_format, const smbreplay_encode_options *options,
+	uint8_t *out, size_t capacity, size_t *out_size);
+
+/* Reads only the header. For GCI only the start of the payload is decompressed. */
+SMBREPLAY_API smbreplay_status smbreplay_read_header(smbreplay_format format, const uint8_t *data, size_t size, smbreplay_header *out_header);
+SMBREPLAY_API smbreplay_status smbreplay_get_header(const smbreplay_replay *replay, smbreplay_header *out_header);
+
+SMBREPLAY_API size_t smbreplay_frame_count(const smbreplay_replay *replay);
+/* Number of floats per frame of a column, 0 for unknown columns */
+SMBREPLAY_API size_t smbreplay_column_components(smbreplay_column column);
+/* Copies frame_count * components floats into out */
+SMBREPLAY_API smbreplay_status smbreplay_get_column(const smbreplay_replay *replay, smbreplay_column column, float *out, size_t capacity, size_t *out_size);
+/* Copies frame_count * 3 absolute positions into out, start position plus all deltas up to and
+ * including each frame. precision is SMBREPLAY_POSITIONS_FLOAT or SMBREPLAY_POSITIONS_DOUBLE. (API version 2) */
+SMBREPLAY_API smbreplay_status smbreplay_get_positions(const smbreplay_replay *replay, smbreplay_positions precision, float *out, size_t capacity, size_t *out_size);
+/* Copies frame_count flag words into out */
+SMBREPLAY_API smbreplay_status smbreplay_get_flags(const smbreplay_replay *replay, uint32_t *out, size_t capacity, size_t *out_size);
+
+/* CRC-16 as stored in GCI files, over the data following the checksum */
+SMBREPLAY_API uint16_t smbreplay_crc(const uint8_t *data, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,153 @@
+#include "stage-stats.hpp"
+
+#include <iomanip>
+
+#include "json.hpp"
+
+thread_local StageStats *tStageStats = nullptr;
+thread_local uint64_t tAllocationCount = 0;
+
+const char *getStageName(Stage stage)
+{
+	switch (stage)
+	{
+	case Stage::Load:
+		return "load";
+	case Stage::Decompress:
+		return "decompress";
+	case Stage::DecodeColumns:
+		return "decode-columns";
+	case Stage::ParseJSON:
+		return "parse-json";
+	case Stage::DecodeJSON:
+		return "decode-json";
+	case Stage::Trajectory:
+		return "trajectory";
+	case Stage::Metrics:
+		return "metrics";
+	case Stage::EncodeColumns:
+		return "encode-columns";
+	case Stage::Compress:
+		return "compress";
+	case Stage::Hash:
+		return "hash";
+	case Stage::CRC:
+		return "crc";
+	case Stage::EncodeJSON:
+		return "encode-json";
+	case Stage::DumpJSON:
+		return "dump-json";
+	case Stage::EncodeCSV:
+		return "encode-csv";
+	case Stage::Write:
+		return "write";
+	default:
+		return "unknown";
+	}
+}
+
+void StageStats::merge(const StageStats &other)
+{
+	for (size_t i = 0; i < static_cast<size_t>(Stage::Count); ++i)
+	{
+		stages[i].calls += other.stages[i].calls;
+		stages[i].nanoseconds += other.stages[i].nanoseconds;
+		stages[i].bytesIn += other.stages[i].bytesIn;
+		stages[i].bytesOut += other.stages[i].bytesOut;
+		stages[i].allocations += other.stages[i].allocations;
+	}
+	files += other.files;
+	fileNanoseconds += other.fileNanoseconds;
+}
+
+namespace
+{
+
+double getMBPerSecond(uint64_t bytes, uint64_t nanoseconds)
+{
+	return nanoseconds ? (bytes / 1e6) / (nanoseconds / 1e9) : 0.;
+}
+
+uint64_t getStageNanoseconds(const StageStats &stats)
+{
+	uint64_t total = 0;
+	for (const auto &counters : stats.stages)
+	{
+		total += counters.nanoseconds;
+	}
+	return total;
+}
+
+}
+
+void printStageStats(std::ostream &stream, const StageStats &stats)
+{
+	auto flags = stream.flags();
+	auto precision = stream.precision();
+
+	stream << std::left << std::setw(16) << "stage"
+		<< std::right << std::setw(8) << "calls"
+		<< std::setw(12) << "ms"
+		<< std::setw(8) << "%"
+		<< std::setw(12) << "bytes in"
+		<< std::setw(12) << "bytes out"
+		<< std::setw(10) << "MB/s"
+		<< std::setw(10) << "allocs" << std::endl;
+
+	double total = static_cast<double>(stats.fileNanoseconds);
+	for (size_t i = 0; i < static_cast<size_t>(Stage::Count); ++i)
+	{
+		const auto &counters = stats.stages[i];
+		if (!counters.calls)
+		{
+			continue;
+		}
+		stream << std::left << std::setw(16) << getStageName(static_cast<Stage>(i))
+			<< std::right << std::setw(8) << counters.calls
+			<< std::fixed << std::setprecision(3) << std::setw(12) << counters.nanoseconds / 1e6
+			<< std::setprecision(1) << std::setw(8) << (total > 0. ? 100. * counters.nanoseconds / total : 0.)
+			<< std::setw(12) << counters.bytesIn
+			<< std::setw(12) << counters.bytesOut
+			<< std::setw(10) << getMBPerSecond(counters.bytesIn ? counters.bytesIn : counters.bytesOut, counters.nanoseconds)
+			<< std::setw(10) << counters.allocations << std::endl;
+	}
+
+	// Whatever the stages don't cover: option handling, copies between stages, GCI banner etc.
+	uint64_t staged = getStageNanoseconds(stats);
+	uint64_t other = stats.fileNanoseconds > staged ? stats.fileNanoseconds - staged : 0;
+	stream << std::left << std::setw(16) << "other"
+		<< std::right << std::setw(8) << ""
+		<< std::fixed << std::setprecision(3) << std::setw(12) << other / 1e6
+		<< std::setprecision(1) << std::setw(8) << (total > 0. ? 100. * other / total : 0.) << std::endl;
+	stream << std::left << std::setw(16) << "total"
+		<< std::right << std::setw(8) << stats.files
+		<< std::setprecision(3) << std::setw(12) << stats.fileNanoseconds / 1e6 << std::endl;
+
+	stream.flags(flags);
+	stream.precision(precision);
+}
+
+void printStageStatsJSON(std::ostream &stream, const StageStats &stats)
+{
+	nlohmann::json output;
+	output["files"] = stats.files;
+	output["fileNanoseconds"] = stats.fileNanoseconds;
+	output["stages"] = nlohmann::json::object();
+	for (size_t i = 0; i < static_cast<size_t>(Stage::Count); ++i)
+	{
+		const auto &counters = stats.stages[i];
+		if (!counters.calls)
+		{
+			continue;
+		}
+		nlohmann::json stage;
+		stage["calls"] = counters.calls;
+		stage["nanoseconds"] = counters.nanoseconds;
+		stage["bytesIn"] = counters.bytesIn;
+		stage["bytesOut"] = counters.bytesOut;
+		stage["allocations"] = counters.allocations;
+		stage["mbPerSecond"] = getMBPerSecond(counters.bytesIn ? counters.bytesIn : counters.bytesOut, counters.nanoseconds);
+		output["stages"][getStageName(static_cast<Stage>(i))] = stage;
+	}
+	stream << output.dump() << std::endl;
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+#include "trace.hpp"
+
+// Stages of a conversion that the codec reports timings for
+enum class Stage
+{
+	Load,
+	Decompress,
+	DecodeColumns,
+	ParseJSON,
+	DecodeJSON,
+	Trajectory,
+	Metrics,
+	EncodeColumns,
+	Compress,
+	Hash,
+	CRC,
+	EncodeJSON,
+	DumpJSON,
+	EncodeCSV,
+	Write,
+
+	Count,
+};
+
+const char *getStageName(Stage stage);
+
+struct StageCounters
+{
+	uint64_t calls = 0;
+	uint64_t nanoseconds = 0;
+	uint64_t bytesIn = 0;
+	uint64_t bytesOut = 0;
+	uint64_t allocations = 0;
+};
+
+struct StageStats
+{
+	StageCounters stages[static_cast<size_t>(Stage::Count)];
+	uint64_t files = 0;
+	uint64_t fileNanoseconds = 0;
+
+	void merge(const StageStats &other);
+};
+
+// Stats the calling thread reports into, null while nobody is collecting
+extern thread_local StageStats *tStageStats;
+// Bumped by the operator new replacement of tools that want allocation counts
+extern thread_local uint64_t tAllocationCount;
+
+// Times the enclosing block and adds it to the calling thread's stats, if any, and to the trace
+// if tracing is on
+class StageScope
+{
+public:
+	explicit StageScope(Stage stage)
+		: mStats(tStageStats), mStage(stage), mTrace(gTraceEnabled)
+	{
+		if (mStats)
+		{
+			mAllocations = tAllocationCount;
+			mStart = std::chrono::steady_clock::now();
+		}
+		if (mTrace)
+		{
+			mTraceStart = getTraceTimestamp();
+		}
+	}
+
+	StageScope(const StageScope &) = delete;
+	StageScope &operator=(const StageScope &) = delete;
+
+	~StageScope()
+	{
+		if (mStats)
+		{
+			auto elapsed = std::chrono::steady_clock::now() - mStart;
+			auto &counters = mStats->stages[static_cast<size_t>(mStage)];
+			++counters.calls;
+			counters.nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+			counters.bytesIn += mBytesIn;
+			counters.bytesOut += mBytesOut;
+			counters.allocations += tAllocationCount - mAllocations;
+		}
+		if (mTrace)
+		{
+			recordTraceEvent("stage", getStageName(mStage), mTraceStart, getTraceTimestamp(), nullptr);
+		}
+	}
+
+	void setBytes(uint64_t bytesIn, uint64_t bytesOut)
+	{
+		mBytesIn = bytesIn;
+		mBytesOut = bytesOut;
+	}
+
+private:
+	StageStats *mStats;
+	Stage mStage;
+	bool mTrace;
+	std::chrono::steady_clock::time_point mStart;
+	uint64_t mTraceStart = 0;
+	uint64_t mAllocations = 0;
+	uint64_t mBytesIn = 0;
+	uint64_t mBytesOut = 0;
+};
+
+void printStageStats(std::ostream &stream, const StageStats &stats);
+void printStageStatsJSON(std::ostream &stream, const StageStats &stats);
@@ -0,0 +1,151 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "trace.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+bool gTraceEnabled = false;
+
+namespace
+{
+
+struct TraceEvent
+{
+	const char *category;
+	const char *name;
+	uint64_t start;
+	uint64_t end;
+	std::string detail;
+};
+
+struct ThreadTrace
+{
+	uint32_t threadID;
+	std::string name;
+	std::vector<TraceEvent> events;
+};
+
+std::chrono::steady_clock::time_point gTraceStart;
+
+// Buffers outlive their threads so batch workers can exit before the trace is written
+std::mutex gThreadTracesMutex;
+std::vector<std::unique_ptr<ThreadTrace>> gThreadTraces;
+thread_local ThreadTrace *tThreadTrace = nullptr;
+
+ThreadTrace &getThreadTrace()
+{
+	if (!tThreadTrace)
+	{
+		std::lock_guard<std::mutex> lock(gThreadTracesMutex);
+		gThreadTraces.emplace_back(new ThreadTrace());
+		tThreadTrace = gThreadTraces.back().get();
+		tThreadTrace->threadID = static_cast<uint32_t>(gThreadTraces.size());
+	}
+	return *tThreadTrace;
+}
+
+void writeEscaped(FILE *file, const std::string &text)
+{
+	for (char c : text)
+	{
+		if (c == '"' || c == '\\')
+		{
+			fprintf(file, "\\%c", c);
+		}
+		else if (static_cast<unsigned char>(c) < 0x20)
+		{
+			fprintf(file, "\\u%04x", static_cast<unsigned>(c));
+		}
+		else
+		{
+			fputc(c, file);
+		}
+	}
+}
+
+}
+
+void enableTrace()
+{
+	gTraceStart = std::chrono::steady_clock::now();
+	gTraceEnabled = true;
+}
+
+uint64_t getTraceTimestamp()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - gTraceStart).count();
+}
+
+void recordTraceEvent(const char *category, const char *name, uint64_t start, uint64_t end, const std::string *detail)
+{
+	TraceEvent event;
+	event.category = category;
+	event.name = name;
+	event.start = start;
+	event.end = end;
+	if (detail)
+	{
+		event.detail = *detail;
+	}
+	getThreadTrace().events.emplace_back(std::move(event));
+}
+
+void setTraceThreadName(const std::string &name)
+{
+	if (gTraceEnabled)
+	{
+		getThreadTrace().name = name;
+	}
+}
+
+bool writeTrace(const std::string &filename)
+{
+	FILE *file = fopen(filename.c_str(), "wb");
+	if (!file)
+	{
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(gThreadTracesMutex);
+	const int processID = 1;
+	bool first = true;
+	auto separator = [&]()
+	{
+		fputs(first ? "\n" : ",\n", file);
+		first = false;
+	};
+
+	fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", file);
+	for (const auto &thread : gThreadTraces)
+	{
+		if (!thread->name.empty())
+		{
+			separator();
+			fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":\"", processID, thread->threadID);
+			writeEscaped(file, thread->name);
+			fputs("\"}}", file);
+		}
+		for (const auto &event : thread->events)
+		{
+			// Timestamps are in microseconds, keep the nanoseconds as fraction
+			separator();
+			fprintf(file, "{\"cat\":\"%s\",\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f",
+				event.category, event.name, processID, thread->threadID,
+				event.start / 1e3, (event.end - event.start) / 1e3);
+			if (!event.detail.empty())
+			{
+				fputs(",\"args\":{\"detail\":\"", file);
+				writeEscaped(file, event.detail);
+				fputs("\"}", file);
+			}
+			fputc('}', file);
+		}
+	}
+	fputs("\n]}\n", file);
+
+	return fclose(file) == 0;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Chrome/Perfetto trace-event recording. Everything is a no-op behind a single branch until
+// enableTrace is called, so the scopes can stay in the codec permanently.
+
+extern bool gTraceEnabled;
+
+// Call before any worker threads are started
+void enableTrace();
+// Nanoseconds since enableTrace
+uint64_t getTraceTimestamp();
+void recordTraceEvent(const char *category, const char *name, uint64_t start, uint64_t end, const std::string *detail);
+// Shows up as the track name in the trace viewer
+void setTraceThreadName(const std::string &name);
+// Call once all threads that recorded events have finished
+bool writeTrace(const std::string &filename);
+
+class TraceScope
+{
+public:
+	// detail is shown as an argument of the span and has to outlive the scope
+	TraceScope(const char *category, const char *name, const std::string *detail = nullptr)
+		: mCategory(category), mName(name), mDetail(detail)
+	{
+		if (gTraceEnabled)
+		{
+			mStart = getTraceTimestamp();
+		}
+	}
+
+	TraceScope(const TraceScope &) = delete;
+	TraceScope &operator=(const TraceScope &) = delete;
+
+	~TraceScope()
+	{
+		if (gTraceEnabled)
+		{
+			recordTraceEvent(mCategory, mName, mStart, getTraceTimestamp(), mDetail);
+		}
+	}
+
+private:
+	const char *mCategory;
+	const char *mName;
+	const std::string *mDetail;
+	uint64_t mStart = 0;
+};
@@ -0,0 +1,62 @@
+#include "trajectory.hpp"
+#include "stage-stats.hpp"
+
+namespace
+{
+
+// The three axes are independent dependency chains, running them in one loop keeps the adder
+// busy while each waits on its previous sum
+template<typename Accumulator>
+void accumulateAxes(const float *deltaX, const float *deltaY, const float *deltaZ, size_t frames,
+	const float start[3], float *x, float *y, float *z)
+{
+	Accumulator sumX = start[0];
+	Accumulator sumY = start[1];
+	Accumulator sumZ = start[2];
+	for (size_t i = 0; i < frames; ++i)
+	{
+		sumX += deltaX[i];
+		sumY += deltaY[i];
+		sumZ += deltaZ[i];
+		x[i] = static_cast<float>(sumX);
+		y[i] = static_cast<float>(sumY);
+		z[i] = static_cast<float>(sumZ);
+	}
+}
+
+}
+
+void accumulatePositions(const float *deltaX, const float *deltaY, const float *deltaZ, size_t frames,
+	const float start[3], float *x, float *y, float *z, bool doublePrecision)
+{
+	if (doublePrecision)
+	{
+		accumulateAxes<double>(deltaX, deltaY, deltaZ, frames, start, x, y, z);
+	}
+	else
+	{
+		accumulateAxes<float>(deltaX, deltaY, deltaZ, frames, start, x, y, z);
+	}
+}
+
+void reconstructTrajectory(const ReplayFile &replay, bool doublePrecision, Trajectory &trajectory)
+{
+	StageScope scope(Stage::Trajectory);
+	size_t frames = replay.playerPositionDelta.size();
+	trajectory.x.resize(frames);
+	trajectory.y.resize(frames);
+	trajectory.z.resize(frames);
+
+	// Split the per-frame vectors into planar columns, then sum those in place
+	for (size_t i = 0; i < frames; ++i)
+	{
+		const auto &delta = replay.playerPositionDelta[i];
+		trajectory.x[i] = delta.size() > 0 ? delta[0] : 0.f;
+		trajectory.y[i] = delta.size() > 1 ? delta[1] : 0.f;
+		trajectory.z[i] = delta.size() > 2 ? delta[2] : 0.f;
+	}
+	const float start[3] = { replay.header.startPositionX, replay.header.startPositionY, replay.header.startPositionZ };
+	accumulatePositions(trajectory.x.data(), trajectory.y.data(), trajectory.z.data(), frames,
+		start, trajectory.x.data(), trajectory.y.data(), trajectory.z.data(), doublePrecision);
+	scope.setBytes(frames * 3 * sizeof(float), frames * 3 * sizeof(float));
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "smb-replay.hpp"
+
+// Absolute player positions, one column per axis
+struct Trajectory
+{
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<float> z;
+};
+
+// Inclusive prefix sum of planar delta columns: x[i] = start[0] + deltaX[0] + ... + deltaX[i].
+// Float accumulation gives what summing frame by frame in float gives, double accumulation only
+// rounds once per output value. Outputs may alias their delta column.
+void accumulatePositions(const float *deltaX, const float *deltaY, const float *deltaZ, size_t frames,
+	const float start[3], float *x, float *y, float *z, bool doublePrecision);
+
+// Positions for every frame, starting from the header's start position
+void reconstructTrajectory(const ReplayFile &replay, bool doublePrecision, Trajectory &trajectory);
@@ -0,0 +1,422 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "corpus-bench.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+
+#include "smb-replay.hpp"
+using json = nlohmann::json;
+
+#include <boost/filesystem.hpp>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#ifndef SMB_BENCH_BUILD_TYPE
+#define SMB_BENCH_BUILD_TYPE ""
+#endif
+
+namespace
+{
+
+struct PairStats
+{
+	FileFormat inputFormat;
+	FileFormat outputFormat;
+	std::vector<double> latencies; // ns per file
+	uint64_t inputBytes = 0;
+	uint64_t outputBytes = 0;
+	size_t failures = 0;
+};
+
+struct FidelityCheck
+{
+	std::string name;
+	size_t checked = 0;
+	std::vector<std::string> failedFiles;
+};
+
+size_t getPeakRSS()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+	{
+		return 0;
+	}
+	return counters.PeakWorkingSetSize;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+	{
+		return 0;
+	}
+#ifdef __APPLE__
+	return static_cast<size_t>(usage.ru_maxrss);
+#else
+	return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+// Nearest-rank percentile, expects sorted input
+double getPercentile(const std::vector<double> &sorted, double percentile)
+{
+	if (sorted.empty())
+	{
+		return 0.;
+	}
+	size_t rank = static_cast<size_t>(std::ceil(percentile / 100. * sorted.size()));
+	return sorted[std::min(std::max(rank, static_cast<size_t>(1)), sorted.size()) - 1];
+}
+
+bool columnsMatch(const std::vector<float> &a, const std::vector<float> &b, float tolerance)
+{
+	if (a.size() != b.size())
+	{
+		return false;
+	}
+	for (size_t i = 0; i < a.size(); ++i)
+	{
+		if (!(std::fabs(a[i] - b[i]) <= tolerance))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool columnsMatch(const std::vector<std::vector<float>> &a, const std::vector<std::vector<float>> &b, float tolerance)
+{
+	if (a.size() != b.size())
+	{
+		return false;
+	}
+	for (size_t i = 0; i < a.size(); ++i)
+	{
+		if (!columnsMatch(a[i], b[i], tolerance))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// JSON stores the scaled floats, so anything within one quantization step of the original is
+// the same value once it is written back out
+bool replaysMatchWithinScale(const ReplayFile &a, const ReplayFile &b)
+{
+	std::vector<uint8_t> headerA, headerB;
+	serializeBinary(headerA, a.header);
+	serializeBinary(headerB, b.header);
+	return headerA == headerB
+		&& columnsMatch(a.playerPositionDelta, b.playerPositionDelta, ReplayFile::cPlayerPositionDeltaScale)
+		&& columnsMatch(a.playerTilt, b.playerTilt, ReplayFile::cPlayerTiltScale)
+		&& columnsMatch(a.data567, b.data567, ReplayFile::cData567Scale)
+		&& columnsMatch(a.data8, b.data8, ReplayFile::cData8Scale)
+		&& a.flags == b.flags
+		&& columnsMatch(a.stageTilt, b.stageTilt, ReplayFile::cStageTiltScale);
+}
+
+bool convert(FileFormat inputFormat, BufferView input, FileFormat outputFormat, const EncodeOptions &options, std::vector<uint8_t> &output)
+{
+	ReplayFile replay;
+	return decodeReplay(inputFormat, input, replay) && encodeReplay(outputFormat, replay, options, output);
+}
+
+std::vector<std::string> findCorpusFiles(const std::string &corpusPath)
+{
+	namespace fs = boost::filesystem;
+	std::vector<std::string> files;
+	for (fs::recursive_directory_iterator it(corpusPath), end; it != end; ++it)
+	{
+		if (fs::is_regular_file(it->status()) && getFileFormatByExtension(it->path().string()) != FileFormat::Unknown)
+		{
+			files.emplace_back(it->path().string());
+		}
+	}
+	// Walk order depends on the file system, keep runs comparable
+	std::sort(files.begin(), files.end());
+	return files;
+}
+
+}
+
+int runCorpusBenchmark(const CorpusBenchmarkOptions &options)
+{
+	using clock = std::chrono::steady_clock;
+
+	std::vector<std::string> files;
+	try
+	{
+		files = findCorpusFiles(options.corpusPath);
+	}
+	catch (const boost::filesystem::filesystem_error &error)
+	{
+		std::cout << "Failed to read corpus: " << error.what() << std::endl;
+		return -1;
+	}
+	if (files.empty())
+	{
+		std::cout << "No replays found in corpus!" << std::endl;
+		return -1;
+	}
+
+	std::vector<PairStats> pairs;
+	for (const auto &input : getFileFormats())
+	{
+		for (const auto &output : getFileFormats())
+		{
+			if (input.canDecode && output.canEncode)
+			{
+				PairStats stats;
+				stats.inputFormat = input.format;
+				stats.outputFormat = output.format;
+				pairs.emplace_back(stats);
+			}
+		}
+	}
+
+	FidelityCheck gciCheck, binaryCheck, jsonCheck;
+	gciCheck.name = "gci-binary-gci";
+	binaryCheck.name = "binary-binary";
+	jsonCheck.name = "binary-json-binary";
+
+	size_t decodeErrors = 0;
+	uint64_t corpusBytes = 0;
+	clock::duration loadTime(0);
+	auto wallStart = clock::now();
+
+	for (const auto &filename : files)
+	{
+		auto loadStart = clock::now();
+		auto data = loadFile(filename);
+		loadTime += clock::now() - loadStart;
+		corpusBytes += data.size();
+
+		ReplayFile replay;
+		bool decoded = false;
+		try
+		{
+			decoded = data.size() && decodeReplay(getFileFormatByExtension(filename), data, replay);
+		}
+		catch (const std::exception &)
+		{
+		}
+		if (!decoded)
+		{
+			++decodeErrors;
+			continue;
+		}
+
+		// Fixed name and comment so GCI output only depends on the replay itself
+		EncodeOptions encodeOptions;
+		encodeOptions.replayComment = getReplayComment(replay.header, "smb-bench", 0);
+		encodeOptions.gciFilename = "smkb0000000000000000";
+
+		// Every pair starts from the original replay re-encoded in the pair's input format
+		std::vector<std::vector<uint8_t>> encoded(getFileFormats().size());
+		for (size_t i = 0; i < getFileFormats().size(); ++i)
+		{
+			encodeReplay(getFileFormats()[i].format, replay, encodeOptions, encoded[i]);
+		}
+		auto getEncoded = [&](FileFormat format) -> const std::vector<uint8_t> &
+		{
+			for (size_t i = 0; i < getFileFormats().size(); ++i)
+			{
+				if (getFileFormats()[i].format == format)
+				{
+					return encoded[i];
+				}
+			}
+			return encoded.front();
+		};
+
+		for (auto &pair : pairs)
+		{
+			const std::vector<uint8_t> &input = getEncoded(pair.inputFormat);
+			std::vector<uint8_t> output;
+			auto start = clock::now();
+			bool converted = false;
+			try
+			{
+				ReplayFile intermediate;
+				converted = decodeReplay(pair.inputFormat, input, intermediate)
+					&& encodeReplay(pair.outputFormat, intermediate, encodeOptions, output);
+			}
+			catch (const std::exception &)
+			{
+			}
+			auto elapsed = clock::now() - start;
+			if (!converted)
+			{
+				++pair.failures;
+				continue;
+			}
+			pair.latencies.emplace_back(static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+			pair.inputBytes += input.size();
+			pair.outputBytes += output.size();
+		}
+
+		// gci -> binary -> gci has to reproduce the GCI byte for byte
+		{
+			std::vector<uint8_t> binary, gci;
+			bool ok = convert(FileFormat::GCI, getEncoded(FileFormat::GCI), FileFormat::Binary, encodeOptions, binary)
+				&& convert(FileFormat::Binary, binary, FileFormat::GCI, encodeOptions, gci)
+				&& gci == getEncoded(FileFormat::GCI);
+			++gciCheck.checked;
+			if (!ok)
+				gciCheck.failedFiles.emplace_back(filename);
+		}
+		// binary -> binary is lossless once the values are on the storage grid
+		{
+			std::vector<uint8_t> binary;
+			bool ok = convert(FileFormat::Binary, getEncoded(FileFormat::Binary), FileFormat::Binary, encodeOptions, binary)
+				&& binary == getEncoded(FileFormat::Binary);
+			++binaryCheck.checked;
+			if (!ok)
+				binaryCheck.failedFiles.emplace_back(filename);
+		}
+		// binary -> json -> binary has to land within one quantization step of every value
+		{
+			std::vector<uint8_t> jsonData, binary;
+			ReplayFile reference, roundTripped;
+			bool ok = false;
+			try
+			{
+				ok = convert(FileFormat::Binary, getEncoded(FileFormat::Binary), FileFormat::JSON, encodeOptions, jsonData)
+					&& convert(FileFormat::JSON, jsonData, FileFormat::Binary, encodeOptions, binary)
+					&& decodeReplay(FileFormat::Binary, getEncoded(FileFormat::Binary), reference)
+					&& decodeReplay(FileFormat::Binary, binary, roundTripped)
+					&& replaysMatchWithinScale(reference, roundTripped);
+			}
+			catch (const std::exception &)
+			{
+			}
+			++jsonCheck.checked;
+			if (!ok)
+				jsonCheck.failedFiles.emplace_back(filename);
+		}
+	}
+
+	double wallSeconds = std::chrono::duration<double>(clock::now() - wallStart).count();
+	size_t peakRSS = getPeakRSS();
+	size_t replayCount = files.size() - decodeErrors;
+
+	std::cout << "corpus: " << options.corpusPath << " (" << files.size() << " files, "
+		<< corpusBytes << " bytes, " << decodeErrors << " unreadable)" << std::endl;
+	std::cout << std::left << std::setw(16) << "pair"
+		<< std::right << std::setw(8) << "files"
+		<< std::setw(8) << "failed"
+		<< std::setw(12) << "files/s"
+		<< std::setw(10) << "MB/s"
+		<< std::setw(12) << "p50 us"
+		<< std::setw(12) << "p99 us" << std::endl;
+
+	json pairsJSON = json::array();
+	double totalSeconds = 0.;
+	uint64_t totalBytes = 0;
+	size_t totalConversions = 0;
+	for (auto &pair : pairs)
+	{
+		std::sort(pair.latencies.begin(), pair.latencies.end());
+		double seconds = 0.;
+		for (auto latency : pair.latencies)
+		{
+			seconds += latency / 1e9;
+		}
+		double filesPerSecond = seconds > 0. ? pair.latencies.size() / seconds : 0.;
+		double mbPerSecond = seconds > 0. ? (pair.inputBytes / 1e6) / seconds : 0.;
+		double p50 = getPercentile(pair.latencies, 50.) / 1e3;
+		double p99 = getPercentile(pair.latencies, 99.) / 1e3;
+		totalSeconds += seconds;
+		totalBytes += pair.inputBytes;
+		totalConversions += pair.latencies.size();
+
+		std::string name = std::string(getFileFormatName(pair.inputFormat)) + "->" + getFileFormatName(pair.outputFormat);
+		std::cout << std::left << std::setw(16) << name
+			<< std::right << std::setw(8) << pair.latencies.size()
+			<< std::setw(8) << pair.failures
+			<< std::fixed << std::setprecision(1) << std::setw(12) << filesPerSecond
+			<< std::setw(10) << mbPerSecond
+			<< std::setw(12) << p50
+			<< std::setw(12) << p99 << std::endl;
+
+		json entry;
+		entry["input"] = getFileFormatName(pair.inputFormat);
+		entry["output"] = getFileFormatName(pair.outputFormat);
+		entry["files"] = pair.latencies.size();
+		entry["failures"] = pair.failures;
+		entry["inputBytes"] = pair.inputBytes;
+		entry["outputBytes"] = pair.outputBytes;
+		entry["filesPerSecond"] = filesPerSecond;
+		entry["mbPerSecond"] = mbPerSecond;
+		entry["p50Microseconds"] = p50;
+		entry["p99Microseconds"] = p99;
+		pairsJSON.emplace_back(entry);
+	}
+
+	// The headline number: conversions per second over all pairs
+	double overallFilesPerSecond = totalSeconds > 0. ? totalConversions / totalSeconds : 0.;
+	double overallMBPerSecond = totalSeconds > 0. ? (totalBytes / 1e6) / totalSeconds : 0.;
+	double loadMBPerSecond = loadTime.count() ? (corpusBytes / 1e6) / std::chrono::duration<double>(loadTime).count() : 0.;
+	std::cout << std::left << std::setw(16) << "all pairs"
+		<< std::right << std::setw(8) << totalConversions
+		<< std::setw(8) << ""
+		<< std::setw(12) << overallFilesPerSecond
+		<< std::setw(10) << overallMBPerSecond << std::endl;
+	std::cout << "load: " << loadMBPerSecond << " MB/s, wall: " << wallSeconds << " s, peak RSS: "
+		<< peakRSS / (1024 * 1024) << " MiB" << std::endl;
+
+	bool fidelityFailed = false;
+	json fidelityJSON;
+	for (const auto *check : { &gciCheck, &binaryCheck, &jsonCheck })
+	{
+		std::cout << "fidelity " << check->name << ": " << check->checked - check->failedFiles.size()
+			<< "/" << check->checked << " ok" << std::endl;
+		for (size_t i = 0; i < check->failedFiles.size() && i < 10; ++i)
+		{
+			std::cout << "  mismatch: " << check->failedFiles[i] << std::endl;
+		}
+		fidelityFailed |= !check->failedFiles.empty();
+		fidelityJSON[check->name]["checked"] = check->checked;
+		fidelityJSON[check->name]["failed"] = check->failedFiles;
+	}
+
+	if (!options.jsonPath.empty())
+	{
+		json output;
+		output["tool"] = "smb-bench";
+		output["mode"] = "corpus";
+		output["label"] = options.label;
+		output["buildType"] = SMB_BENCH_BUILD_TYPE;
+		output["corpus"] = options.corpusPath;
+		output["files"] = files.size();
+		output["replays"] = replayCount;
+		output["unreadable"] = decodeErrors;
+		output["corpusBytes"] = corpusBytes;
+		output["peakRSSBytes"] = peakRSS;
+		output["wallSeconds"] = wallSeconds;
+		output["loadMBPerSecond"] = loadMBPerSecond;
+		output["filesPerSecond"] = overallFilesPerSecond;
+		output["mbPerSecond"] = overallMBPerSecond;
+		output["pairs"] = pairsJSON;
+		output["fidelity"] = fidelityJSON;
+		if (!saveFile(options.jsonPath, stringToBuffer(output.dump(2))))
+		{
+			std::cout << "Failed to write JSON results!" << std::endl;
+			return -1;
+		}
+	}
+
+	return fidelityFailed ? 2 : 0;
+}
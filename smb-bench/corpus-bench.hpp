@@ -0,0 +1,14 @@
+#pragma once
+
+#include <string>
+
+struct CorpusBenchmarkOptions
+{
+	std::string corpusPath;
+	std::string jsonPath;
+	std::string label;
+};
+
+// Converts every replay in a corpus directory between every pair of formats and checks that the
+// round trips are lossless. Returns the process exit code.
+int runCorpusBenchmark(const CorpusBenchmarkOptions &options);
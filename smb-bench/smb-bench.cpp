@@ -0,0 +1,371 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <memory>
+
+#include "smb-replay.hpp"
+#include "trajectory.hpp"
+#include "hash.hpp"
+#include "csv.hpp"
+#include "corpus-bench.hpp"
+#include "synthetic-replay.hpp"
+using json = nlohmann::json;
+
+#include <boost/program_options.hpp>
+
+#ifndef SMB_BENCH_BUILD_TYPE
+#define SMB_BENCH_BUILD_TYPE ""
+#endif
+
+struct Benchmark
+{
+	std::string name;
+	// Bytes a single iteration processes, used for ns/byte and MB/s
+	size_t bytes;
+	// Untimed, runs before every iteration (e.g. to refill a buffer the stage consumes)
+	std::function<void()> setup;
+	std::function<size_t()> run;
+};
+
+struct BenchmarkResult
+{
+	std::string name;
+	size_t bytes;
+	size_t iterations;
+	double nsPerIteration;
+	double nsPerByte;
+	double mbPerSecond;
+};
+
+// Stages return something derived from their output so it can't be optimized away
+static volatile size_t gSink;
+
+BenchmarkResult runBenchmark(const Benchmark &benchmark, std::chrono::nanoseconds minTime, size_t minIterations)
+{
+	using clock = std::chrono::steady_clock;
+
+	// Warm up caches and the allocator
+	if (benchmark.setup)
+		benchmark.setup();
+	gSink = benchmark.run();
+
+	std::vector<double> samples;
+	clock::duration total(0);
+	while (total < minTime || samples.size() < minIterations)
+	{
+		if (benchmark.setup)
+			benchmark.setup();
+		auto start = clock::now();
+		gSink = benchmark.run();
+		auto elapsed = clock::now() - start;
+		total += elapsed;
+		samples.emplace_back(static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+	}
+
+	// Median is a lot more stable than the mean when the machine is not idle
+	std::sort(samples.begin(), samples.end());
+	double median = samples[samples.size() / 2];
+
+	BenchmarkResult result;
+	result.name = benchmark.name;
+	result.bytes = benchmark.bytes;
+	result.iterations = samples.size();
+	result.nsPerIteration = median;
+	result.nsPerByte = benchmark.bytes ? median / benchmark.bytes : 0.;
+	result.mbPerSecond = median > 0. ? (benchmark.bytes / 1e6) / (median / 1e9) : 0.;
+	return result;
+}
+
+bool loadReplay(const std::string &filename, const std::string &formatName, ReplayFile &replay)
+{
+	auto data = loadFile(filename);
+	if (!data.size())
+	{
+		return false;
+	}
+	return decodeReplay(getFileFormatByName(formatName), data, replay);
+}
+
+std::vector<Benchmark> makeBenchmarks(const ReplayFile &replay)
+{
+	std::vector<Benchmark> benchmarks;
+
+	// Reference encodings of the payload every stage starts from
+	std::vector<uint8_t> binary;
+	serializeBinary(binary, replay);
+	auto compressed = compressBufferRLE(binary);
+	std::vector<uint8_t> gci;
+	serializeGCI(gci, replay, getReplayComment(replay.header, "smb-bench", 0), "smkb0000000000000000");
+	json replayJSON;
+	serializeJSON(replayJSON, "root", replay);
+	std::string jsonText = replayJSON.dump();
+
+	// Everything behind the GCI header and CRC is what the CRC covers
+	const size_t crcOffset = 0x40 + sizeof(uint16_t);
+	std::vector<uint8_t> crcData(gci.begin() + crcOffset, gci.end());
+
+	benchmarks.push_back({ "rle-compress", binary.size(), nullptr, [=]()
+	{
+		return compressBufferRLE(binary).size();
+	} });
+	benchmarks.push_back({ "rle-compress-optimal", binary.size(), nullptr, [=]()
+	{
+		return compressBufferRLEOptimal(binary).size();
+	} });
+	benchmarks.push_back({ "rle-decompress", binary.size(), nullptr, [=]()
+	{
+		return decompressBufferRLE(compressed, binary.size()).size();
+	} });
+	benchmarks.push_back({ "crc", crcData.size(), nullptr, [=]()
+	{
+		return static_cast<size_t>(getCRCForBuffer(crcData));
+	} });
+	benchmarks.push_back({ "crc-x4", crcData.size() * 4, nullptr, [=]()
+	{
+		const uint8_t *buffers[4] = { crcData.data(), crcData.data(), crcData.data(), crcData.data() };
+		size_t sizes[4] = { crcData.size(), crcData.size(), crcData.size(), crcData.size() };
+		uint16_t checksums[4];
+		getCRCForBuffers(buffers, sizes, 4, checksums);
+		return static_cast<size_t>(checksums[3]);
+	} });
+	benchmarks.push_back({ "hash128", binary.size(), nullptr, [=]()
+	{
+		return static_cast<size_t>(hashBuffer128(binary).low);
+	} });
+
+	// One pair per column of the schema, bytes being the column's share of the binary replay
+	forEachColumn([&](const auto &column, auto offset)
+	{
+		size_t columnSize = sizeof(typename std::decay_t<decltype(column)>::StorageType) * column.dimensions * ReplayFile::cChunkSize;
+		benchmarks.push_back({ std::string("column-encode-") + column.name, columnSize, nullptr, [=]()
+		{
+			std::vector<uint8_t> buffer(columnSize);
+			encodeColumn(buffer.data(), column, replay);
+			return static_cast<size_t>(buffer.front());
+		} });
+		benchmarks.push_back({ std::string("column-decode-") + column.name, columnSize, nullptr, [=]()
+		{
+			ReplayFile decoded;
+			decodeColumn(binary.data() + offset, column, decoded);
+			return (decoded.*column.member).size();
+		} });
+	});
+
+	benchmarks.push_back({ "trajectory-float", ReplayFile::cChunkSize * 3 * sizeof(float), nullptr, [=]()
+	{
+		Trajectory trajectory;
+		reconstructTrajectory(replay, false, trajectory);
+		return trajectory.x.size();
+	} });
+	benchmarks.push_back({ "trajectory-double", ReplayFile::cChunkSize * 3 * sizeof(float), nullptr, [=]()
+	{
+		Trajectory trajectory;
+		reconstructTrajectory(replay, true, trajectory);
+		return trajectory.x.size();
+	} });
+
+	json headerJSON;
+	serializeJSON(headerJSON, "header", replay.header);
+	benchmarks.push_back({ "header-serialize-binary", ReplayFile::cHeaderSize, nullptr, [=]()
+	{
+		std::vector<uint8_t> buffer;
+		serializeBinary(buffer, replay.header);
+		return buffer.size();
+	} });
+	benchmarks.push_back({ "header-deserialize-binary", ReplayFile::cHeaderSize, nullptr, [=]()
+	{
+		ReplayFileHeader header;
+		BufferView view(binary);
+		deserializeBinary(view, header);
+		return static_cast<size_t>(header.levelID);
+	} });
+	benchmarks.push_back({ "header-serialize-json", ReplayFile::cHeaderSize, nullptr, [=]()
+	{
+		json outputJSON;
+		serializeJSON(outputJSON, "header", replay.header);
+		return outputJSON.size();
+	} });
+	benchmarks.push_back({ "header-deserialize-json", ReplayFile::cHeaderSize, nullptr, [=]()
+	{
+		ReplayFileHeader header;
+		deserializeJSON(headerJSON, "header", header);
+		return static_cast<size_t>(header.levelID);
+	} });
+
+	benchmarks.push_back({ "replay-serialize-binary", binary.size(), nullptr, [=]()
+	{
+		std::vector<uint8_t> buffer;
+		serializeBinary(buffer, replay);
+		return buffer.size();
+	} });
+	benchmarks.push_back({ "replay-deserialize-binary", binary.size(), nullptr, [=]()
+	{
+		ReplayFile decoded;
+		BufferView view(binary);
+		deserializeBinary(view, decoded);
+		return decoded.flags.size();
+	} });
+	benchmarks.push_back({ "replay-serialize-json", jsonText.size(), nullptr, [=]()
+	{
+		json outputJSON;
+		serializeJSON(outputJSON, "root", replay);
+		return outputJSON.dump().size();
+	} });
+	benchmarks.push_back({ "replay-deserialize-json", jsonText.size(), nullptr, [=]()
+	{
+		ReplayFile decoded;
+		json inputJSON = json::parse(jsonText);
+		deserializeJSON(inputJSON, "root", decoded);
+		return decoded.flags.size();
+	} });
+	std::vector<uint8_t> csv;
+	serializeCSV(csv, replay, EncodeOptions());
+	benchmarks.push_back({ "replay-serialize-csv", csv.size(), nullptr, [=]()
+	{
+		std::vector<uint8_t> buffer;
+		serializeCSV(buffer, replay, EncodeOptions());
+		return buffer.size();
+	} });
+	benchmarks.push_back({ "replay-serialize-gci", gci.size(), nullptr, [=]()
+	{
+		std::vector<uint8_t> buffer;
+		serializeGCI(buffer, replay, "smb-bench", "smkb0000000000000000");
+		return buffer.size();
+	} });
+	benchmarks.push_back({ "replay-deserialize-gci", gci.size(), nullptr, [=]()
+	{
+		ReplayFile decoded;
+		deserializeGCI(gci, decoded);
+		return decoded.flags.size();
+	} });
+
+	return benchmarks;
+}
+
+int main(int argc, char **argv)
+{
+	namespace po = boost::program_options;
+	po::options_description optionDescription("Valid options");
+	optionDescription.add_options()
+		("help",												"print usage")
+		("replay,r",		po::value<std::string>(),			"replay to use as payload instead of a synthetic one")
+		("seed,s",			po::value<uint64_t>()->default_value(1), "seed of the synthetic replay used as payload")
+		("corpus",			po::value<std::string>(),			"run the end-to-end benchmark over every replay in this directory instead")
+		("replay-format,f",	po::value<std::string>()->default_value("gci"), "format of the replay passed with --replay (binary, gci, json)")
+		("filter",			po::value<std::string>(),			"only run benchmarks whose name contains this string")
+		("min-time",		po::value<int>()->default_value(200), "minimum time to spend on each benchmark in milliseconds")
+		("min-iterations",	po::value<int>()->default_value(5),	"minimum number of timed iterations per benchmark")
+		("label",			po::value<std::string>(),			"free-form label stored in the JSON results, e.g. a commit hash")
+		("json",			po::value<std::string>(),			"also write results as JSON to this file");
+	std::vector<std::string> unrecognizedOptions;
+
+	bool parsingError = false;
+	po::variables_map varMap;
+	try
+	{
+		po::parsed_options parsedOptions = po::command_line_parser(argc, argv)
+			.options(optionDescription)
+			.allow_unregistered().run();
+		unrecognizedOptions = po::collect_unrecognized(parsedOptions.options, po::include_positional);
+		po::store(parsedOptions, varMap);
+		po::notify(varMap);
+	}
+	catch (const boost::exception &)
+	{
+		parsingError = true;
+	}
+
+	if (parsingError || unrecognizedOptions.size()
+		|| varMap.count("help")
+		|| varMap.at("min-time").as<int>() < 0
+		|| varMap.at("min-iterations").as<int>() < 1)
+	{
+		optionDescription.print(std::cout);
+		return 1;
+	}
+
+	if (varMap.count("corpus"))
+	{
+		CorpusBenchmarkOptions corpusOptions;
+		corpusOptions.corpusPath = varMap.at("corpus").as<std::string>();
+		corpusOptions.jsonPath = varMap.count("json") ? varMap.at("json").as<std::string>() : "";
+		corpusOptions.label = varMap.count("label") ? varMap.at("label").as<std::string>() : "";
+		return runCorpusBenchmark(corpusOptions);
+	}
+
+	ReplayFile replay;
+	std::string payloadSource = "synthetic:" + std::to_string(varMap.at("seed").as<uint64_t>());
+	if (varMap.count("replay"))
+	{
+		payloadSource = varMap.at("replay").as<std::string>();
+		if (!loadReplay(payloadSource, varMap.at("replay-format").as<std::string>(), replay))
+		{
+			std::cout << "Failed to read replay!" << std::endl;
+			return -1;
+		}
+	}
+	else
+	{
+		replay = generateSyntheticReplay(varMap.at("seed").as<uint64_t>());
+	}
+
+	auto minTime = std::chrono::milliseconds(varMap.at("min-time").as<int>());
+	size_t minIterations = static_cast<size_t>(varMap.at("min-iterations").as<int>());
+	std::string filter = varMap.count("filter") ? varMap.at("filter").as<std::string>() : "";
+
+	std::cout << std::left << std::setw(36) << "benchmark"
+		<< std::right << std::setw(10) << "bytes"
+		<< std::setw(8) << "iters"
+		<< std::setw(14) << "ns/iter"
+		<< std::setw(10) << "ns/byte"
+		<< std::setw(10) << "MB/s" << std::endl;
+
+	std::vector<BenchmarkResult> results;
+	for (const auto &benchmark : makeBenchmarks(replay))
+	{
+		if (benchmark.name.find(filter) == std::string::npos)
+		{
+			continue;
+		}
+		auto result = runBenchmark(benchmark, minTime, minIterations);
+		std::cout << std::left << std::setw(36) << result.name
+			<< std::right << std::setw(10) << result.bytes
+			<< std::setw(8) << result.iterations
+			<< std::fixed << std::setprecision(0) << std::setw(14) << result.nsPerIteration
+			<< std::setprecision(3) << std::setw(10) << result.nsPerByte
+			<< std::setprecision(1) << std::setw(10) << result.mbPerSecond << std::endl;
+		results.emplace_back(result);
+	}
+
+	if (varMap.count("json"))
+	{
+		json output;
+		output["tool"] = "smb-bench";
+		output["label"] = varMap.count("label") ? varMap.at("label").as<std::string>() : "";
+		output["buildType"] = SMB_BENCH_BUILD_TYPE;
+		output["payload"] = payloadSource;
+		for (const auto &result : results)
+		{
+			json entry;
+			entry["name"] = result.name;
+			entry["bytes"] = result.bytes;
+			entry["iterations"] = result.iterations;
+			entry["nsPerIteration"] = result.nsPerIteration;
+			entry["nsPerByte"] = result.nsPerByte;
+			entry["mbPerSecond"] = result.mbPerSecond;
+			output["results"].emplace_back(entry);
+		}
+		if (!saveFile(varMap.at("json").as<std::string>(), stringToBuffer(output.dump(2))))
+		{
+			std::cout << "Failed to write JSON results!" << std::endl;
+			return -1;
+		}
+	}
+
+	return 0;
+}
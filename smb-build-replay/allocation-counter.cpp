@@ -0,0 +1,74 @@
+// Replaces the global allocation functions so --stats can report allocations per stage.
+// Only linked into the command line tool, never into anything that gets embedded.
+
+#include <cstdlib>
+#include <new>
+
+#include "stage-stats.hpp"
+
+namespace
+{
+
+void *allocate(std::size_t size)
+{
+	++tAllocationCount;
+	// malloc(0) may return null, operator new may not
+	return std::malloc(size ? size : 1);
+}
+
+}
+
+void *operator new(std::size_t size)
+{
+	void *pointer = allocate(size);
+	if (!pointer)
+	{
+		throw std::bad_alloc();
+	}
+	return pointer;
+}
+
+void *operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+	return allocate(size);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+	return allocate(size);
+}
+
+void operator delete(void *pointer) noexcept
+{
+	std::free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept
+{
+	std::free(pointer);
+}
+
+void operator delete(void *pointer, std::size_t) noexcept
+{
+	std::free(pointer);
+}
+
+void operator delete[](void *pointer, std::size_t) noexcept
+{
+	std::free(pointer);
+}
+
+void operator delete(void *pointer, const std::nothrow_t &) noexcept
+{
+	std::free(pointer);
+}
+
+void operator delete[](void *pointer, const std::nothrow_t &) noexcept
+{
+	std::free(pointer);
+}
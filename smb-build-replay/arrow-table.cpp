@@ -0,0 +1,654 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "arrow-table.hpp"
+#include "stage-stats.hpp"
+
+#include <array>
+#include <algorithm>
+
+namespace
+{
+
+// MetadataVersion V5
+const int16_t cMetadataVersion = 4;
+// MessageHeader union
+const uint8_t cSchemaHeader = 1;
+const uint8_t cRecordBatchHeader = 3;
+const uint32_t cContinuation = 0xFFFFFFFF;
+// Padded to 8 at the start of the file, not at the end
+const char cArrowMagic[8] = "ARROW1";
+
+// Just enough of a FlatBuffers writer for the Arrow metadata. Everything is written front to
+// back with parents before what they point to, since offsets may only point forward, and each
+// offset field is patched once its target is written.
+class FlatBufferWriter
+{
+public:
+	// Offset fields of a table by field id
+	using Slots = std::array<size_t, 8>;
+
+	explicit FlatBufferWriter(std::vector<uint8_t> &buffer)
+		: mBuffer(buffer), mStart(buffer.size())
+	{
+		mBuffer.resize(mStart + 4, 0);
+	}
+
+	// Slot of the root table offset
+	size_t getRoot() const { return mStart; }
+
+	void beginTable()
+	{
+		mFields.clear();
+	}
+
+	template<typename T>
+	void addScalar(uint16_t id, T value)
+	{
+		Field field = { id, sizeof(T), false, {} };
+		writeLittleEndian(field.data, value);
+		mFields.push_back(field);
+	}
+
+	void addOffset(uint16_t id)
+	{
+		mFields.push_back({ id, 4, true, {} });
+	}
+
+	// Writes the vtable and right behind it the table, and points slot at the table
+	Slots endTable(size_t slot)
+	{
+		// Biggest first after the vtable offset, so every field is naturally aligned
+		std::stable_sort(mFields.begin(), mFields.end(), [](const Field &a, const Field &b) { return a.size > b.size; });
+		uint16_t fieldOffsets[std::tuple_size<Slots>::value] = {};
+		size_t fieldCount = 0;
+		size_t tableSize = 4;
+		for (const auto &field : mFields)
+		{
+			fieldOffsets[field.id] = static_cast<uint16_t>(tableSize);
+			fieldCount = std::max<size_t>(fieldCount, field.id + 1);
+			tableSize += field.size;
+		}
+
+		align(2);
+		size_t vtable = mBuffer.size();
+		appendLittleEndian(mBuffer, static_cast<uint16_t>(4 + 2 * fieldCount));
+		appendLittleEndian(mBuffer, static_cast<uint16_t>(tableSize));
+		for (size_t i = 0; i < fieldCount; ++i)
+		{
+			appendLittleEndian(mBuffer, fieldOffsets[i]);
+		}
+
+		// With 8 byte fields the table starts 4 bytes before an 8 byte boundary
+		bool wide = !mFields.empty() && mFields.front().size == 8;
+		align(wide ? 8 : 4, wide ? 4 : 0);
+		size_t table = mBuffer.size();
+		appendLittleEndian(mBuffer, static_cast<int32_t>(table - vtable));
+		Slots slots = {};
+		for (const auto &field : mFields)
+		{
+			if (field.offset)
+			{
+				slots[field.id] = mBuffer.size();
+			}
+			mBuffer.insert(mBuffer.end(), field.data, field.data + field.size);
+		}
+		point(slot, table);
+		return slots;
+	}
+
+	void writeString(size_t slot, const std::string &text)
+	{
+		align(4);
+		point(slot, mBuffer.size());
+		appendLittleEndian(mBuffer, static_cast<uint32_t>(text.size()));
+		mBuffer.insert(mBuffer.end(), text.begin(), text.end());
+		mBuffer.push_back(0);
+	}
+
+	// Returns the slot of the first element, the others follow 4 bytes apart
+	size_t writeOffsetVector(size_t slot, size_t count)
+	{
+		align(4);
+		point(slot, mBuffer.size());
+		appendLittleEndian(mBuffer, static_cast<uint32_t>(count));
+		size_t elements = mBuffer.size();
+		mBuffer.resize(elements + count * 4, 0);
+		return elements;
+	}
+
+	// Every Arrow struct is made of 8 byte aligned longs
+	void writeStructVector(size_t slot, const std::vector<uint8_t> &elements, size_t count)
+	{
+		align(8, 4);
+		point(slot, mBuffer.size());
+		appendLittleEndian(mBuffer, static_cast<uint32_t>(count));
+		mBuffer.insert(mBuffer.end(), elements.begin(), elements.end());
+	}
+
+	// Arrow wants the metadata padded to 8 bytes
+	void finish()
+	{
+		align(8);
+	}
+
+private:
+	struct Field
+	{
+		uint16_t id;
+		uint8_t size;
+		bool offset;
+		uint8_t data[8];
+	};
+
+	void align(size_t alignment, size_t remainder = 0)
+	{
+		while ((mBuffer.size() - mStart) % alignment != remainder)
+		{
+			mBuffer.push_back(0);
+		}
+	}
+
+	void point(size_t slot, size_t target)
+	{
+		writeLittleEndian(&mBuffer[slot], static_cast<uint32_t>(target - slot));
+	}
+
+	std::vector<uint8_t> &mBuffer;
+	size_t mStart;
+	std::vector<Field> mFields;
+};
+
+template<typename T>
+struct ColumnValue;
+
+template<typename T>
+struct ColumnValue<std::vector<T>>
+{
+	using Type = T;
+};
+
+template<typename T>
+struct ColumnValue<std::vector<std::vector<T>>>
+{
+	using Type = T;
+};
+
+template<typename T>
+ArrowArray::Type getArrowType(T)
+{
+	return ArrowArray::Type::Int;
+}
+
+ArrowArray::Type getArrowType(float)
+{
+	return ArrowArray::Type::FloatingPoint;
+}
+
+std::vector<ArrowArray> getArrowSchema(ArrowLayout layout)
+{
+	std::vector<ArrowArray> arrays;
+	auto addArray = [&arrays](const std::string &name, ArrowArray::Type type, uint32_t size, size_t children)
+	{
+		ArrowArray array;
+		array.name = name;
+		array.type = type;
+		array.size = size;
+		array.children = children;
+		arrays.push_back(array);
+	};
+
+	addArray("name", ArrowArray::Type::Utf8, 0, 0);
+	if (layout == ArrowLayout::Frames)
+	{
+		addArray("frame", ArrowArray::Type::Int, 32, 0);
+	}
+	addArray("header", ArrowArray::Type::Struct, 0, std::tuple_size<decltype(FieldTable<ReplayFileHeader>::get())>::value);
+	forEachField<ReplayFileHeader>([&addArray](const auto &field)
+	{
+		using Type = typename std::decay_t<decltype(field)>::Type;
+		addArray(field.name, getArrowType(Type()), sizeof(Type) * 8, 0);
+	});
+	forEachColumn([layout, &addArray](const auto &column, auto)
+	{
+		using Type = typename ColumnValue<std::decay_t<decltype(ReplayFile().*column.member)>>::Type;
+		std::string name = column.name;
+		if (layout == ArrowLayout::Replays)
+		{
+			addArray(name, ArrowArray::Type::List, 0, 1);
+			name = "item";
+		}
+		if (column.dimensions > 1)
+		{
+			addArray(name, ArrowArray::Type::FixedSizeList, static_cast<uint32_t>(column.dimensions), 1);
+			name = "item";
+		}
+		addArray(name, getArrowType(Type()), sizeof(Type) * 8, 0);
+	});
+	return arrays;
+}
+
+// Past the last descendant of arrays[index]
+size_t skipArray(const std::vector<ArrowArray> &arrays, size_t index)
+{
+	size_t children = arrays[index++].children;
+	for (size_t i = 0; i < children; ++i)
+	{
+		index = skipArray(arrays, index);
+	}
+	return index;
+}
+
+// Writes the Field table of arrays[index] and its children, returns the index past them
+size_t writeField(FlatBufferWriter &writer, size_t slot, const std::vector<ArrowArray> &arrays, size_t index)
+{
+	const auto &array = arrays[index++];
+	writer.beginTable();
+	writer.addOffset(0);
+	writer.addScalar<uint8_t>(2, static_cast<uint8_t>(array.type));
+	writer.addOffset(3);
+	if (array.children)
+	{
+		writer.addOffset(5);
+	}
+	auto field = writer.endTable(slot);
+	writer.writeString(field[0], array.name);
+
+	// Every integer is unsigned, the default, and every float single precision
+	writer.beginTable();
+	switch (array.type)
+	{
+	case ArrowArray::Type::Int:
+	case ArrowArray::Type::FixedSizeList:
+		writer.addScalar<int32_t>(0, static_cast<int32_t>(array.size));
+		break;
+	case ArrowArray::Type::FloatingPoint:
+		writer.addScalar<int16_t>(0, 1);
+		break;
+	default:
+		break;
+	}
+	writer.endTable(field[3]);
+
+	if (array.children)
+	{
+		size_t element = writer.writeOffsetVector(field[5], array.children);
+		for (size_t i = 0; i < array.children; ++i)
+		{
+			index = writeField(writer, element + i * 4, arrays, index);
+		}
+	}
+	return index;
+}
+
+void writeSchema(FlatBufferWriter &writer, size_t slot, const std::vector<ArrowArray> &arrays)
+{
+	size_t fieldCount = 0;
+	for (size_t index = 0; index < arrays.size(); index = skipArray(arrays, index))
+	{
+		++fieldCount;
+	}
+
+	writer.beginTable();
+	writer.addOffset(1);
+	auto schema = writer.endTable(slot);
+	size_t element = writer.writeOffsetVector(schema[1], fieldCount);
+	for (size_t index = 0; index < arrays.size(); element += 4)
+	{
+		index = writeField(writer, element, arrays, index);
+	}
+}
+
+// Encapsulated IPC message: continuation marker, metadata length and the Message flatbuffer
+// padded to 8 bytes. The caller appends bodyLength bytes of body.
+template<typename WriteHeader>
+void appendMessage(std::vector<uint8_t> &buffer, uint8_t headerType, int64_t bodyLength, WriteHeader &&writeHeader)
+{
+	appendLittleEndian(buffer, cContinuation);
+	size_t lengthOffset = buffer.size();
+	appendLittleEndian(buffer, static_cast<int32_t>(0));
+
+	FlatBufferWriter writer(buffer);
+	writer.beginTable();
+	writer.addScalar<int16_t>(0, cMetadataVersion);
+	writer.addScalar<uint8_t>(1, headerType);
+	writer.addOffset(2);
+	writer.addScalar<int64_t>(3, bodyLength);
+	auto message = writer.endTable(writer.getRoot());
+	writeHeader(writer, message[2]);
+	writer.finish();
+
+	writeLittleEndian(&buffer[lengthOffset], static_cast<int32_t>(buffer.size() - lengthOffset - 4));
+}
+
+void appendPadded(std::vector<uint8_t> &buffer, const std::vector<uint8_t> &data)
+{
+	buffer.insert(buffer.end(), data.begin(), data.end());
+	buffer.resize(buffer.size() + (8 - data.size() % 8) % 8, 0);
+}
+
+void resetArray(ArrowArray &array)
+{
+	array.length = 0;
+	array.offsets.clear();
+	array.values.clear();
+	if (array.type == ArrowArray::Type::Utf8 || array.type == ArrowArray::Type::List)
+	{
+		appendLittleEndian(array.offsets, static_cast<int32_t>(0));
+	}
+}
+
+// Grows data by size bytes at once, the per value appends would each check the capacity
+uint8_t *extend(std::vector<uint8_t> &data, size_t size)
+{
+	size_t offset = data.size();
+	data.resize(offset + size);
+	return &data[offset];
+}
+
+// count times the same value, for what Frames repeats on every row of a replay
+template<typename T>
+void appendRepeated(ArrowArray &array, const T &value, size_t count)
+{
+	uint8_t *data = extend(array.values, count * sizeof(T));
+	for (size_t i = 0; i < count; ++i)
+	{
+		writeLittleEndian(data + i * sizeof(T), value);
+	}
+	array.length += count;
+}
+
+void appendRepeated(ArrowArray &array, const std::string &text, size_t count)
+{
+	uint8_t *data = extend(array.values, count * text.size());
+	uint8_t *offsets = extend(array.offsets, count * sizeof(int32_t));
+	size_t end = array.values.size() - count * text.size();
+	for (size_t i = 0; i < count; ++i)
+	{
+		memcpy(data + i * text.size(), text.data(), text.size());
+		end += text.size();
+		writeLittleEndian(offsets + i * sizeof(int32_t), static_cast<int32_t>(end));
+	}
+	array.length += count;
+}
+
+// Exactly frames values, and dimensions per frame, whatever a JSON input held
+template<typename T>
+void appendFrames(ArrowArray &array, const std::vector<T> &values, size_t frames, size_t)
+{
+	uint8_t *data = extend(array.values, frames * sizeof(T));
+	for (size_t i = 0; i < frames; ++i)
+	{
+		writeLittleEndian(data + i * sizeof(T), i < values.size() ? values[i] : T());
+	}
+	array.length += frames;
+}
+
+template<typename T>
+void appendFrames(ArrowArray &array, const std::vector<std::vector<T>> &values, size_t frames, size_t dimensions)
+{
+	uint8_t *data = extend(array.values, frames * dimensions * sizeof(T));
+	for (size_t i = 0; i < frames; ++i)
+	{
+		for (size_t j = 0; j < dimensions; ++j)
+		{
+			writeLittleEndian(data + (i * dimensions + j) * sizeof(T), i < values.size() && j < values[i].size() ? values[i][j] : T());
+		}
+	}
+	array.length += frames * dimensions;
+}
+
+}
+
+ArrowBatch::ArrowBatch(ArrowLayout layout)
+	: mLayout(layout), mArrays(getArrowSchema(layout))
+{
+	for (auto &array : mArrays)
+	{
+		resetArray(array);
+	}
+}
+
+void ArrowBatch::add(const std::string &name, const ReplayFile &replay)
+{
+	StageScope scope(Stage::EncodeColumns);
+
+	// The longest column, the others are padded with zeros
+	size_t frames = 0;
+	forEachColumn([&frames, &replay](const auto &column, auto)
+	{
+		frames = std::max(frames, (replay.*column.member).size());
+	});
+	size_t rows = mLayout == ArrowLayout::Frames ? frames : 1;
+
+	// Schema order, see getArrowSchema
+	auto array = mArrays.begin();
+	appendRepeated(*array++, name, rows);
+	if (mLayout == ArrowLayout::Frames)
+	{
+		auto &frameArray = *array++;
+		uint8_t *data = extend(frameArray.values, frames * sizeof(uint32_t));
+		for (size_t i = 0; i < frames; ++i)
+		{
+			writeLittleEndian(data + i * sizeof(uint32_t), static_cast<uint32_t>(i));
+		}
+		frameArray.length += frames;
+	}
+	auto &headerArray = *array++;
+	headerArray.length += rows;
+	forEachField<ReplayFileHeader>([&array, &replay, rows](const auto &field)
+	{
+		appendRepeated(*array++, replay.header.*field.member, rows);
+	});
+	forEachColumn([this, &array, &replay, frames](const auto &column, auto)
+	{
+		ArrowArray *list = mLayout == ArrowLayout::Replays ? &*array++ : nullptr;
+		ArrowArray *fixedSizeList = column.dimensions > 1 ? &*array++ : nullptr;
+		auto &values = *array++;
+		appendFrames(values, replay.*column.member, frames, column.dimensions);
+		if (fixedSizeList)
+		{
+			fixedSizeList->length += frames;
+		}
+		if (list)
+		{
+			// Counted in elements of the direct child
+			appendLittleEndian(list->offsets, static_cast<int32_t>(fixedSizeList ? fixedSizeList->length : values.length));
+			++list->length;
+		}
+	});
+
+	++mReplays;
+	scope.setBytes(0, frames * ReplayFile::cBinarySize / ReplayFile::cChunkSize);
+}
+
+void ArrowBatch::encode(std::vector<uint8_t> &buffer)
+{
+	StageScope scope(Stage::EncodeColumns);
+	size_t start = buffer.size();
+
+	// Buffers of every array in schema order, each 8 byte aligned in the body. Nothing is ever
+	// null, so every validity bitmap is left out with a length of 0.
+	mNodes.clear();
+	mBuffers.clear();
+	int64_t bodyLength = 0;
+	auto addBuffer = [this, &bodyLength](size_t size)
+	{
+		appendLittleEndian(mBuffers, bodyLength);
+		appendLittleEndian(mBuffers, static_cast<int64_t>(size));
+		bodyLength += (size + 7) / 8 * 8;
+	};
+	for (const auto &array : mArrays)
+	{
+		appendLittleEndian(mNodes, array.length);
+		appendLittleEndian(mNodes, static_cast<int64_t>(0));
+		addBuffer(0);
+		if (array.type == ArrowArray::Type::Utf8 || array.type == ArrowArray::Type::List)
+		{
+			addBuffer(array.offsets.size());
+		}
+		if (array.type != ArrowArray::Type::List && array.type != ArrowArray::Type::FixedSizeList && array.type != ArrowArray::Type::Struct)
+		{
+			addBuffer(array.values.size());
+		}
+	}
+
+	buffer.reserve(start + static_cast<size_t>(bodyLength) + 4096);
+	appendMessage(buffer, cRecordBatchHeader, bodyLength, [this](FlatBufferWriter &writer, size_t slot)
+	{
+		writer.beginTable();
+		writer.addScalar<int64_t>(0, mArrays.front().length);
+		writer.addOffset(1);
+		writer.addOffset(2);
+		auto batch = writer.endTable(slot);
+		writer.writeStructVector(batch[1], mNodes, mArrays.size());
+		writer.writeStructVector(batch[2], mBuffers, mBuffers.size() / 16);
+	});
+	for (auto &array : mArrays)
+	{
+		appendPadded(buffer, array.offsets);
+		appendPadded(buffer, array.values);
+		resetArray(array);
+	}
+
+	mReplays = 0;
+	scope.setBytes(0, buffer.size() - start);
+}
+
+size_t getArrowBatchReplays(ArrowLayout layout)
+{
+	// Around 30000 rows either way
+	return layout == ArrowLayout::Frames ? 8 : 64;
+}
+
+ArrowTableWriter::~ArrowTableWriter()
+{
+	close();
+}
+
+bool ArrowTableWriter::open(const std::string &filename, ArrowLayout layout)
+{
+	close();
+	mFailed = false;
+	mLayout = layout;
+	mOffset = 0;
+	mNextIndex = 0;
+	mPending.clear();
+	mBlocks.clear();
+	mFile = fopen(filename.c_str(), "wb");
+	if (!mFile)
+	{
+		return false;
+	}
+
+	// Magic padded to 8, then the schema as the first message of the stream
+	std::vector<uint8_t> start(cArrowMagic, cArrowMagic + 8);
+	appendMessage(start, cSchemaHeader, 0, [layout](FlatBufferWriter &writer, size_t slot)
+	{
+		writeSchema(writer, slot, getArrowSchema(layout));
+	});
+	if (fwrite(start.data(), 1, start.size(), mFile) != start.size())
+	{
+		mFailed = true;
+	}
+	mOffset = start.size();
+	return !mFailed;
+}
+
+bool ArrowTableWriter::write(size_t index, const std::vector<uint8_t> &message)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (!mFile)
+	{
+		return false;
+	}
+	if (index != mNextIndex)
+	{
+		mPending[index] = message;
+		return !mFailed;
+	}
+
+	writeMessage(message);
+	++mNextIndex;
+	for (auto it = mPending.begin(); it != mPending.end() && it->first == mNextIndex; it = mPending.erase(it))
+	{
+		writeMessage(it->second);
+		++mNextIndex;
+	}
+	return !mFailed;
+}
+
+bool ArrowTableWriter::writeMessage(const std::vector<uint8_t> &message)
+{
+	if (message.empty())
+	{
+		return true;
+	}
+
+	StageScope scope(Stage::Write);
+	int32_t metadataLength = 0;
+	for (size_t i = 0; i < 4; ++i)
+	{
+		metadataLength |= message[4 + i] << (i * 8);
+	}
+	Block block;
+	block.offset = mOffset;
+	block.metadataLength = 8 + metadataLength;
+	block.bodyLength = static_cast<int64_t>(message.size()) - block.metadataLength;
+	if (fwrite(message.data(), 1, message.size(), mFile) != message.size())
+	{
+		mFailed = true;
+		return false;
+	}
+	mBlocks.push_back(block);
+	mOffset += message.size();
+	scope.setBytes(message.size(), 0);
+	return true;
+}
+
+bool ArrowTableWriter::close()
+{
+	if (!mFile)
+	{
+		return !mFailed;
+	}
+	if (!mPending.empty())
+	{
+		mFailed = true;
+	}
+
+	// End of stream marker, then the footer with the schema again and where every batch is
+	std::vector<uint8_t> end;
+	appendLittleEndian(end, cContinuation);
+	appendLittleEndian(end, static_cast<int32_t>(0));
+	size_t footerStart = end.size();
+	std::vector<uint8_t> blocks;
+	for (const auto &block : mBlocks)
+	{
+		appendLittleEndian(blocks, block.offset);
+		appendLittleEndian(blocks, block.metadataLength);
+		appendLittleEndian(blocks, static_cast<int32_t>(0));
+		appendLittleEndian(blocks, block.bodyLength);
+	}
+	FlatBufferWriter writer(end);
+	writer.beginTable();
+	writer.addScalar<int16_t>(0, cMetadataVersion);
+	writer.addOffset(1);
+	writer.addOffset(3);
+	auto footer = writer.endTable(writer.getRoot());
+	writeSchema(writer, footer[1], getArrowSchema(mLayout));
+	writer.writeStructVector(footer[3], blocks, mBlocks.size());
+	writer.finish();
+	appendLittleEndian(end, static_cast<int32_t>(end.size() - footerStart));
+	end.insert(end.end(), cArrowMagic, cArrowMagic + 6);
+
+	if (fwrite(end.data(), 1, end.size(), mFile) != end.size())
+	{
+		mFailed = true;
+	}
+	if (fclose(mFile) != 0)
+	{
+		mFailed = true;
+	}
+	mFile = nullptr;
+	return !mFailed;
+}
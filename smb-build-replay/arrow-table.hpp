@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "smb-replay.hpp"
+
+// Rows of an Arrow table of replays. Both have a utf8 "name" and a "header" struct with every
+// header field as a child column, as in JSON.
+//   Frames   one row per frame with its "frame" index, the header repeated, and a column per
+//            ReplayColumns entry: float32 (flags uint32), fixed_size_list<float32> if it has more
+//            than one dimension
+//   Replays  one row per replay, every ReplayColumns entry as a list of what it is per frame
+enum class ArrowLayout
+{
+	Frames,
+	Replays,
+};
+
+// A node of the flattened Arrow schema with the data of one record batch, children follow their
+// parent in pre-order
+struct ArrowArray
+{
+	enum class Type : uint8_t
+	{
+		Int = 2,
+		FloatingPoint = 3,
+		Utf8 = 5,
+		List = 12,
+		Struct = 13,
+		FixedSizeList = 16,
+	};
+
+	std::string name;
+	Type type;
+	// Bits of Int and FloatingPoint, list size of FixedSizeList
+	uint32_t size = 0;
+	size_t children = 0;
+
+	int64_t length = 0;
+	// int32 offsets of Utf8 and List, starting with 0
+	std::vector<uint8_t> offsets;
+	std::vector<uint8_t> values;
+};
+
+// Collects replays into the columns of one record batch. Owned by a worker and reused, so the
+// columns keep their capacity from batch to batch.
+class ArrowBatch
+{
+public:
+	explicit ArrowBatch(ArrowLayout layout);
+
+	void add(const std::string &name, const ReplayFile &replay);
+	size_t getReplayCount() const { return mReplays; }
+
+	// Appends the record batch as an encapsulated IPC message and starts a new batch
+	void encode(std::vector<uint8_t> &buffer);
+
+private:
+	ArrowLayout mLayout;
+	std::vector<ArrowArray> mArrays;
+	size_t mReplays = 0;
+	// FieldNode and Buffer structs of the record batch
+	std::vector<uint8_t> mNodes;
+	std::vector<uint8_t> mBuffers;
+};
+
+// Replays a worker collects into a batch before handing it to the ArrowTableWriter
+size_t getArrowBatchReplays(ArrowLayout layout);
+
+// Arrow IPC file (Feather v2) written a record batch at a time, only the block list of the footer
+// stays in memory.
+class ArrowTableWriter
+{
+public:
+	ArrowTableWriter() = default;
+	ArrowTableWriter(const ArrowTableWriter &) = delete;
+	ArrowTableWriter &operator=(const ArrowTableWriter &) = delete;
+	~ArrowTableWriter();
+
+	bool open(const std::string &filename, ArrowLayout layout);
+	ArrowLayout getLayout() const { return mLayout; }
+
+	// Thread safe. Batches go to the file in index order, counting from 0, whatever order they
+	// arrive in. An empty message only moves the order along.
+	bool write(size_t index, const std::vector<uint8_t> &message);
+
+	// Writes the footer, returns false if anything failed along the way or a batch is missing
+	bool close();
+
+private:
+	struct Block
+	{
+		int64_t offset;
+		int32_t metadataLength;
+		int64_t bodyLength;
+	};
+
+	bool writeMessage(const std::vector<uint8_t> &message);
+
+	FILE *mFile = nullptr;
+	bool mFailed = false;
+	ArrowLayout mLayout = ArrowLayout::Frames;
+	std::mutex mMutex;
+	int64_t mOffset = 0;
+	size_t mNextIndex = 0;
+	std::map<size_t, std::vector<uint8_t>> mPending;
+	std::vector<Block> mBlocks;
+};
@@ -0,0 +1,695 @@
+#include "conversion.hpp"
+#include "dedup-store.hpp"
+#include "arrow-table.hpp"
+#include "corpus-writer.hpp"
+#include "csv.hpp"
+#include "tar-archive.hpp"
+
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <cstdio>
+#include <condition_variable>
+#include <deque>
+#include <map>
+
+#include <boost/filesystem.hpp>
+
+const char *getConversionResultMessage(ConversionResult result)
+{
+	switch (result)
+	{
+	case ConversionResult::Success:
+		return "Success";
+	case ConversionResult::ReadFailed:
+		return "Failed to read input file!";
+	case ConversionResult::DecodeFailed:
+		return "Failed to decode input file!";
+	case ConversionResult::EncodeFailed:
+		return "Failed to encode output file!";
+	case ConversionResult::WriteFailed:
+		return "Failed to write output file!";
+	case ConversionResult::StoreFailed:
+		return "Failed to add replay to dedup store!";
+	default:
+		return "Unknown error!";
+	}
+}
+
+namespace
+{
+
+// std::cin synced with stdio reads one character at a time, this reads standard input in big chunks
+class StandardInputBuffer : public std::streambuf
+{
+public:
+	StandardInputBuffer() : mBuffer(64 * 1024)
+	{
+	}
+
+protected:
+	int_type underflow() override
+	{
+		size_t count = fread(mBuffer.data(), 1, mBuffer.size(), stdin);
+		if (!count)
+		{
+			return traits_type::eof();
+		}
+		setg(mBuffer.data(), mBuffer.data(), mBuffer.data() + count);
+		return traits_type::to_int_type(mBuffer[0]);
+	}
+
+private:
+	std::vector<char> mBuffer;
+};
+
+EncodeOptions getEncodeOptions(const ConversionOptions &options)
+{
+	EncodeOptions encodeOptions;
+	encodeOptions.prettyJSON = options.prettyJSON;
+	encodeOptions.positions = options.positions;
+	encodeOptions.doublePrecisionPositions = options.doublePrecisionPositions;
+	encodeOptions.speeds = options.speeds;
+	encodeOptions.optimalRLE = options.optimalRLE;
+	encodeOptions.headerOnly = options.headerOnly;
+	return encodeOptions;
+}
+
+// Only the header and columns if not null, see decodeReplayColumns
+ConversionResult decodeConvertedReplay(const ConversionOptions &options, BufferView inputData, ReplayFile &replay, const std::vector<std::string> *columns = nullptr)
+{
+	try
+	{
+		bool decoded = columns ? decodeReplayColumns(options.inputFormat, inputData, *columns, replay) : decodeReplay(options.inputFormat, inputData, replay);
+		if (!decoded)
+		{
+			return ConversionResult::DecodeFailed;
+		}
+	}
+	catch (const std::exception &)
+	{
+		// Malformed JSON
+		return ConversionResult::DecodeFailed;
+	}
+	return ConversionResult::Success;
+}
+
+// When nothing but the metrics look at a replay, the columns they need are all that is decoded
+const std::vector<std::string> *getDecodedColumns(const ConversionOptions &options, const std::vector<ConversionOutput> &outputs, bool metrics)
+{
+	bool onlyMetrics = metrics && outputs.empty() && !options.dedupStore && !options.arrowTable && !options.corpus;
+	return onlyMetrics ? &getReplayMetricsColumns() : nullptr;
+}
+
+ConversionResult encodeConvertedReplay(const ConversionOptions &options, FileFormat outputFormat, const ReplayFile &replay, std::vector<uint8_t> &outputData)
+{
+	EncodeOptions encodeOptions = getEncodeOptions(options);
+	size_t savedBlocks = 0;
+	if (outputFormat == FileFormat::GCI)
+	{
+		encodeOptions.replayComment = getReplayComment(replay.header, options.comment, options.padFloorNumber);
+		encodeOptions.gciFilename = getGCIFilename();
+		if (options.savedBlocks)
+		{
+			encodeOptions.savedBlocks = &savedBlocks;
+		}
+	}
+	if (!encodeReplay(outputFormat, replay, encodeOptions, outputData))
+	{
+		return ConversionResult::EncodeFailed;
+	}
+	if (options.savedBlocks)
+	{
+		*options.savedBlocks += savedBlocks;
+	}
+	return ConversionResult::Success;
+}
+
+}
+
+bool canWriteCorpus(FileFormat format)
+{
+	return format == FileFormat::CSV || format == FileFormat::JSONL;
+}
+
+void encodeCorpusStart(const ConversionOptions &options, std::vector<uint8_t> &outputData)
+{
+	if (options.outputFormat == FileFormat::CSV)
+	{
+		serializeCSVHeader(outputData, true, getEncodeOptions(options));
+	}
+}
+
+ConversionResult encodeCorpusReplay(const ConversionOptions &options, const std::string &name, const ReplayFile &replay, std::vector<uint8_t> &outputData)
+{
+	if (options.outputFormat == FileFormat::CSV)
+	{
+		serializeCSVRows(outputData, replay, &name, getEncodeOptions(options));
+		return ConversionResult::Success;
+	}
+	if (options.outputFormat == FileFormat::JSONL)
+	{
+		serializeJSONLine(outputData, replay, &name, getEncodeOptions(options));
+		return ConversionResult::Success;
+	}
+	return ConversionResult::EncodeFailed;
+}
+
+ConversionResult convertBuffer(const ConversionOptions &options, BufferView inputData, std::vector<uint8_t> &outputData, ReplayFile &replay)
+{
+	auto result = decodeConvertedReplay(options, inputData, replay);
+	if (result != ConversionResult::Success)
+	{
+		return result;
+	}
+	return encodeConvertedReplay(options, options.outputFormat, replay, outputData);
+}
+
+ConversionResult convertFile(const ConversionOptions &options, const std::string &inputFilename, const std::vector<ConversionOutput> &outputs, ConversionBuffers &buffers,
+	ReplayMetrics *metrics)
+{
+	auto start = std::chrono::steady_clock::now();
+	TraceScope fileScope("file", "convert", &inputFilename);
+
+	auto &replay = buffers.replay;
+	if (inputFilename == "-" && options.inputFormat == FileFormat::JSON)
+	{
+		// Parse as the text streams in rather than buffering all of it first
+		StandardInputBuffer inputBuffer;
+		std::istream inputStream(&inputBuffer);
+		try
+		{
+			decodeReplayJSON(inputStream, replay);
+		}
+		catch (const std::exception &)
+		{
+			return ConversionResult::DecodeFailed;
+		}
+	}
+	else
+	{
+		auto &inputData = buffers.input;
+		{
+			StageScope scope(Stage::Load);
+			loadFile(inputFilename, inputData);
+			scope.setBytes(0, inputData.size());
+		}
+		if (!inputData.size())
+		{
+			return ConversionResult::ReadFailed;
+		}
+		auto result = decodeConvertedReplay(options, inputData, replay, getDecodedColumns(options, outputs, metrics != nullptr));
+		if (result != ConversionResult::Success)
+		{
+			return result;
+		}
+	}
+
+	if (metrics)
+	{
+		computeReplayMetrics(replay, *metrics);
+	}
+
+	if (options.dedupStore && !options.dedupStore->add(replay, inputFilename))
+	{
+		return ConversionResult::StoreFailed;
+	}
+
+	// Every output is encoded from the one decoded replay, which the encoders only read
+	if (buffers.outputs.size() < outputs.size())
+	{
+		buffers.outputs.resize(outputs.size());
+	}
+	std::vector<ConversionResult> results(outputs.size(), ConversionResult::Success);
+	auto encodeOutput = [&](size_t i)
+	{
+		auto &outputData = buffers.outputs[i];
+		outputData.clear();
+		results[i] = encodeConvertedReplay(options, outputs[i].format, replay, outputData);
+		if (results[i] == ConversionResult::Success)
+		{
+			StageScope scope(Stage::Write);
+			if (!saveFile(outputs[i].filename, outputData))
+			{
+				results[i] = ConversionResult::WriteFailed;
+			}
+			scope.setBytes(outputData.size(), 0);
+		}
+	};
+	size_t threadCount = std::min<size_t>(options.outputJobs, outputs.size());
+	if (threadCount > 1)
+	{
+		// The calling thread encodes the first output, each helper takes every threadCount-th of
+		// the rest and reports its stages to a StageStats of its own
+		std::vector<StageStats> threadStats(threadCount);
+		bool collectStats = tStageStats != nullptr;
+		std::vector<std::thread> threads;
+		for (size_t t = 1; t < threadCount; ++t)
+		{
+			threads.emplace_back([&, t]()
+			{
+				tStageStats = collectStats ? &threadStats[t] : nullptr;
+				for (size_t i = t; i < outputs.size(); i += threadCount)
+				{
+					encodeOutput(i);
+				}
+			});
+		}
+		for (size_t i = 0; i < outputs.size(); i += threadCount)
+		{
+			encodeOutput(i);
+		}
+		for (auto &thread : threads)
+		{
+			thread.join();
+		}
+		if (collectStats)
+		{
+			for (const auto &stats : threadStats)
+			{
+				tStageStats->merge(stats);
+			}
+		}
+	}
+	else
+	{
+		for (size_t i = 0; i < outputs.size(); ++i)
+		{
+			encodeOutput(i);
+		}
+	}
+
+	if (tStageStats)
+	{
+		++tStageStats->files;
+		tStageStats->fileNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	}
+	// An encoding failure counts over a failed write, so it fails the run
+	ConversionResult result = ConversionResult::Success;
+	for (auto outputResult : results)
+	{
+		if (outputResult != ConversionResult::Success && (result == ConversionResult::Success || result == ConversionResult::WriteFailed))
+		{
+			result = outputResult;
+		}
+	}
+	return result;
+}
+
+void runWorkers(unsigned jobs, StageStats *stats, const std::function<void(unsigned)> &work)
+{
+	std::mutex statsMutex;
+	auto worker = [&](unsigned workerIndex)
+	{
+		if (workerIndex)
+		{
+			setTraceThreadName("worker " + std::to_string(workerIndex));
+		}
+		StageStats *callerStats = tStageStats;
+		StageStats workerStats;
+		tStageStats = stats ? &workerStats : nullptr;
+		work(workerIndex);
+		tStageStats = callerStats;
+		if (stats)
+		{
+			std::lock_guard<std::mutex> lock(statsMutex);
+			stats->merge(workerStats);
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for (unsigned i = 1; i < jobs; ++i)
+	{
+		workers.emplace_back(worker, i);
+	}
+	// The calling thread does its share too
+	worker(0);
+	for (auto &thread : workers)
+	{
+		thread.join();
+	}
+}
+
+BatchResult convertDirectory(const ConversionOptions &options, const std::string &inputDirectory, const std::vector<ConversionOutput> &outputs, unsigned jobs, StageStats *stats, std::vector<ReplayMetricsRow> *metrics)
+{
+	namespace fs = boost::filesystem;
+
+	BatchResult result;
+	std::vector<fs::path> inputFiles;
+	try
+	{
+		for (fs::recursive_directory_iterator it(inputDirectory), end; it != end; ++it)
+		{
+			if (fs::is_regular_file(it->status()) && getFileFormatByExtension(it->path().string()) == options.inputFormat)
+			{
+				inputFiles.emplace_back(it->path());
+			}
+		}
+	}
+	catch (const fs::filesystem_error &error)
+	{
+		*options.messages << "Failed to read input directory: " << error.what() << std::endl;
+		result.failed = 1;
+		return result;
+	}
+	std::sort(inputFiles.begin(), inputFiles.end());
+	if (metrics)
+	{
+		// Every worker fills in its own rows, so the table comes out in input order without locking
+		metrics->assign(inputFiles.size(), ReplayMetricsRow());
+	}
+
+	// With an Arrow table workers take runs of files that make up one record batch, so the batches
+	// can go to the table in input order
+	size_t runSize = options.arrowTable ? getArrowBatchReplays(options.arrowTable->getLayout()) : 1;
+	std::atomic<size_t> nextRun(0);
+	std::atomic<size_t> converted(0);
+	std::atomic<size_t> failed(0);
+	std::mutex outputMutex;
+
+	runWorkers(jobs, stats, [&](unsigned)
+	{
+		ConversionBuffers buffers;
+		std::vector<ConversionOutput> fileOutputs;
+		std::unique_ptr<ArrowBatch> arrowBatch;
+		std::vector<uint8_t> arrowMessage;
+		if (options.arrowTable)
+		{
+			arrowBatch.reset(new ArrowBatch(options.arrowTable->getLayout()));
+		}
+
+		for (size_t run = nextRun++; run * runSize < inputFiles.size(); run = nextRun++)
+		{
+			for (size_t i = run * runSize; i < std::min((run + 1) * runSize, inputFiles.size()); ++i)
+			{
+				const auto &inputPath = inputFiles[i];
+				// Without outputs files are only decoded for their metrics, the dedup store, the Arrow
+				// table or the corpus
+				fileOutputs.resize(outputs.size());
+				for (size_t j = 0; j < outputs.size(); ++j)
+				{
+					fs::path outputPath = fs::path(outputs[j].filename) / fs::relative(inputPath, inputDirectory);
+					outputPath.replace_extension(getFileFormatInfo(outputs[j].format)->extension);
+
+					boost::system::error_code error;
+					fs::create_directories(outputPath.parent_path(), error);
+					fileOutputs[j].format = outputs[j].format;
+					fileOutputs[j].filename = outputPath.string();
+				}
+
+				std::string name = fs::relative(inputPath, inputDirectory).generic_string();
+				ReplayMetricsRow *row = metrics ? &(*metrics)[i] : nullptr;
+				auto conversionResult = convertFile(options, inputPath.string(), fileOutputs, buffers, row ? &row->metrics : nullptr);
+				if (options.corpus)
+				{
+					// Failed replays leave an empty chunk so the order moves on
+					buffers.output.clear();
+					if (conversionResult == ConversionResult::Success)
+					{
+						conversionResult = encodeCorpusReplay(options, name, buffers.replay, buffers.output);
+					}
+					options.corpus->write(i, buffers.output);
+				}
+				if (row)
+				{
+					row->name = name;
+					row->valid = conversionResult == ConversionResult::Success;
+				}
+				if (conversionResult == ConversionResult::Success)
+				{
+					++converted;
+					if (arrowBatch)
+					{
+						arrowBatch->add(name, buffers.replay);
+					}
+				}
+				else
+				{
+					++failed;
+					std::lock_guard<std::mutex> lock(outputMutex);
+					*options.messages << inputPath.string() << ": " << getConversionResultMessage(conversionResult) << std::endl;
+				}
+			}
+
+			if (arrowBatch)
+			{
+				// A run without a single replay still takes its turn
+				arrowMessage.clear();
+				if (arrowBatch->getReplayCount())
+				{
+					arrowBatch->encode(arrowMessage);
+				}
+				// Failures show when the table is closed
+				options.arrowTable->write(run, arrowMessage);
+			}
+		}
+	});
+
+	result.converted = converted;
+	result.failed = failed;
+	return result;
+}
+
+namespace
+{
+
+// Replays are kilobytes, JSON with positions a few megabytes. Anything bigger in an archive is
+// broken or something else under a replay's name, and isn't worth loading.
+const uint64_t cMaxArchiveMemberSize = 64 * 1024 * 1024;
+
+// A member of the input archive on its way through the workers
+struct ArchiveMember
+{
+	size_t index = 0;
+	std::string name;
+	uint64_t modifiedTime = 0;
+	std::vector<uint8_t> data;
+	ConversionResult result = ConversionResult::Success;
+	std::vector<std::vector<uint8_t>> outputs;
+	ReplayMetricsRow row;
+};
+
+}
+
+BatchResult convertArchive(const ConversionOptions &options, const std::string &inputArchive, const std::vector<ConversionOutput> &outputs, unsigned jobs, StageStats *stats,
+	std::vector<ReplayMetricsRow> *metrics)
+{
+	namespace fs = boost::filesystem;
+
+	BatchResult result;
+	TarReader reader;
+	if (!reader.open(inputArchive))
+	{
+		*options.messages << "Failed to open input archive!" << std::endl;
+		result.failed = 1;
+		return result;
+	}
+	std::vector<std::unique_ptr<TarWriter>> writers;
+	for (const auto &output : outputs)
+	{
+		writers.emplace_back(new TarWriter());
+		if (!writers.back()->open(output.filename))
+		{
+			*options.messages << "Failed to open output archive " << output.filename << "!" << std::endl;
+			result.failed = 1;
+			return result;
+		}
+	}
+
+	// The reader hands members to the workers through a queue, and they go to the output archives
+	// in the order they were read by whichever worker finishes the next one. At most a few members
+	// per worker are read but not yet written, so memory stays flat however big the archive is.
+	const size_t maxMembersInFlight = jobs * 4;
+	std::mutex mutex;
+	std::condition_variable memberRead;
+	std::condition_variable memberWritten;
+	std::deque<std::unique_ptr<ArchiveMember>> queue;
+	std::map<size_t, std::unique_ptr<ArchiveMember>> finished;
+	size_t membersInFlight = 0;
+	size_t nextWrite = 0;
+	bool readDone = false;
+	bool writeFailed = false;
+
+	// Called with the mutex held
+	auto writeFinished = [&]()
+	{
+		for (auto it = finished.begin(); it != finished.end() && it->first == nextWrite; it = finished.erase(it), ++nextWrite)
+		{
+			auto &member = *it->second;
+			if (member.result == ConversionResult::Success)
+			{
+				for (size_t j = 0; j < writers.size(); ++j)
+				{
+					fs::path outputName(member.name);
+					outputName.replace_extension(getFileFormatInfo(outputs[j].format)->extension);
+					StageScope scope(Stage::Write);
+					if (!writers[j]->addFile(outputName.generic_string(), member.outputs[j], member.modifiedTime))
+					{
+						writeFailed = true;
+					}
+					scope.setBytes(member.outputs[j].size(), 0);
+				}
+				++result.converted;
+			}
+			else
+			{
+				++result.failed;
+				*options.messages << member.name << ": " << getConversionResultMessage(member.result) << std::endl;
+			}
+			if (metrics)
+			{
+				member.row.name = member.name;
+				member.row.valid = member.result == ConversionResult::Success;
+				metrics->push_back(std::move(member.row));
+			}
+			--membersInFlight;
+			memberWritten.notify_one();
+		}
+	};
+
+	const std::vector<std::string> *decodedColumns = getDecodedColumns(options, outputs, metrics != nullptr);
+	auto convertMembers = [&]()
+	{
+		ReplayFile replay;
+		std::vector<uint8_t> corpusChunk;
+		while (true)
+		{
+			std::unique_ptr<ArchiveMember> member;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				memberRead.wait(lock, [&]() { return !queue.empty() || readDone; });
+				if (queue.empty())
+				{
+					break;
+				}
+				member = std::move(queue.front());
+				queue.pop_front();
+			}
+
+			auto start = std::chrono::steady_clock::now();
+			{
+				TraceScope fileScope("file", "convert", &member->name);
+				if (member->result == ConversionResult::Success)
+				{
+					member->result = decodeConvertedReplay(options, member->data, replay, decodedColumns);
+				}
+				if (member->result == ConversionResult::Success && metrics)
+				{
+					computeReplayMetrics(replay, member->row.metrics);
+				}
+				if (member->result == ConversionResult::Success && options.dedupStore && !options.dedupStore->add(replay, member->name))
+				{
+					member->result = ConversionResult::StoreFailed;
+				}
+				member->outputs.resize(outputs.size());
+				for (size_t j = 0; j < outputs.size() && member->result == ConversionResult::Success; ++j)
+				{
+					member->result = encodeConvertedReplay(options, outputs[j].format, replay, member->outputs[j]);
+				}
+				if (options.corpus)
+				{
+					corpusChunk.clear();
+					if (member->result == ConversionResult::Success)
+					{
+						member->result = encodeCorpusReplay(options, member->name, replay, corpusChunk);
+					}
+					options.corpus->write(member->index, corpusChunk);
+				}
+			}
+			if (tStageStats)
+			{
+				++tStageStats->files;
+				tStageStats->fileNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+			}
+
+			// The input is no longer needed while the member waits for its turn
+			std::vector<uint8_t>().swap(member->data);
+			std::lock_guard<std::mutex> lock(mutex);
+			size_t index = member->index;
+			finished[index] = std::move(member);
+			writeFinished();
+		}
+	};
+
+	// The calling thread reads. Members of other formats are skipped without loading them, ones too
+	// big to be a replay fail without loading them.
+	auto readMembers = [&]()
+	{
+		TarMember header;
+		for (size_t index = 0; reader.next(header);)
+		{
+			if (getFileFormatByExtension(header.name) != options.inputFormat)
+			{
+				continue;
+			}
+			std::unique_ptr<ArchiveMember> member(new ArchiveMember());
+			member->name = header.name;
+			member->modifiedTime = header.modifiedTime;
+			if (header.size > cMaxArchiveMemberSize)
+			{
+				member->result = ConversionResult::ReadFailed;
+			}
+			else
+			{
+				StageScope scope(Stage::Load);
+				if (!reader.readData(member->data))
+				{
+					break;
+				}
+				scope.setBytes(0, member->data.size());
+			}
+			// "tar -C dir ." names members ./<path>, the same files in a directory are named <path>
+			while (member->name.compare(0, 2, "./") == 0)
+			{
+				member->name.erase(0, 2);
+			}
+			member->index = index++;
+			std::unique_lock<std::mutex> lock(mutex);
+			memberWritten.wait(lock, [&]() { return membersInFlight < maxMembersInFlight; });
+			++membersInFlight;
+			queue.push_back(std::move(member));
+			memberRead.notify_one();
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			readDone = true;
+		}
+		memberRead.notify_all();
+	};
+
+	// The calling thread reads while jobs workers of their own convert
+	runWorkers(jobs + 1, stats, [&](unsigned workerIndex)
+	{
+		if (workerIndex)
+		{
+			convertMembers();
+		}
+		else
+		{
+			readMembers();
+		}
+	});
+
+	if (reader.hasFailed())
+	{
+		*options.messages << "Failed to read input archive!" << std::endl;
+		++result.failed;
+	}
+	for (auto &writer : writers)
+	{
+		if (!writer->close())
+		{
+			writeFailed = true;
+		}
+	}
+	if (writeFailed)
+	{
+		*options.messages << "Failed to write output archive!" << std::endl;
+		++result.failed;
+	}
+	return result;
+}
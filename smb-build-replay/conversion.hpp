@@ -0,0 +1,118 @@
+#pragma once
+
+#include <string>
+#include <atomic>
+#include <functional>
+#include <vector>
+#include <iostream>
+
+#include "smb-replay.hpp"
+#include "stage-stats.hpp"
+#include "metrics.hpp"
+
+class DedupStore;
+class ArrowTableWriter;
+class CorpusWriter;
+
+struct ConversionOptions
+{
+	FileFormat inputFormat = FileFormat::Unknown;
+	// Of convertBuffer and the corpus, files and directories take a ConversionOutput each
+	FileFormat outputFormat = FileFormat::Unknown;
+	bool prettyJSON = false;
+	std::string comment = "<UNTAGGED>";
+	int padFloorNumber = 0;
+	bool positions = false;
+	bool doublePrecisionPositions = true;
+	bool speeds = false;
+	// GCI output: size optimal RLE, the GCI blocks that saved are added to savedBlocks if not null
+	bool optimalRLE = false;
+	std::atomic<size_t> *savedBlocks = nullptr;
+	// JSONL output: only the header of each replay
+	bool headerOnly = false;
+	// Every decoded replay is added here if not null, under its input filename
+	DedupStore *dedupStore = nullptr;
+	// Directories only: every decoded replay is added to this table if not null, in sorted path order
+	ArrowTableWriter *arrowTable = nullptr;
+	// Directories only: every replay is encoded into this one file instead of a file each, see
+	// encodeCorpusReplay
+	CorpusWriter *corpus = nullptr;
+	// Several outputs of a single file are encoded on up to this many threads
+	unsigned outputJobs = 1;
+	// Where batch conversions report files that failed
+	std::ostream *messages = &std::cout;
+};
+
+// A file, or a directory when converting a directory
+struct ConversionOutput
+{
+	FileFormat format = FileFormat::Unknown;
+	std::string filename;
+};
+
+enum class ConversionResult
+{
+	Success,
+	ReadFailed,
+	DecodeFailed,
+	EncodeFailed,
+	WriteFailed,
+	StoreFailed,
+};
+
+const char *getConversionResultMessage(ConversionResult result);
+
+// Memory a worker reuses from one conversion to the next. Everything keeps its capacity, so once it
+// has grown to the largest replay seen, loading, decoding and binary/GCI encoding stop allocating.
+struct ConversionBuffers
+{
+	std::vector<uint8_t> input;
+	std::vector<uint8_t> output;
+	// One per output of convertFile
+	std::vector<std::vector<uint8_t>> outputs;
+	ReplayFile replay;
+};
+
+// Formats whose files can simply be concatenated, so a whole directory fits in one file
+bool canWriteCorpus(FileFormat format);
+// What goes in front of the first replay of a corpus, e.g. the CSV column header
+void encodeCorpusStart(const ConversionOptions &options, std::vector<uint8_t> &outputData);
+// Appends replay tagged with name, e.g. CSV rows with the name and header fields in front or a
+// JSONL line with the name as its first key
+ConversionResult encodeCorpusReplay(const ConversionOptions &options, const std::string &name, const ReplayFile &replay, std::vector<uint8_t> &outputData);
+
+// Decodes inputData into replay, whatever it held before, and appends the encoded result to outputData.
+ConversionResult convertBuffer(const ConversionOptions &options, BufferView inputData, std::vector<uint8_t> &outputData, ReplayFile &replay);
+
+// Converts a single file, "-" is standard input/output. The input is decoded once and encoded for
+// every output, without any it is only decoded. Metrics of the replay go to metrics if it is not
+// null. Stage timings go to the calling thread's tStageStats, if set.
+ConversionResult convertFile(const ConversionOptions &options, const std::string &inputFilename, const std::vector<ConversionOutput> &outputs, ConversionBuffers &buffers,
+	ReplayMetrics *metrics = nullptr);
+
+// Runs work on jobs threads, passing each its worker index, and returns once all are done. The
+// calling thread is worker 0, the others are named for the trace. Each worker collects stage stats
+// of its own, merged into stats if it is not null.
+void runWorkers(unsigned jobs, StageStats *stats, const std::function<void(unsigned)> &work);
+
+struct BatchResult
+{
+	size_t converted = 0;
+	size_t failed = 0;
+};
+
+// Converts every file with the input format's extension below inputDirectory to the same relative
+// path below each output directory, with the extension swapped for the output's format, on jobs
+// threads. Stats of all workers are merged into stats if it is not null. Without outputs files are
+// only decoded, and encoded into options.corpus if it is set. metrics, if not null, receives a row
+// per input file in sorted path order.
+BatchResult convertDirectory(const ConversionOptions &options, const std::string &inputDirectory, const std::vector<ConversionOutput> &outputs, unsigned jobs, StageStats *stats,
+	std::vector<ReplayMetricsRow> *metrics = nullptr);
+
+// Converts every member of the tar archive inputArchive with the input format's extension in one
+// sequential read, "-" is standard input. The results go into a tar archive for each output under
+// the member's name with the extension swapped, in the order of the input, or into options.corpus.
+// Workers run on jobs threads of their own while the calling thread reads. Failed members are
+// counted as failed, a damaged input or failed output archive once more.
+BatchResult convertArchive(const ConversionOptions &options, const std::string &inputArchive, const std::vector<ConversionOutput> &outputs, unsigned jobs, StageStats *stats,
+	std::vector<ReplayMetricsRow> *metrics = nullptr);
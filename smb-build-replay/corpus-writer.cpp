@@ -0,0 +1,107 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "corpus-writer.hpp"
+#include "stage-stats.hpp"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+CorpusWriter::~CorpusWriter()
+{
+	close();
+}
+
+bool CorpusWriter::open(const std::string &filename, const std::vector<uint8_t> &start, bool ordered, size_t window)
+{
+	close();
+	mFailed = false;
+	mOrdered = ordered;
+	mWindow = std::max<size_t>(window, 1);
+	mNextIndex = 0;
+	mPending.clear();
+	if (filename == "-")
+	{
+		mFile = stdout;
+#ifdef _WIN32
+		_setmode(_fileno(stdout), _O_BINARY);
+#endif
+	}
+	else
+	{
+		mFile = fopen(filename.c_str(), "wb");
+	}
+	if (!mFile)
+	{
+		return false;
+	}
+	return writeChunk(start);
+}
+
+bool CorpusWriter::write(size_t index, const std::vector<uint8_t> &chunk)
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	if (!mFile)
+	{
+		return false;
+	}
+	if (!mOrdered)
+	{
+		writeChunk(chunk);
+		return !mFailed;
+	}
+	// The replay due next is always let through, so waiting writes can't hold each other up
+	mIndexWritten.wait(lock, [&]() { return index < mNextIndex + mWindow; });
+	if (index != mNextIndex)
+	{
+		mPending[index] = chunk;
+		return !mFailed;
+	}
+
+	writeChunk(chunk);
+	++mNextIndex;
+	for (auto it = mPending.begin(); it != mPending.end() && it->first == mNextIndex; it = mPending.erase(it))
+	{
+		writeChunk(it->second);
+		++mNextIndex;
+	}
+	mIndexWritten.notify_all();
+	return !mFailed;
+}
+
+bool CorpusWriter::writeChunk(const std::vector<uint8_t> &chunk)
+{
+	if (chunk.empty())
+	{
+		return true;
+	}
+	StageScope scope(Stage::Write);
+	if (fwrite(chunk.data(), 1, chunk.size(), mFile) != chunk.size())
+	{
+		mFailed = true;
+		return false;
+	}
+	scope.setBytes(chunk.size(), 0);
+	return true;
+}
+
+bool CorpusWriter::close()
+{
+	if (!mFile)
+	{
+		return !mFailed;
+	}
+	if (!mPending.empty())
+	{
+		mFailed = true;
+	}
+	if ((mFile == stdout ? fflush(mFile) : fclose(mFile)) != 0)
+	{
+		mFailed = true;
+	}
+	mFile = nullptr;
+	return !mFailed;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <condition_variable>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// One output file that the workers of a batch conversion append whole replays to. Only the
+// replays in flight are ever in memory. Ordered writes go to the file in index order, counting
+// from 0, with replays that are done early held back until it is their turn. A write more than
+// window replays ahead of the next one due blocks until the file catches up, so a slow replay
+// holds back at most that many. Unordered writes go to the file as they come, so no worker ever
+// waits on a slow one.
+class CorpusWriter
+{
+public:
+	CorpusWriter() = default;
+	CorpusWriter(const CorpusWriter &) = delete;
+	CorpusWriter &operator=(const CorpusWriter &) = delete;
+	~CorpusWriter();
+
+	// "-" is standard output. start goes before the first replay, e.g. a column header.
+	bool open(const std::string &filename, const std::vector<uint8_t> &start, bool ordered = true, size_t window = 64);
+
+	// Thread safe. An empty chunk only moves the order along.
+	bool write(size_t index, const std::vector<uint8_t> &chunk);
+
+	// Returns false if anything failed along the way or a replay is missing
+	bool close();
+
+private:
+	bool writeChunk(const std::vector<uint8_t> &chunk);
+
+	FILE *mFile = nullptr;
+	bool mFailed = false;
+	bool mOrdered = true;
+	size_t mWindow = 64;
+	std::mutex mMutex;
+	std::condition_variable mIndexWritten;
+	size_t mNextIndex = 0;
+	std::map<size_t, std::vector<uint8_t>> mPending;
+};
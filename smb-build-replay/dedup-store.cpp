@@ -0,0 +1,110 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "dedup-store.hpp"
+#include "stage-stats.hpp"
+
+#include <thread>
+#include <sstream>
+
+#include <boost/filesystem.hpp>
+
+DedupStore::~DedupStore()
+{
+	if (mMappingFile)
+	{
+		fclose(mMappingFile);
+	}
+}
+
+bool DedupStore::open(const std::string &directory)
+{
+	namespace fs = boost::filesystem;
+	boost::system::error_code error;
+	fs::create_directories(fs::path(directory) / "objects", error);
+	if (error)
+	{
+		return false;
+	}
+	mDirectory = directory;
+	mMappingFile = fopen((fs::path(directory) / "mapping.tsv").string().c_str(), "ab");
+	return mMappingFile != nullptr;
+}
+
+bool DedupStore::add(const ReplayFile &replay, const std::string &name)
+{
+	namespace fs = boost::filesystem;
+
+	std::vector<uint8_t> payload;
+	{
+		StageScope scope(Stage::EncodeColumns);
+		serializeBinary(payload, replay);
+		scope.setBytes(0, payload.size());
+	}
+	Hash128 hash;
+	{
+		StageScope scope(Stage::Hash);
+		hash = hashBuffer128(payload);
+		scope.setBytes(payload.size(), 0);
+	}
+	std::string hashString = getHashString(hash);
+	fs::path objectPath = fs::path(mDirectory) / "objects" / hashString.substr(0, 2) / (hashString + ".bin");
+
+	// Duplicates wait for whoever is writing the object and take over if that fails
+	bool known;
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		auto it = mKnownHashes.find(hash);
+		while (it != mKnownHashes.end() && !it->second)
+		{
+			mObjectWritten.wait(lock);
+			it = mKnownHashes.find(hash);
+		}
+		known = it != mKnownHashes.end();
+		if (!known)
+		{
+			mKnownHashes[hash] = false;
+		}
+	}
+	if (!known && !fs::exists(objectPath))
+	{
+		// Written under a name of our own and renamed, so a crash or another process storing the
+		// same replay never leaves a partial object behind
+		boost::system::error_code error;
+		fs::create_directories(objectPath.parent_path(), error);
+		std::stringstream temporaryName;
+		temporaryName << hashString << "." << std::this_thread::get_id() << ".tmp";
+		fs::path temporaryPath = objectPath.parent_path() / temporaryName.str();
+
+		StageScope scope(Stage::Write);
+		bool saved = saveFile(temporaryPath.string(), payload);
+		if (saved)
+		{
+			fs::rename(temporaryPath, objectPath, error);
+			saved = !error;
+		}
+		if (!saved)
+		{
+			fs::remove(temporaryPath, error);
+			std::lock_guard<std::mutex> lock(mMutex);
+			mKnownHashes.erase(hash);
+			mObjectWritten.notify_all();
+			return false;
+		}
+		scope.setBytes(payload.size(), 0);
+		++mStored;
+	}
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (!known)
+	{
+		mKnownHashes[hash] = true;
+		mObjectWritten.notify_all();
+	}
+	// Flushed line by line so a failed write shows up on the replay it belongs to
+	if (fprintf(mMappingFile, "%s\t%s\n", hashString.c_str(), name.c_str()) < 0 || fflush(mMappingFile) != 0)
+	{
+		return false;
+	}
+	++mAdded;
+	return true;
+}
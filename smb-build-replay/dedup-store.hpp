@@ -0,0 +1,44 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "smb-replay.hpp"
+#include "hash.hpp"
+
+// Content addressed replay store. A replay is keyed by the hash of its binary encoding, which is
+// what a GCI decompresses to, so the GCI file name, comment and timestamps don't matter.
+//   objects/<first two hex digits>/<hash>.bin   every distinct replay once
+//   mapping.tsv                                 hash, tab, original filename per added file
+class DedupStore
+{
+public:
+	DedupStore() = default;
+	DedupStore(const DedupStore &) = delete;
+	DedupStore &operator=(const DedupStore &) = delete;
+	~DedupStore();
+
+	bool open(const std::string &directory);
+
+	// Stores replay unless an identical one is stored already and maps name to it. Thread safe, a
+	// name is only mapped once its object is on disk.
+	bool add(const ReplayFile &replay, const std::string &name);
+
+	size_t getAddedCount() const { return mAdded; }
+	size_t getStoredCount() const { return mStored; }
+
+private:
+	std::string mDirectory;
+	FILE *mMappingFile = nullptr;
+	std::mutex mMutex;
+	std::condition_variable mObjectWritten;
+	// Objects of this run, true once on disk and false while being written. Saves asking the file
+	// system again.
+	std::map<Hash128, bool> mKnownHashes;
+	std::atomic<size_t> mAdded{ 0 };
+	std::atomic<size_t> mStored{ 0 };
+};
@@ -0,0 +1,443 @@
+#include "server.hpp"
+
+#include <iostream>
+
+#ifndef _WIN32
+
+#include <vector>
+#include <deque>
+#include <set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstring>
+#include <csignal>
+#include <algorithm>
+
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <fcntl.h>
+
+#include "conversion.hpp"
+#include "trace.hpp"
+
+namespace
+{
+
+const size_t cRequestHeaderSize = 12;
+const size_t cResponseHeaderSize = 8;
+// A client that stops sending in the middle of a request, or stops reading its response, is
+// dropped after this long
+const int cStallTimeoutSeconds = 10;
+
+volatile std::sig_atomic_t gStopServer = 0;
+
+void stopServer(int)
+{
+	gStopServer = 1;
+}
+
+uint32_t readLE32(const uint8_t *data)
+{
+	return data[0] | (data[1] << 8) | (data[2] << 16) | (uint32_t(data[3]) << 24);
+}
+
+void writeLE32(uint8_t *data, uint32_t value)
+{
+	data[0] = value & 0xFF;
+	data[1] = (value >> 8) & 0xFF;
+	data[2] = (value >> 16) & 0xFF;
+	data[3] = (value >> 24) & 0xFF;
+}
+
+bool readFully(int fd, uint8_t *data, size_t size)
+{
+	while (size)
+	{
+		ssize_t count = read(fd, data, size);
+		if (count < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (count <= 0)
+		{
+			return false;
+		}
+		data += count;
+		size -= count;
+	}
+	return true;
+}
+
+bool writeFully(int fd, const uint8_t *data, size_t size)
+{
+	while (size)
+	{
+		ssize_t count = write(fd, data, size);
+		if (count < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (count <= 0)
+		{
+			return false;
+		}
+		data += count;
+		size -= count;
+	}
+	return true;
+}
+
+FileFormat getServerFileFormat(uint8_t format)
+{
+	switch (format)
+	{
+	case 1:
+		return FileFormat::Binary;
+	case 2:
+		return FileFormat::GCI;
+	case 3:
+		return FileFormat::JSON;
+	default:
+		return FileFormat::Unknown;
+	}
+}
+
+// Buffers stay with the worker so steady state requests reuse their capacity
+struct ServerWorker
+{
+	std::vector<uint8_t> request;
+	std::vector<uint8_t> response;
+	ReplayFile replay;
+	ConversionOptions options;
+};
+
+ConversionResult handleRequest(ServerWorker &worker)
+{
+	const auto &request = worker.request;
+	auto &options = worker.options;
+	options.inputFormat = getServerFileFormat(request[0]);
+	options.outputFormat = getServerFileFormat(request[1]);
+	options.prettyJSON = (request[2] & 0x1) != 0;
+	options.positions = (request[2] & 0x2) != 0;
+	options.doublePrecisionPositions = (request[2] & 0x4) == 0;
+	options.optimalRLE = (request[2] & 0x8) != 0;
+	options.speeds = (request[2] & 0x10) != 0;
+	options.padFloorNumber = int32_t(readLE32(&request[4]));
+	size_t commentLength = readLE32(&request[8]);
+	if (commentLength > request.size() - cRequestHeaderSize)
+	{
+		return ConversionResult::ReadFailed;
+	}
+	size_t inputStart = cRequestHeaderSize + commentLength;
+	if (commentLength)
+	{
+		options.comment.assign(request.begin() + cRequestHeaderSize, request.begin() + inputStart);
+	}
+	else
+	{
+		options.comment = "<UNTAGGED>";
+	}
+
+	if (options.inputFormat == FileFormat::Unknown)
+	{
+		return ConversionResult::DecodeFailed;
+	}
+	if (options.outputFormat == FileFormat::Unknown)
+	{
+		return ConversionResult::EncodeFailed;
+	}
+
+	// Decoded straight out of the request
+	return convertBuffer(options, BufferView(request.data() + inputStart, request.size() - inputStart), worker.response, worker.replay);
+}
+
+// Answers the next request of a client whose connection is readable. False once the client hangs
+// up, breaks the framing or stalls.
+bool serveRequest(ServerWorker &worker, int fd)
+{
+	uint8_t sizeBytes[4];
+	if (!readFully(fd, sizeBytes, sizeof(sizeBytes)))
+	{
+		return false;
+	}
+	size_t size = readLE32(sizeBytes);
+	if (size < cRequestHeaderSize || size > cMaxServerRequestSize)
+	{
+		return false;
+	}
+	worker.request.resize(size);
+	if (!readFully(fd, worker.request.data(), size))
+	{
+		return false;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	worker.response.resize(cResponseHeaderSize);
+	ConversionResult result = handleRequest(worker);
+	if (result != ConversionResult::Success)
+	{
+		const char *message = getConversionResultMessage(result);
+		worker.response.resize(cResponseHeaderSize);
+		worker.response.insert(worker.response.end(), message, message + strlen(message));
+	}
+	writeLE32(worker.response.data(), uint32_t(worker.response.size() - 4));
+	worker.response[4] = uint8_t(result);
+	worker.response[5] = worker.response[6] = worker.response[7] = 0;
+
+	if (tStageStats)
+	{
+		++tStageStats->files;
+		tStageStats->fileNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	return writeFully(fd, worker.response.data(), worker.response.size());
+}
+
+int openServerSocket(const std::string &socketPath)
+{
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (socketPath.size() >= sizeof(address.sun_path))
+	{
+		std::cout << "Socket path is too long!" << std::endl;
+		return -1;
+	}
+	memcpy(address.sun_path, socketPath.c_str(), socketPath.size());
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+	{
+		std::cout << "Failed to create socket!" << std::endl;
+		return -1;
+	}
+
+	// Left behind by a previous run that was killed if nobody answers on it, otherwise it belongs
+	// to a server that is still running
+	struct stat pathStat;
+	if (stat(socketPath.c_str(), &pathStat) == 0 && S_ISSOCK(pathStat.st_mode))
+	{
+		if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0 || (errno != ECONNREFUSED && errno != ENOENT))
+		{
+			std::cout << "Already serving on " << socketPath << "!" << std::endl;
+			close(fd);
+			return -1;
+		}
+		unlink(socketPath.c_str());
+		// A socket that failed to connect can't be bound
+		close(fd);
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0)
+		{
+			std::cout << "Failed to create socket!" << std::endl;
+			return -1;
+		}
+	}
+	if (bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0)
+	{
+		std::cout << "Failed to listen on " << socketPath << "!" << std::endl;
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+}
+
+bool serveConversions(const std::string &socketPath, unsigned jobs, StageStats *stats)
+{
+	gStopServer = 0;
+	int listenFd = openServerSocket(socketPath);
+	if (listenFd < 0)
+	{
+		return false;
+	}
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = stopServer;
+	sigaction(SIGINT, &action, nullptr);
+	sigaction(SIGTERM, &action, nullptr);
+	// Clients hanging up early should not take the server with them
+	signal(SIGPIPE, SIG_IGN);
+
+	// Workers take a connection for one request at a time and hand it back to the accept loop,
+	// which waits for the next request on it, so idle clients never hold up a worker
+	int wakePipe[2];
+	if (pipe(wakePipe) != 0)
+	{
+		std::cout << "Failed to create socket!" << std::endl;
+		close(listenFd);
+		return false;
+	}
+	fcntl(wakePipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(wakePipe[1], F_SETFL, O_NONBLOCK);
+
+	std::mutex queueMutex;
+	std::condition_variable queueCondition;
+	std::deque<int> pendingConnections;
+	std::set<int> activeConnections;
+	std::vector<int> idleConnections;
+	bool stopping = false;
+
+	auto worker = [&](unsigned workerIndex)
+	{
+		setTraceThreadName("worker " + std::to_string(workerIndex));
+		StageStats workerStats;
+		tStageStats = stats ? &workerStats : nullptr;
+		ServerWorker serverWorker;
+
+		for (;;)
+		{
+			int fd;
+			{
+				std::unique_lock<std::mutex> lock(queueMutex);
+				queueCondition.wait(lock, [&]() { return stopping || !pendingConnections.empty(); });
+				if (stopping)
+				{
+					break;
+				}
+				fd = pendingConnections.front();
+				pendingConnections.pop_front();
+				activeConnections.insert(fd);
+			}
+
+			bool keep = serveRequest(serverWorker, fd);
+
+			std::lock_guard<std::mutex> lock(queueMutex);
+			activeConnections.erase(fd);
+			if (keep && !stopping)
+			{
+				idleConnections.push_back(fd);
+				// Nothing to do if the pipe is full, the accept loop is awake then anyway
+				uint8_t wake = 0;
+				ssize_t written = write(wakePipe[1], &wake, 1);
+				(void)written;
+			}
+			else
+			{
+				close(fd);
+			}
+		}
+
+		tStageStats = nullptr;
+		if (stats)
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			stats->merge(workerStats);
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for (unsigned i = 0; i < jobs; ++i)
+	{
+		workers.emplace_back(worker, i + 1);
+	}
+	std::cout << "Listening on " << socketPath << " with " << jobs << " workers" << std::endl;
+
+	bool success = true;
+	std::vector<pollfd> pollFds;
+	while (!gStopServer)
+	{
+		pollFds.clear();
+		pollFds.push_back({ listenFd, POLLIN, 0 });
+		pollFds.push_back({ wakePipe[0], POLLIN, 0 });
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			for (int fd : idleConnections)
+			{
+				pollFds.push_back({ fd, POLLIN, 0 });
+			}
+		}
+		// Wake up now and then in case the signal went to another thread
+		int ready = poll(pollFds.data(), pollFds.size(), 250);
+		if (ready < 0 && errno != EINTR)
+		{
+			std::cout << "Failed to wait for connections!" << std::endl;
+			success = false;
+			break;
+		}
+		if (ready <= 0)
+		{
+			continue;
+		}
+
+		if (pollFds[1].revents)
+		{
+			uint8_t wake[64];
+			while (read(wakePipe[0], wake, sizeof(wake)) > 0)
+			{
+			}
+		}
+		std::lock_guard<std::mutex> lock(queueMutex);
+		// A request or a hang up on an idle connection, either way a worker deals with it
+		for (size_t i = 2; i < pollFds.size(); ++i)
+		{
+			if (pollFds[i].revents)
+			{
+				idleConnections.erase(std::find(idleConnections.begin(), idleConnections.end(), pollFds[i].fd));
+				pendingConnections.push_back(pollFds[i].fd);
+				queueCondition.notify_one();
+			}
+		}
+		if (pollFds[0].revents)
+		{
+			int fd = accept(listenFd, nullptr, nullptr);
+			if (fd >= 0)
+			{
+				timeval timeout = { cStallTimeoutSeconds, 0 };
+				setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+				setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+				idleConnections.push_back(fd);
+			}
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		stopping = true;
+		for (int fd : pendingConnections)
+		{
+			close(fd);
+		}
+		pendingConnections.clear();
+		for (int fd : idleConnections)
+		{
+			close(fd);
+		}
+		idleConnections.clear();
+		// Unblocks workers stuck reading from or writing to a stalled client
+		for (int fd : activeConnections)
+		{
+			shutdown(fd, SHUT_RDWR);
+		}
+	}
+	queueCondition.notify_all();
+	for (auto &thread : workers)
+	{
+		thread.join();
+	}
+
+	close(wakePipe[0]);
+	close(wakePipe[1]);
+	close(listenFd);
+	unlink(socketPath.c_str());
+	return success;
+}
+
+#else
+
+bool serveConversions(const std::string &, unsigned, StageStats *)
+{
+	std::cout << "Serving is not supported on this platform!" << std::endl;
+	return false;
+}
+
+#endif
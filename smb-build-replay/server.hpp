@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string>
+
+#include "stage-stats.hpp"
+
+// Conversion daemon listening on a Unix domain socket (POSIX only).
+//
+// A connection carries any number of requests, each answered in order. All integers are little endian.
+//
+// Request:
+//   uint32 size of everything that follows
+//   uint8  input format  (1 binary, 2 gci, 3 json, as in smbreplay.h)
+//   uint8  output format
+//   uint8  flags         (0x1 pretty JSON, 0x2 JSON player positions, 0x4 sum positions in float,
+//                        0x8 size optimal GCI compression, 0x10 player speed per frame)
+//   uint8  reserved, 0
+//   int32  pad floor number
+//   uint32 comment length, followed by the comment (empty for "<UNTAGGED>")
+//   input file data
+//
+// Response:
+//   uint32 size of everything that follows
+//   uint8  ConversionResult, 0 on success
+//   uint8  reserved[3]
+//   output file data on success, otherwise the error message
+//
+// Requests above cMaxServerRequestSize or with bad framing close the connection, as does stalling
+// for 10 seconds in the middle of a request or while the response is sent. Idle connections cost
+// nothing but a file descriptor.
+
+static const size_t cMaxServerRequestSize = 64 * 1024 * 1024;
+
+// Serves until SIGINT or SIGTERM with jobs worker threads, each taking whichever connection has a
+// request waiting. Stats of all workers are merged into stats if it is not null.
+bool serveConversions(const std::string &socketPath, unsigned jobs, StageStats *stats);
@@ -0,0 +1,425 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "tar-archive.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+namespace
+{
+
+const size_t cTarBlockSize = 512;
+// Past what any tar tool writes, so sizes that would overflow are never worked with
+const uint64_t cMaxTarMemberSize = 1ull << 50;
+const uint64_t cMaxTarExtensionSize = 64 * 1024;
+
+// Numeric header fields are zero padded octal with a terminating NUL
+bool writeOctal(char *field, size_t fieldSize, uint64_t value)
+{
+	for (size_t i = fieldSize - 1; i > 0; --i)
+	{
+		field[i - 1] = static_cast<char>('0' + (value & 7));
+		value >>= 3;
+	}
+	field[fieldSize - 1] = '\0';
+	return value == 0;
+}
+
+bool splitName(const std::string &name, std::string &prefix, std::string &shortName)
+{
+	if (name.size() <= 100)
+	{
+		prefix.clear();
+		shortName = name;
+		return true;
+	}
+	// Split at the last '/' that leaves both parts short enough
+	for (size_t slash = name.rfind('/'); slash != std::string::npos && slash > 0; slash = name.rfind('/', slash - 1))
+	{
+		if (slash <= 155 && name.size() - slash - 1 <= 100)
+		{
+			prefix = name.substr(0, slash);
+			shortName = name.substr(slash + 1);
+			return true;
+		}
+	}
+	return false;
+}
+
+// Octal text, or big endian binary with the top bit of the first byte set as GNU tar writes sizes
+// from 8 GiB on
+uint64_t readNumber(const char *field, size_t fieldSize)
+{
+	uint64_t value = 0;
+	if (static_cast<uint8_t>(field[0]) & 0x80)
+	{
+		value = static_cast<uint8_t>(field[0]) & 0x7F;
+		for (size_t i = 1; i < fieldSize; ++i)
+		{
+			value = (value << 8) | static_cast<uint8_t>(field[i]);
+		}
+		return value;
+	}
+	for (size_t i = 0; i < fieldSize && field[i] != '\0'; ++i)
+	{
+		if (field[i] >= '0' && field[i] <= '7')
+		{
+			value = (value << 3) | static_cast<uint64_t>(field[i] - '0');
+		}
+	}
+	return value;
+}
+
+std::string readString(const char *field, size_t fieldSize)
+{
+	return std::string(field, strnlen(field, fieldSize));
+}
+
+bool isChecksumValid(const char *header)
+{
+	// Old tools summed signed chars, accept either
+	uint32_t unsignedSum = 0;
+	int32_t signedSum = 0;
+	for (size_t i = 0; i < cTarBlockSize; ++i)
+	{
+		char c = i >= 148 && i < 156 ? ' ' : header[i];
+		unsignedSum += static_cast<uint8_t>(c);
+		signedSum += static_cast<signed char>(c);
+	}
+	uint64_t checksum = readNumber(header + 148, 8);
+	return checksum == unsignedSum || checksum == static_cast<uint64_t>(signedSum);
+}
+
+// Records of "<length> <key>=<value>\n", only path and size matter here
+void readPaxHeader(const std::vector<uint8_t> &data, std::string &path, uint64_t &size, bool &hasSize)
+{
+	const char *text = reinterpret_cast<const char *>(data.data());
+	size_t position = 0;
+	while (position < data.size())
+	{
+		size_t length = 0;
+		size_t i = position;
+		for (; i < data.size() && text[i] >= '0' && text[i] <= '9'; ++i)
+		{
+			length = length * 10 + (text[i] - '0');
+		}
+		if (i >= data.size() || text[i] != ' ' || length <= i - position + 1 || position + length > data.size())
+		{
+			return;
+		}
+		std::string record(text + i + 1, text + position + length - 1);
+		size_t equals = record.find('=');
+		if (equals != std::string::npos)
+		{
+			std::string key = record.substr(0, equals);
+			if (key == "path")
+			{
+				path = record.substr(equals + 1);
+			}
+			else if (key == "size")
+			{
+				size = std::strtoull(record.c_str() + equals + 1, nullptr, 10);
+				hasSize = true;
+			}
+		}
+		position += length;
+	}
+}
+
+}
+
+TarWriter::~TarWriter()
+{
+	close();
+}
+
+bool TarWriter::open(const std::string &filename)
+{
+	close();
+	mFailed = false;
+	if (filename == "-")
+	{
+		mFile = stdout;
+#ifdef _WIN32
+		_setmode(_fileno(stdout), _O_BINARY);
+#endif
+	}
+	else
+	{
+		mFile = fopen(filename.c_str(), "wb");
+	}
+	return mFile != nullptr;
+}
+
+bool TarWriter::addFile(const std::string &name, const uint8_t *data, size_t size, uint64_t modifiedTime)
+{
+	if (!mFile)
+	{
+		return false;
+	}
+
+	std::string prefix, shortName;
+	if (!splitName(name, prefix, shortName))
+	{
+		// Too long for ustar, GNU tar's long name member in front holds it instead. The name is
+		// written with its terminating NUL.
+		if (!writeMember("././@LongLink", "", 'L', reinterpret_cast<const uint8_t *>(name.c_str()), name.size() + 1, 0))
+		{
+			return false;
+		}
+		prefix.clear();
+		shortName = name.substr(0, 100);
+	}
+	return writeMember(shortName, prefix, '0', data, size, modifiedTime);
+}
+
+bool TarWriter::writeMember(const std::string &shortName, const std::string &prefix, char type, const uint8_t *data, size_t size, uint64_t modifiedTime)
+{
+	char header[cTarBlockSize] = {};
+	memcpy(header + 0, shortName.data(), shortName.size());
+	writeOctal(header + 100, 8, 0644); // mode
+	writeOctal(header + 108, 8, 0); // uid
+	writeOctal(header + 116, 8, 0); // gid
+	if (!writeOctal(header + 124, 12, size))
+	{
+		mFailed = true;
+		return false;
+	}
+	writeOctal(header + 136, 12, modifiedTime);
+	header[156] = type;
+	memcpy(header + 257, "ustar", 6);
+	memcpy(header + 263, "00", 2);
+	memcpy(header + 345, prefix.data(), prefix.size());
+
+	// Checksum is computed with the checksum field itself set to spaces
+	memset(header + 148, ' ', 8);
+	uint32_t checksum = 0;
+	for (auto c : header)
+	{
+		checksum += static_cast<uint8_t>(c);
+	}
+	writeOctal(header + 148, 7, checksum);
+	header[155] = ' ';
+
+	static const char padding[cTarBlockSize] = {};
+	size_t paddingSize = (cTarBlockSize - size % cTarBlockSize) % cTarBlockSize;
+	if (fwrite(header, 1, sizeof(header), mFile) != sizeof(header)
+		|| fwrite(data, 1, size, mFile) != size
+		|| fwrite(padding, 1, paddingSize, mFile) != paddingSize)
+	{
+		mFailed = true;
+		return false;
+	}
+	return true;
+}
+
+bool TarWriter::close()
+{
+	if (!mFile)
+	{
+		return !mFailed;
+	}
+	static const char endOfArchive[cTarBlockSize * 2] = {};
+	if (fwrite(endOfArchive, 1, sizeof(endOfArchive), mFile) != sizeof(endOfArchive))
+	{
+		mFailed = true;
+	}
+	if ((mFile == stdout ? fflush(mFile) : fclose(mFile)) != 0)
+	{
+		mFailed = true;
+	}
+	mFile = nullptr;
+	return !mFailed;
+}
+
+TarReader::~TarReader()
+{
+	close();
+}
+
+bool TarReader::open(const std::string &filename)
+{
+	close();
+	mFailed = false;
+	mDataLeft = 0;
+	mPaddingLeft = 0;
+	if (filename == "-")
+	{
+		mFile = stdin;
+#ifdef _WIN32
+		_setmode(_fileno(stdin), _O_BINARY);
+#endif
+	}
+	else
+	{
+		mFile = fopen(filename.c_str(), "rb");
+	}
+	// Pipes can't seek, so members are skipped by reading past them there
+	mSeekable = mFile && fseek(mFile, 0, SEEK_CUR) == 0;
+	return mFile != nullptr;
+}
+
+bool TarReader::read(void *data, size_t size)
+{
+	if (fread(data, 1, size, mFile) != size)
+	{
+		mFailed = true;
+		return false;
+	}
+	return true;
+}
+
+bool TarReader::skip(uint64_t size)
+{
+	if (mSeekable)
+	{
+		// A seek past the end goes unnoticed here, the next header read fails instead
+		const uint64_t cMaxSeek = 1u << 30;
+		for (; size; size -= std::min(size, cMaxSeek))
+		{
+			if (fseek(mFile, static_cast<long>(std::min(size, cMaxSeek)), SEEK_CUR) != 0)
+			{
+				mFailed = true;
+				return false;
+			}
+		}
+		return true;
+	}
+	char buffer[cTarBlockSize * 8];
+	while (size)
+	{
+		size_t count = static_cast<size_t>(std::min<uint64_t>(size, sizeof(buffer)));
+		if (!read(buffer, count))
+		{
+			return false;
+		}
+		size -= count;
+	}
+	return true;
+}
+
+bool TarReader::next(TarMember &member)
+{
+	// Whatever the caller didn't read of the previous member
+	if (!mFile || mFailed || !skip(mDataLeft + mPaddingLeft))
+	{
+		return false;
+	}
+	mDataLeft = 0;
+	mPaddingLeft = 0;
+
+	// Extended headers name the member that follows them
+	std::string longName;
+	uint64_t paxSize = 0;
+	bool hasPaxSize = false;
+	while (true)
+	{
+		char header[cTarBlockSize];
+		if (!read(header, sizeof(header)))
+		{
+			return false;
+		}
+		// The archive ends with zero blocks, some writers leave out the second one
+		if (std::all_of(header, header + sizeof(header), [](char c) { return c == '\0'; }))
+		{
+			return false;
+		}
+		if (!isChecksumValid(header))
+		{
+			mFailed = true;
+			return false;
+		}
+
+		uint64_t size = hasPaxSize ? paxSize : readNumber(header + 124, 12);
+		if (size > cMaxTarMemberSize)
+		{
+			mFailed = true;
+			return false;
+		}
+		uint64_t paddingSize = (cTarBlockSize - size % cTarBlockSize) % cTarBlockSize;
+		char type = header[156];
+		if (type == 'L' || type == 'x')
+		{
+			// Names and a few records, anything bigger is a broken archive
+			if (size > cMaxTarExtensionSize)
+			{
+				mFailed = true;
+				return false;
+			}
+			std::vector<uint8_t> extension(static_cast<size_t>(size));
+			if (!read(extension.data(), extension.size()) || !skip(paddingSize))
+			{
+				return false;
+			}
+			if (type == 'L')
+			{
+				longName = readString(reinterpret_cast<const char *>(extension.data()), extension.size());
+			}
+			else
+			{
+				readPaxHeader(extension, longName, paxSize, hasPaxSize);
+			}
+			continue;
+		}
+		if (type != '0' && type != '\0' && type != '7')
+		{
+			longName.clear();
+			hasPaxSize = false;
+			if (!skip(size + paddingSize))
+			{
+				return false;
+			}
+			continue;
+		}
+
+		if (!longName.empty())
+		{
+			member.name = longName;
+		}
+		// Only POSIX ustar has a prefix, GNU tar keeps other things there
+		else if (memcmp(header + 257, "ustar", 6) == 0 && header[345] != '\0')
+		{
+			member.name = readString(header + 345, 155) + '/' + readString(header, 100);
+		}
+		else
+		{
+			member.name = readString(header, 100);
+		}
+		member.size = size;
+		member.modifiedTime = readNumber(header + 136, 12);
+		mDataLeft = size;
+		mPaddingLeft = paddingSize;
+		return true;
+	}
+}
+
+bool TarReader::readData(std::vector<uint8_t> &data)
+{
+	if (!mFile || mFailed || mDataLeft > SIZE_MAX)
+	{
+		return false;
+	}
+	data.resize(static_cast<size_t>(mDataLeft));
+	mDataLeft = 0;
+	if (!read(data.data(), data.size()))
+	{
+		return false;
+	}
+	return true;
+}
+
+void TarReader::close()
+{
+	if (mFile && mFile != stdin)
+	{
+		fclose(mFile);
+	}
+	mFile = nullptr;
+}
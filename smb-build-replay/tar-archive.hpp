@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Writes a POSIX ustar archive member by member without keeping anything but the current
+// member in memory.
+class TarWriter
+{
+public:
+	TarWriter() = default;
+	TarWriter(const TarWriter &) = delete;
+	TarWriter &operator=(const TarWriter &) = delete;
+	~TarWriter();
+
+	// "-" is standard output
+	bool open(const std::string &filename);
+	// Names longer than 100 characters are split into the ustar prefix field at a '/', or written
+	// as a GNU long name if that doesn't fit either
+	bool addFile(const std::string &name, const uint8_t *data, size_t size, uint64_t modifiedTime = 0);
+	bool addFile(const std::string &name, const std::vector<uint8_t> &data, uint64_t modifiedTime = 0)
+	{
+		return addFile(name, data.data(), data.size(), modifiedTime);
+	}
+	// Writes the end-of-archive marker, returns false if anything failed along the way
+	bool close();
+
+private:
+	bool writeMember(const std::string &shortName, const std::string &prefix, char type, const uint8_t *data, size_t size, uint64_t modifiedTime);
+
+	FILE *mFile = nullptr;
+	bool mFailed = false;
+};
+
+struct TarMember
+{
+	std::string name;
+	uint64_t size = 0;
+	uint64_t modifiedTime = 0;
+};
+
+// Reads a tar archive member by member in one sequential pass, so it works on pipes too. Knows
+// ustar, GNU long names and pax extended headers, which covers what tar tools write by default.
+// Headers come first so the caller can decide whether a member is worth loading at all.
+class TarReader
+{
+public:
+	TarReader() = default;
+	TarReader(const TarReader &) = delete;
+	TarReader &operator=(const TarReader &) = delete;
+	~TarReader();
+
+	// "-" is standard input
+	bool open(const std::string &filename);
+	// Moves to the next regular file, past directories, links and the like and whatever wasn't read
+	// of the last one. Returns false at the end of the archive and on errors, see hasFailed.
+	bool next(TarMember &member);
+	// The data of the member next returned, member.size bytes. The caller checks that size first.
+	bool readData(std::vector<uint8_t> &data);
+	// A bad header checksum or an archive that ends in the middle of a member
+	bool hasFailed() const
+	{
+		return mFailed;
+	}
+	void close();
+
+private:
+	bool read(void *data, size_t size);
+	bool skip(uint64_t size);
+
+	FILE *mFile = nullptr;
+	bool mFailed = false;
+	bool mSeekable = false;
+	// Left of the current member
+	uint64_t mDataLeft = 0;
+	uint64_t mPaddingLeft = 0;
+};
@@ -0,0 +1,404 @@
+#include "verify.hpp"
+#include "conversion.hpp"
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <cctype>
+
+#include "smb-replay.hpp"
+#include "trace.hpp"
+
+#include <boost/filesystem.hpp>
+
+namespace
+{
+
+const size_t cGCIHeaderSize = 0x40;
+// CRCs are computed this many files at a time, see getCRCForBuffers
+const size_t cCRCBatchSize = 4;
+
+uint16_t readBE16(const uint8_t *data)
+{
+	return static_cast<uint16_t>((data[0] << 8) | data[1]);
+}
+
+uint32_t readBE32(const uint8_t *data)
+{
+	return (uint32_t(data[0]) << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+}
+
+uint64_t readBE64(const uint8_t *data)
+{
+	return (uint64_t(readBE32(data)) << 32) | readBE32(data + 4);
+}
+
+bool isCardImage(const std::string &filename)
+{
+	std::string extension = boost::filesystem::path(filename).extension().string();
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](char c)
+	{
+		return static_cast<char>(tolower(static_cast<unsigned char>(c)));
+	});
+	return extension == ".raw" || extension == ".gcp";
+}
+
+bool isReplayEntry(const uint8_t *header)
+{
+	GCIFile defaults;
+	return readBE32(header) == defaults.gameCode && readBE16(header + 4) == defaults.makerCode;
+}
+
+struct PendingGCI
+{
+	std::string name;
+	std::vector<uint8_t> data;
+};
+
+// Everything that can be checked before the CRC, null if fine
+const char *checkGCIHeader(const std::vector<uint8_t> &data)
+{
+	if (data.size() < cGCIHeaderSize + sizeof(uint16_t))
+	{
+		return "Truncated GCI header";
+	}
+	if (!isReplayEntry(data.data()))
+	{
+		return "Not a Super Monkey Ball replay";
+	}
+	size_t blockCount = readBE16(&data[0x38]);
+	if (!blockCount || cGCIHeaderSize + blockCount * GCIFile::cBlockSize != data.size())
+	{
+		return "Block count doesn't match the file size";
+	}
+	if (data.size() < GCIFile::cReplayDataOffset + sizeof(uint64_t))
+	{
+		return "Too small to hold a replay";
+	}
+	return nullptr;
+}
+
+// Walks the RLE tags without expanding them
+const char *checkCompressedReplay(const std::vector<uint8_t> &data)
+{
+	uint64_t decompressedSize = readBE64(&data[GCIFile::cReplayDataOffset]);
+	if (decompressedSize < ReplayFile::cBinarySize)
+	{
+		return "Compressed replay is too small";
+	}
+	uint64_t decompressed = 0;
+	size_t i = GCIFile::cReplayDataOffset + sizeof(uint64_t);
+	while (decompressed < decompressedSize)
+	{
+		if (i >= data.size())
+		{
+			return "Compressed replay is truncated";
+		}
+		size_t length = data[i] & 0x7F;
+		size_t tagSize = (data[i] & 0x80) ? 2 : length + 1;
+		if (i + tagSize > data.size())
+		{
+			return "Compressed replay is truncated";
+		}
+		i += tagSize;
+		decompressed += length;
+	}
+	if (decompressed != decompressedSize)
+	{
+		return "Compressed replay is longer than its size";
+	}
+	return nullptr;
+}
+
+// Additive checksums of the card system blocks
+bool checkCardChecksums(const uint8_t *data, size_t size, uint16_t checksum, uint16_t inverseChecksum)
+{
+	uint16_t sum = 0;
+	uint16_t inverseSum = 0;
+	for (size_t i = 0; i + 1 < size; i += 2)
+	{
+		uint16_t value = readBE16(data + i);
+		sum = static_cast<uint16_t>(sum + value);
+		inverseSum = static_cast<uint16_t>(inverseSum + (value ^ 0xFFFF));
+	}
+	if (sum == 0xFFFF)
+	{
+		sum = 0;
+	}
+	if (inverseSum == 0xFFFF)
+	{
+		inverseSum = 0;
+	}
+	return sum == checksum && inverseSum == inverseChecksum;
+}
+
+bool checkDirectoryBlock(const uint8_t *block)
+{
+	return checkCardChecksums(block, 0x1FFC, readBE16(block + 0x1FFC), readBE16(block + 0x1FFE));
+}
+
+bool checkAllocationBlock(const uint8_t *block)
+{
+	return checkCardChecksums(block + 4, GCIFile::cBlockSize - 4, readBE16(block), readBE16(block + 2));
+}
+
+// Newer of the two copies at firstBlock that is intact, null if neither is
+const uint8_t *getCurrentCardBlock(const std::vector<uint8_t> &image, size_t firstBlock, bool (*check)(const uint8_t *), size_t counterOffset)
+{
+	const uint8_t *blocks[2] = { &image[firstBlock * GCIFile::cBlockSize], &image[(firstBlock + 1) * GCIFile::cBlockSize] };
+	bool intact[2] = { check(blocks[0]), check(blocks[1]) };
+	if (intact[0] && intact[1])
+	{
+		int16_t counters[2] = { static_cast<int16_t>(readBE16(blocks[0] + counterOffset)), static_cast<int16_t>(readBE16(blocks[1] + counterOffset)) };
+		return counters[0] >= counters[1] ? blocks[0] : blocks[1];
+	}
+	return intact[0] ? blocks[0] : intact[1] ? blocks[1] : nullptr;
+}
+
+class Verifier
+{
+public:
+	Verifier(std::mutex &outputMutex, std::ostream &messages, std::atomic<size_t> &verified, std::atomic<size_t> &failed, std::atomic<size_t> &skipped)
+		: mOutputMutex(outputMutex), mMessages(messages), mVerified(verified), mFailed(failed), mSkipped(skipped)
+	{}
+
+	void verifyFile(const std::string &filename)
+	{
+		auto start = std::chrono::steady_clock::now();
+		TraceScope fileScope("file", "verify", &filename);
+
+		std::vector<uint8_t> data;
+		{
+			StageScope scope(Stage::Load);
+			data = loadFile(filename);
+			scope.setBytes(0, data.size());
+		}
+		if (!data.size())
+		{
+			fail(filename, "Failed to read file");
+		}
+		else if (isCardImage(filename))
+		{
+			addCardImage(filename, data);
+		}
+		else
+		{
+			add(filename, std::move(data));
+		}
+
+		if (tStageStats)
+		{
+			++tStageStats->files;
+			tStageStats->fileNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		}
+	}
+
+	void flush()
+	{
+		uint16_t storedChecksums[cCRCBatchSize];
+		const uint8_t *buffers[cCRCBatchSize];
+		size_t sizes[cCRCBatchSize];
+		uint16_t checksums[cCRCBatchSize];
+		const char *problems[cCRCBatchSize];
+		size_t crcCount = 0;
+		size_t crcBytes = 0;
+		for (size_t i = 0; i < mBatch.size(); ++i)
+		{
+			const auto &data = mBatch[i].data;
+			problems[i] = checkGCIHeader(data);
+			if (!problems[i])
+			{
+				storedChecksums[crcCount] = readBE16(&data[cGCIHeaderSize]);
+				buffers[crcCount] = &data[cGCIHeaderSize + sizeof(uint16_t)];
+				sizes[crcCount] = data.size() - cGCIHeaderSize - sizeof(uint16_t);
+				crcBytes += sizes[crcCount];
+				++crcCount;
+			}
+		}
+		{
+			StageScope scope(Stage::CRC);
+			getCRCForBuffers(buffers, sizes, crcCount, checksums);
+			scope.setBytes(crcBytes, 0);
+		}
+
+		size_t crcIndex = 0;
+		for (size_t i = 0; i < mBatch.size(); ++i)
+		{
+			if (!problems[i])
+			{
+				if (checksums[crcIndex] != storedChecksums[crcIndex])
+				{
+					problems[i] = "CRC mismatch";
+				}
+				else
+				{
+					StageScope scope(Stage::Decompress);
+					problems[i] = checkCompressedReplay(mBatch[i].data);
+					scope.setBytes(mBatch[i].data.size(), 0);
+				}
+				++crcIndex;
+			}
+
+			if (problems[i])
+			{
+				fail(mBatch[i].name, problems[i]);
+			}
+			else
+			{
+				++mVerified;
+			}
+		}
+		mBatch.clear();
+	}
+
+private:
+	void add(const std::string &name, std::vector<uint8_t> data)
+	{
+		mBatch.push_back({ name, std::move(data) });
+		if (mBatch.size() == cCRCBatchSize)
+		{
+			flush();
+		}
+	}
+
+	void fail(const std::string &name, const char *problem)
+	{
+		++mFailed;
+		std::lock_guard<std::mutex> lock(mOutputMutex);
+		mMessages << name << ": " << problem << std::endl;
+	}
+
+	// Reassembles every replay on the card into a GCI
+	void addCardImage(const std::string &filename, const std::vector<uint8_t> &image)
+	{
+		size_t blockCount = image.size() / GCIFile::cBlockSize;
+		if (image.size() % GCIFile::cBlockSize || blockCount < cCardSystemBlocks)
+		{
+			fail(filename, "Not a memory card image");
+			return;
+		}
+		const uint8_t *directory = getCurrentCardBlock(image, 1, checkDirectoryBlock, 0x1FFA);
+		const uint8_t *allocationTable = getCurrentCardBlock(image, 3, checkAllocationBlock, 4);
+		if (!directory || !allocationTable)
+		{
+			fail(filename, directory ? "Damaged block allocation table" : "Damaged directory");
+			return;
+		}
+
+		for (size_t entry = 0; entry < cCardDirectoryEntries; ++entry)
+		{
+			const uint8_t *header = directory + entry * cGCIHeaderSize;
+			if (readBE32(header) == 0xFFFFFFFF)
+			{
+				continue;
+			}
+			std::string name(reinterpret_cast<const char *>(header + 8), 0x20);
+			name = filename + ":" + name.substr(0, name.find('\0'));
+			if (!isReplayEntry(header))
+			{
+				++mSkipped;
+				continue;
+			}
+
+			size_t fileBlocks = readBE16(header + 0x38);
+			size_t block = readBE16(header + 0x36);
+			std::vector<uint8_t> data(header, header + cGCIHeaderSize);
+			data.reserve(cGCIHeaderSize + fileBlocks * GCIFile::cBlockSize);
+			const char *problem = fileBlocks ? nullptr : "Empty file";
+			for (size_t i = 0; i < fileBlocks && !problem; ++i)
+			{
+				if (block < cCardSystemBlocks || block >= blockCount)
+				{
+					problem = "File blocks are outside the card";
+					break;
+				}
+				auto blockIt = image.begin() + block * GCIFile::cBlockSize;
+				data.insert(data.end(), blockIt, blockIt + GCIFile::cBlockSize);
+				uint16_t next = readBE16(allocationTable + 0xA + (block - cCardSystemBlocks) * sizeof(uint16_t));
+				if (i + 1 < fileBlocks && next == 0xFFFF)
+				{
+					problem = "File is shorter than its block count";
+				}
+				else if (i + 1 == fileBlocks && next != 0xFFFF)
+				{
+					problem = "File is longer than its block count";
+				}
+				block = next;
+			}
+
+			if (problem)
+			{
+				fail(name, problem);
+			}
+			else
+			{
+				add(name, std::move(data));
+			}
+		}
+	}
+
+	std::mutex &mOutputMutex;
+	std::ostream &mMessages;
+	std::atomic<size_t> &mVerified;
+	std::atomic<size_t> &mFailed;
+	std::atomic<size_t> &mSkipped;
+	std::vector<PendingGCI> mBatch;
+};
+
+}
+
+VerifyResult verifyReplays(const std::string &path, unsigned jobs, StageStats *stats, std::ostream &messages)
+{
+	namespace fs = boost::filesystem;
+
+	VerifyResult result;
+	std::vector<std::string> inputFiles;
+	try
+	{
+		if (fs::is_directory(path))
+		{
+			for (fs::recursive_directory_iterator it(path), end; it != end; ++it)
+			{
+				std::string filename = it->path().string();
+				if (fs::is_regular_file(it->status()) && (getFileFormatByExtension(filename) == FileFormat::GCI || isCardImage(filename)))
+				{
+					inputFiles.push_back(filename);
+				}
+			}
+		}
+		else
+		{
+			inputFiles.push_back(path);
+		}
+	}
+	catch (const fs::filesystem_error &error)
+	{
+		messages << "Failed to read input directory: " << error.what() << std::endl;
+		result.failed = 1;
+		return result;
+	}
+	std::sort(inputFiles.begin(), inputFiles.end());
+
+	std::atomic<size_t> nextFile(0);
+	std::atomic<size_t> verified(0);
+	std::atomic<size_t> failed(0);
+	std::atomic<size_t> skipped(0);
+	std::mutex outputMutex;
+
+	runWorkers(jobs, stats, [&](unsigned)
+	{
+		Verifier verifier(outputMutex, messages, verified, failed, skipped);
+		for (size_t i = nextFile++; i < inputFiles.size(); i = nextFile++)
+		{
+			verifier.verifyFile(inputFiles[i]);
+		}
+		verifier.flush();
+	});
+
+	result.verified = verified;
+	result.failed = failed;
+	result.skipped = skipped;
+	return result;
+}
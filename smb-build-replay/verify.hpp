@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+#include <ostream>
+
+#include "stage-stats.hpp"
+
+// Memory card images hold up to 127 files behind a five block system area. The directory and the
+// block allocation table are kept twice, the copy with the higher update counter is current.
+//   block 0      card header
+//   blocks 1, 2  directory, 127 GCI headers each
+//   blocks 3, 4  block allocation table, the next block of every file block, 0xFFFF on the last
+static const size_t cCardSystemBlocks = 5;
+static const size_t cCardDirectoryEntries = 127;
+
+struct VerifyResult
+{
+	size_t verified = 0;
+	size_t failed = 0;
+	// Files on card images that aren't replays
+	size_t skipped = 0;
+};
+
+// Checks every GCI and memory card image (.raw, .gcp) at path or below it, on jobs threads: GCI
+// header, block count against the file size, stored CRC and that the compressed replay decodes
+// to a complete replay. Card images also have their directory and allocation table checked.
+// Every problem is written to messages. Stats of all workers are merged into stats if it is not null.
+VerifyResult verifyReplays(const std::string &path, unsigned jobs, StageStats *stats, std::ostream &messages);
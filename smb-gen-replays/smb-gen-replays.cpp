@@ -0,0 +1,191 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <chrono>
+
+#include "smb-replay.hpp"
+#include "synthetic-replay.hpp"
+#include "tar-archive.hpp"
+
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+
+std::string getReplayPath(uint64_t index, uint64_t filesPerDirectory, const char *extension)
+{
+	char name[64];
+	snprintf(name, sizeof(name), "replay-%08llu%s", static_cast<unsigned long long>(index), extension);
+	if (!filesPerDirectory)
+	{
+		return name;
+	}
+	// Millions of files in one directory make most file systems and tools crawl
+	char directory[32];
+	snprintf(directory, sizeof(directory), "%05llu/", static_cast<unsigned long long>(index / filesPerDirectory));
+	return std::string(directory) + name;
+}
+
+std::vector<uint8_t> buildReplay(FileFormat format, uint64_t seed, const std::string &comment)
+{
+	ReplayFile replay = generateSyntheticReplay(seed);
+
+	EncodeOptions encodeOptions;
+	if (format == FileFormat::GCI)
+	{
+		// Derived from the seed instead of the clock so output is reproducible
+		char filename[21];
+		snprintf(filename, sizeof(filename), "smkb%016llx", static_cast<unsigned long long>(seed));
+		encodeOptions.gciFilename = filename;
+		encodeOptions.replayComment = getReplayComment(replay.header, comment, 0);
+	}
+	std::vector<uint8_t> data;
+	encodeReplay(format, replay, encodeOptions, data);
+	return data;
+}
+
+int main(int argc, char **argv)
+{
+	namespace po = boost::program_options;
+	namespace fs = boost::filesystem;
+	po::options_description optionDescription("Valid options");
+	optionDescription.add_options()
+		("help",												"print usage")
+		("count,n",			po::value<uint64_t>()->default_value(1), "number of replays to generate")
+		("first-index",		po::value<uint64_t>()->default_value(0), "index of the first replay, to generate a slice of a larger corpus")
+		("seed,s",			po::value<uint64_t>()->default_value(0), "corpus seed, the same seed always gives the same replays")
+		("format,f",		po::value<std::string>()->default_value("gci"), "output file format (binary, gci, json, npz, csv, jsonl)")
+		("comment,c",		po::value<std::string>()->default_value("SYNTHETIC"), "GCI file comment")
+		("out-dir,d",		po::value<std::string>(),			"write one file per replay into this directory")
+		("files-per-dir",	po::value<uint64_t>()->default_value(1000), "replays per subdirectory of --out-dir, 0 for a flat directory")
+		("archive,a",		po::value<std::string>(),			"write all replays into this tar archive instead")
+		("jobs,j",			po::value<unsigned>()->default_value(std::max(1u, std::thread::hardware_concurrency())), "number of worker threads");
+	std::vector<std::string> unrecognizedOptions;
+
+	bool parsingError = false;
+	po::variables_map varMap;
+	try
+	{
+		po::parsed_options parsedOptions = po::command_line_parser(argc, argv)
+			.options(optionDescription)
+			.allow_unregistered().run();
+		unrecognizedOptions = po::collect_unrecognized(parsedOptions.options, po::include_positional);
+		po::store(parsedOptions, varMap);
+		po::notify(varMap);
+	}
+	catch (const boost::exception &)
+	{
+		parsingError = true;
+	}
+
+	if (parsingError || unrecognizedOptions.size()
+		|| varMap.count("help")
+		|| varMap.count("out-dir") + varMap.count("archive") != 1
+		|| varMap.at("jobs").as<unsigned>() == 0)
+	{
+		optionDescription.print(std::cout);
+		return 1;
+	}
+
+	FileFormat format = getFileFormatByName(varMap.at("format").as<std::string>());
+	const FileFormatInfo *formatInfo = nullptr;
+	for (const auto &info : getFileFormats())
+	{
+		if (info.format == format && info.canEncode)
+		{
+			formatInfo = &info;
+		}
+	}
+	if (!formatInfo)
+	{
+		std::cout << "Unknown output format!" << std::endl;
+		return -1;
+	}
+
+	uint64_t count = varMap.at("count").as<uint64_t>();
+	uint64_t firstIndex = varMap.at("first-index").as<uint64_t>();
+	uint64_t corpusSeed = varMap.at("seed").as<uint64_t>();
+	uint64_t filesPerDirectory = varMap.at("files-per-dir").as<uint64_t>();
+	unsigned jobs = varMap.at("jobs").as<unsigned>();
+	std::string comment = varMap.at("comment").as<std::string>();
+
+	TarWriter archive;
+	fs::path outputDirectory;
+	if (varMap.count("archive"))
+	{
+		if (!archive.open(varMap.at("archive").as<std::string>()))
+		{
+			std::cout << "Failed to open output archive!" << std::endl;
+			return -1;
+		}
+	}
+	else
+	{
+		outputDirectory = varMap.at("out-dir").as<std::string>();
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	uint64_t bytesWritten = 0;
+
+	// Replays are built in parallel a window at a time and written out in index order, so the
+	// archive layout does not depend on the number of jobs
+	const uint64_t windowSize = static_cast<uint64_t>(jobs) * 32;
+	std::vector<std::vector<uint8_t>> window;
+	for (uint64_t windowStart = 0; windowStart < count; windowStart += windowSize)
+	{
+		uint64_t windowCount = std::min(windowSize, count - windowStart);
+		window.resize(static_cast<size_t>(windowCount));
+
+		std::vector<std::thread> workers;
+		for (unsigned job = 0; job < jobs; ++job)
+		{
+			workers.emplace_back([&, job]()
+			{
+				for (uint64_t i = job; i < windowCount; i += jobs)
+				{
+					uint64_t index = firstIndex + windowStart + i;
+					window[static_cast<size_t>(i)] = buildReplay(format, getSyntheticReplaySeed(corpusSeed, index), comment);
+				}
+			});
+		}
+		for (auto &worker : workers)
+		{
+			worker.join();
+		}
+
+		for (uint64_t i = 0; i < windowCount; ++i)
+		{
+			uint64_t index = firstIndex + windowStart + i;
+			std::string name = getReplayPath(index, filesPerDirectory, formatInfo->extension);
+			const auto &data = window[static_cast<size_t>(i)];
+			bool written;
+			if (varMap.count("archive"))
+			{
+				written = archive.addFile(name, data);
+			}
+			else
+			{
+				fs::path path = outputDirectory / name;
+				boost::system::error_code error;
+				fs::create_directories(path.parent_path(), error);
+				written = saveFile(path.string(), data);
+			}
+			if (!written)
+			{
+				std::cout << "Failed to write " << name << "!" << std::endl;
+				return -1;
+			}
+			bytesWritten += data.size();
+		}
+	}
+
+	if (varMap.count("archive") && !archive.close())
+	{
+		std::cout << "Failed to write output archive!" << std::endl;
+		return -1;
+	}
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "Generated " << count << " replays (" << bytesWritten << " bytes) in " << seconds << " s" << std::endl;
+	return 0;
+}
@@ -0,0 +1,172 @@
+#include "synthetic-replay.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace
+{
+
+// Storage limits of the columns in raw units
+const int32_t cMaxSpeed = 24000; // ~1.5 units per frame
+const int32_t cMaxPlayerTilt = 5461; // 30 degrees
+const int32_t cMaxStageTilt = 6850; // 23 degrees
+const int32_t cGravity = 160;
+
+// Plausible flag bits, the exact meaning is not known yet
+const uint32_t cFlagGrounded = 0x1;
+const uint32_t cFlagMoving = 0x2;
+const uint32_t cFlagAlwaysSet = 0x10;
+const uint32_t cFlagGoal = 0x100;
+
+int32_t clamp(int32_t value, int32_t limit)
+{
+	return std::min(std::max(value, -limit), limit);
+}
+
+// Moves value a fixed fraction of the way to target, like the game's input smoothing
+int32_t ease(int32_t value, int32_t target, int32_t divisor)
+{
+	int32_t step = (target - value) / divisor;
+	if (step == 0 && target != value)
+	{
+		step = target > value ? 1 : -1;
+	}
+	return value + step;
+}
+
+struct Axis
+{
+	int32_t value = 0;
+	int32_t target = 0;
+};
+
+}
+
+uint64_t getSyntheticReplaySeed(uint64_t corpusSeed, uint64_t index)
+{
+	SplitMix64 indexMix(index);
+	SplitMix64 mix(corpusSeed ^ indexMix.next());
+	return mix.next();
+}
+
+ReplayFile generateSyntheticReplay(uint64_t seed)
+{
+	SplitMix64 rng(seed);
+
+	ReplayFile replay = {};
+	auto &header = replay.header;
+
+	static const uint8_t difficulties[] = { 0, 0, 0, 1, 1, 2, 8, 9, 14, 16 };
+	header.levelDifficulty = difficulties[rng.nextInt(0, static_cast<int32_t>(sizeof(difficulties)) - 1)];
+	uint8_t floorCount = header.levelDifficulty == 0 ? 10 : header.levelDifficulty == 1 ? 30 : 50;
+	header.levelFloor = static_cast<uint8_t>(rng.nextInt(1, floorCount));
+	header.levelID = static_cast<uint8_t>(rng.nextInt(1, 200));
+	header.monkeyType = static_cast<uint8_t>(rng.nextInt(0, 3));
+	header.flags = rng.nextChance(1, 4) ? 0x1 : 0x0;
+
+	// Most stages give 60 seconds, a few 30 or 64
+	int32_t timeRoll = rng.nextInt(0, 9);
+	header.levelMaxTime = static_cast<uint16_t>(timeRoll < 7 ? 3600 : timeRoll < 9 ? 1800 : ReplayFile::cChunkSize);
+	// Skewed towards quick clears with a long tail towards the time limit
+	int32_t minimumTime = 300;
+	int32_t span = header.levelMaxTime - minimumTime;
+	int32_t totalTime = minimumTime + std::min(rng.nextInt(0, span), rng.nextInt(0, span));
+	header.replayTotalTime = static_cast<uint16_t>(totalTime);
+	header.unk_34 = header.replayTotalTime;
+	header.scoreTimeRemaining = static_cast<uint16_t>(header.levelMaxTime - totalTime);
+	header.timeWithScore = header.scoreTimeRemaining;
+	header.scorePoints = static_cast<uint32_t>(header.scoreTimeRemaining) * 100 / 60 + (rng.nextChance(1, 3) ? 100 : 0);
+	header.unk_28 = 1.f;
+	header.startPositionX = rng.nextInt(-2000, 2000) / 40.f;
+	header.startPositionY = rng.nextInt(-200, 800) / 40.f;
+	header.startPositionZ = rng.nextInt(-2000, 2000) / 40.f;
+
+	replay.playerPositionDelta.assign(ReplayFile::cChunkSize, std::vector<float>(3, 0.f));
+	replay.playerTilt.assign(ReplayFile::cChunkSize, std::vector<float>(3, 0.f));
+	replay.data567.assign(ReplayFile::cChunkSize, std::vector<float>(3, 0.f));
+	replay.data8.assign(ReplayFile::cChunkSize, 0.f);
+	replay.flags.assign(ReplayFile::cChunkSize, 0);
+	replay.stageTilt.assign(ReplayFile::cChunkSize, std::vector<float>(2, 0.f));
+
+	Axis velocity[3];
+	Axis playerTilt[3];
+	Axis stageTilt[2];
+	int32_t analog = 0;
+	int32_t airborneFrames = 0;
+	int32_t targetHold = 0;
+
+	for (int32_t frame = 0; frame < totalTime; ++frame)
+	{
+		// The player changes their mind every half second or so
+		if (--targetHold <= 0)
+		{
+			targetHold = rng.nextInt(10, 60);
+			for (auto &axis : stageTilt)
+			{
+				axis.target = rng.nextChance(1, 5) ? 0 : rng.nextInt(-cMaxStageTilt, cMaxStageTilt);
+			}
+			velocity[0].target = rng.nextInt(-cMaxSpeed, cMaxSpeed);
+			velocity[2].target = rng.nextInt(-cMaxSpeed, cMaxSpeed);
+			analog = rng.nextInt(-127, 127);
+		}
+		if (airborneFrames == 0 && rng.nextChance(1, 400))
+		{
+			airborneFrames = rng.nextInt(10, 90);
+			velocity[1].value = rng.nextInt(0, 3000);
+		}
+
+		for (auto &axis : stageTilt)
+		{
+			axis.value = clamp(ease(axis.value, axis.target, 8), cMaxStageTilt);
+		}
+		// The ball speeds up along the stage tilt
+		velocity[0].value = clamp(ease(velocity[0].value, velocity[0].target, 40) + stageTilt[0].value / 64, cMaxSpeed);
+		velocity[2].value = clamp(ease(velocity[2].value, velocity[2].target, 40) + stageTilt[1].value / 64, cMaxSpeed);
+		if (airborneFrames > 0)
+		{
+			velocity[1].value = clamp(velocity[1].value - cGravity, cMaxSpeed);
+			--airborneFrames;
+		}
+		else
+		{
+			velocity[1].value = clamp(ease(velocity[1].value, 0, 4) + rng.nextInt(-20, 20), cMaxSpeed);
+		}
+
+		// Player tilt leans into the direction of travel
+		playerTilt[0].target = clamp(velocity[2].value / 4, cMaxPlayerTilt);
+		playerTilt[1].target = clamp(-velocity[1].value / 8, cMaxPlayerTilt);
+		playerTilt[2].target = clamp(-velocity[0].value / 4, cMaxPlayerTilt);
+		for (auto &axis : playerTilt)
+		{
+			axis.value = clamp(ease(axis.value, axis.target, 6), cMaxPlayerTilt);
+		}
+
+		uint32_t flags = cFlagAlwaysSet;
+		if (airborneFrames == 0)
+			flags |= cFlagGrounded;
+		if (std::abs(velocity[0].value) + std::abs(velocity[2].value) > 500)
+			flags |= cFlagMoving;
+		if (frame >= totalTime - 30)
+			flags |= cFlagGoal;
+
+		for (size_t i = 0; i < 3; ++i)
+		{
+			replay.playerPositionDelta[frame][i] = static_cast<int16_t>(velocity[i].value) * ReplayFile::cPlayerPositionDeltaScale;
+			replay.playerTilt[frame][i] = static_cast<int16_t>(playerTilt[i].value) * ReplayFile::cPlayerTiltScale;
+		}
+		// Mostly idle, with the odd small bump
+		if (rng.nextChance(1, 200))
+		{
+			replay.data567[frame][rng.nextInt(0, 2)] = static_cast<int8_t>(rng.nextInt(-2, 2)) * ReplayFile::cData567Scale;
+		}
+		analog = ease(analog, 0, 16);
+		replay.data8[frame] = static_cast<int8_t>(analog) * ReplayFile::cData8Scale;
+		replay.flags[frame] = flags;
+		for (size_t i = 0; i < 2; ++i)
+		{
+			replay.stageTilt[frame][i] = static_cast<int16_t>(stageTilt[i].value) * ReplayFile::cStageTiltScale;
+		}
+	}
+
+	return replay;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+
+#include "smb-replay.hpp"
+
+// Small deterministic PRNG. The standard distributions are implementation defined, so we roll our
+// own to get the same replays from the same seed on every platform and standard library.
+class SplitMix64
+{
+public:
+	explicit SplitMix64(uint64_t seed)
+		: mState(seed)
+	{}
+
+	uint64_t next()
+	{
+		uint64_t z = (mState += 0x9E3779B97F4A7C15ull);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+		return z ^ (z >> 31);
+	}
+
+	// Uniform in [min, max]
+	int32_t nextInt(int32_t min, int32_t max)
+	{
+		uint64_t range = static_cast<uint64_t>(static_cast<int64_t>(max) - min) + 1;
+		return static_cast<int32_t>(min + static_cast<int64_t>(next() % range));
+	}
+
+	bool nextChance(uint32_t numerator, uint32_t denominator)
+	{
+		return next() % denominator < numerator;
+	}
+
+private:
+	uint64_t mState;
+};
+
+// Seed of the replay at the given index of a corpus, independent of generation order
+uint64_t getSyntheticReplaySeed(uint64_t corpusSeed, uint64_t index);
+
+// Builds a replay that decodes like a real one: smooth movement with occasional airborne stretches,
+// tilts that ease towards changing targets within the game's limits, a flags column that follows
+// the movement and zeroed frames after replayTotalTime. Values are generated directly as the stored
+// integers so every column is exactly representable and round trips losslessly.
+ReplayFile generateSyntheticReplay(uint64_t seed);
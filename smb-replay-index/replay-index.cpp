@@ -0,0 +1,522 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "replay-index.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include <boost/filesystem.hpp>
+
+namespace
+{
+
+HeaderFieldType getHeaderFieldType(uint8_t) { return HeaderFieldType::UInt8; }
+HeaderFieldType getHeaderFieldType(uint16_t) { return HeaderFieldType::UInt16; }
+HeaderFieldType getHeaderFieldType(uint32_t) { return HeaderFieldType::UInt32; }
+HeaderFieldType getHeaderFieldType(float) { return HeaderFieldType::Float; }
+
+}
+
+const std::vector<HeaderField> &getHeaderFields()
+{
+	// Same fields as the serializers, at their offsets in the in-memory header
+	static const std::vector<HeaderField> headerFields = []()
+	{
+		std::vector<HeaderField> fields;
+		ReplayFileHeader header = {};
+		const uint8_t *base = reinterpret_cast<const uint8_t *>(&header);
+		forEachField<ReplayFileHeader>([&fields, &header, base](const auto &field)
+		{
+			const uint8_t *member = reinterpret_cast<const uint8_t *>(&(header.*field.member));
+			fields.push_back({ field.name, getHeaderFieldType(header.*field.member), static_cast<size_t>(member - base) });
+		});
+		return fields;
+	}();
+	return headerFields;
+}
+
+const HeaderField *getHeaderField(const std::string &name)
+{
+	for (const auto &field : getHeaderFields())
+	{
+		if (name == field.name)
+		{
+			return &field;
+		}
+	}
+	return nullptr;
+}
+
+double getHeaderFieldValue(const ReplayFileHeader &header, const HeaderField &field)
+{
+	const uint8_t *data = reinterpret_cast<const uint8_t *>(&header) + field.offset;
+	switch (field.type)
+	{
+	case HeaderFieldType::UInt8:
+		return *data;
+	case HeaderFieldType::UInt16:
+	{
+		uint16_t value;
+		memcpy(&value, data, sizeof(value));
+		return value;
+	}
+	case HeaderFieldType::UInt32:
+	{
+		uint32_t value;
+		memcpy(&value, data, sizeof(value));
+		return value;
+	}
+	case HeaderFieldType::Float:
+	{
+		float value;
+		memcpy(&value, data, sizeof(value));
+		return value;
+	}
+	default:
+		return 0.;
+	}
+}
+
+bool ReplayIndex::open(const std::string &filename)
+{
+	namespace bip = boost::interprocess;
+	close();
+	try
+	{
+		mFile = bip::file_mapping(filename.c_str(), bip::read_only);
+		mRegion = bip::mapped_region(mFile, bip::read_only);
+	}
+	catch (const bip::interprocess_exception &)
+	{
+		return false;
+	}
+
+	const char *data = static_cast<const char *>(mRegion.get_address());
+	size_t size = mRegion.get_size();
+	if (size < sizeof(IndexFileHeader))
+	{
+		return false;
+	}
+	const auto *header = reinterpret_cast<const IndexFileHeader *>(data);
+	if (memcmp(header->magic, cIndexMagic, sizeof(cIndexMagic)) != 0
+		|| header->version != cIndexVersion
+		|| header->byteOrderMark != cIndexByteOrderMark
+		|| header->recordSize != sizeof(IndexRecord)
+		|| header->recordsOffset % alignof(IndexRecord) != 0
+		|| header->recordsOffset > size
+		|| header->recordCount > (size - header->recordsOffset) / sizeof(IndexRecord)
+		|| header->stringsOffset > size
+		|| header->stringsSize > size - header->stringsOffset
+		|| header->rootLength > header->stringsSize)
+	{
+		return false;
+	}
+
+	mRecords = reinterpret_cast<const IndexRecord *>(data + header->recordsOffset);
+	mStrings = data + header->stringsOffset;
+	for (size_t i = 0; i < header->recordCount; ++i)
+	{
+		if (mRecords[i].pathOffset > header->stringsSize || mRecords[i].pathLength > header->stringsSize - mRecords[i].pathOffset)
+		{
+			return false;
+		}
+	}
+	mRoot.assign(mStrings, header->rootLength);
+	mHeader = header;
+	return true;
+}
+
+void ReplayIndex::close()
+{
+	namespace bip = boost::interprocess;
+	mRegion = bip::mapped_region();
+	mFile = bip::file_mapping();
+	mHeader = nullptr;
+	mRecords = nullptr;
+	mStrings = nullptr;
+	mRoot.clear();
+}
+
+std::string ReplayIndex::getPath(const IndexRecord &record) const
+{
+	return std::string(mStrings + record.pathOffset, record.pathLength);
+}
+
+namespace
+{
+
+struct IndexEntry
+{
+	std::string path;
+	IndexRecord record;
+};
+
+bool compareIndexKey(const ReplayFileHeader &a, const ReplayFileHeader &b)
+{
+	if (a.levelID != b.levelID)
+		return a.levelID < b.levelID;
+	if (a.levelDifficulty != b.levelDifficulty)
+		return a.levelDifficulty < b.levelDifficulty;
+	return a.levelFloor < b.levelFloor;
+}
+
+// Header decoding only needs the start of GCI and binary files
+size_t getHeaderReadSize(FileFormat format)
+{
+	switch (format)
+	{
+	case FileFormat::GCI:
+		// Worst case RLE takes two bytes per header byte
+		return GCIFile::cReplayDataOffset + sizeof(uint64_t) + 2 * ReplayFile::cHeaderSize;
+	case FileFormat::Binary:
+		return ReplayFile::cHeaderSize;
+	default:
+		return 0;
+	}
+}
+
+bool readReplayHeader(const std::string &filename, FileFormat format, ReplayFileHeader &header)
+{
+	std::vector<uint8_t> data;
+	size_t readSize = getHeaderReadSize(format);
+	if (readSize)
+	{
+		FILE *file = fopen(filename.c_str(), "rb");
+		if (!file)
+		{
+			return false;
+		}
+		data.resize(readSize);
+		data.resize(fread(data.data(), 1, data.size(), file));
+		fclose(file);
+	}
+	else
+	{
+		data = loadFile(filename);
+	}
+
+	try
+	{
+		return decodeReplayHeader(format, data, header);
+	}
+	catch (const std::exception &)
+	{
+		// Malformed JSON
+		return false;
+	}
+}
+
+bool writeIndexFile(const std::string &filename, const std::string &root, FileFormat format, std::vector<IndexEntry> &entries)
+{
+	std::sort(entries.begin(), entries.end(), [](const IndexEntry &a, const IndexEntry &b)
+	{
+		if (compareIndexKey(a.record.header, b.record.header))
+			return true;
+		if (compareIndexKey(b.record.header, a.record.header))
+			return false;
+		return a.path < b.path;
+	});
+
+	std::string strings = root;
+	for (auto &entry : entries)
+	{
+		entry.record.pathOffset = strings.size();
+		entry.record.pathLength = static_cast<uint32_t>(entry.path.size());
+		strings += entry.path;
+	}
+
+	IndexFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, cIndexMagic, sizeof(cIndexMagic));
+	header.version = cIndexVersion;
+	header.byteOrderMark = cIndexByteOrderMark;
+	header.recordSize = sizeof(IndexRecord);
+	header.inputFormat = static_cast<uint32_t>(format);
+	header.recordCount = entries.size();
+	header.recordsOffset = sizeof(IndexFileHeader);
+	header.stringsOffset = header.recordsOffset + entries.size() * sizeof(IndexRecord);
+	header.stringsSize = strings.size();
+	header.rootLength = static_cast<uint32_t>(root.size());
+
+	// Written next to the old index and swapped in, so readers never see half an index
+	std::string temporaryFilename = filename + ".tmp";
+	FILE *file = fopen(temporaryFilename.c_str(), "wb");
+	if (!file)
+	{
+		return false;
+	}
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+	for (const auto &entry : entries)
+	{
+		written = written && fwrite(&entry.record, sizeof(entry.record), 1, file) == 1;
+	}
+	written = written && fwrite(strings.data(), 1, strings.size(), file) == strings.size();
+	written = fclose(file) == 0 && written;
+
+	boost::system::error_code error;
+	if (written)
+	{
+		boost::filesystem::rename(temporaryFilename, filename, error);
+	}
+	if (!written || error)
+	{
+		boost::filesystem::remove(temporaryFilename, error);
+		return false;
+	}
+	return true;
+}
+
+}
+
+bool buildReplayIndex(const std::string &root, FileFormat format, const std::string &indexFilename, unsigned jobs,
+	ReplayIndex *previous, IndexBuildResult &result)
+{
+	namespace fs = boost::filesystem;
+
+	std::vector<IndexEntry> entries;
+	try
+	{
+		for (fs::recursive_directory_iterator it(root), end; it != end; ++it)
+		{
+			if (fs::is_regular_file(it->status()) && getFileFormatByExtension(it->path().string()) == format)
+			{
+				IndexEntry entry;
+				entry.path = fs::relative(it->path(), root).generic_string();
+				memset(&entry.record, 0, sizeof(entry.record));
+				entry.record.fileSize = fs::file_size(it->path());
+				entry.record.modifiedTime = static_cast<int64_t>(fs::last_write_time(it->path()));
+				entries.emplace_back(std::move(entry));
+			}
+		}
+	}
+	catch (const fs::filesystem_error &error)
+	{
+		std::cout << "Failed to read corpus directory: " << error.what() << std::endl;
+		return false;
+	}
+
+	std::unordered_map<std::string, const IndexRecord *> previousRecords;
+	if (previous)
+	{
+		for (const auto &record : *previous)
+		{
+			previousRecords.emplace(previous->getPath(record), &record);
+		}
+	}
+
+	std::atomic<size_t> nextEntry(0);
+	std::atomic<size_t> reused(0);
+	std::vector<uint8_t> valid(entries.size(), 0);
+	auto worker = [&]()
+	{
+		for (size_t i = nextEntry++; i < entries.size(); i = nextEntry++)
+		{
+			auto &entry = entries[i];
+			auto found = previousRecords.find(entry.path);
+			if (found != previousRecords.end()
+				&& found->second->fileSize == entry.record.fileSize
+				&& found->second->modifiedTime == entry.record.modifiedTime)
+			{
+				entry.record.header = found->second->header;
+				valid[i] = 1;
+				++reused;
+			}
+			else
+			{
+				valid[i] = readReplayHeader((fs::path(root) / entry.path).string(), format, entry.record.header);
+			}
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for (unsigned i = 1; i < jobs; ++i)
+	{
+		workers.emplace_back(worker);
+	}
+	worker();
+	for (auto &thread : workers)
+	{
+		thread.join();
+	}
+
+	std::vector<IndexEntry> indexed;
+	indexed.reserve(entries.size());
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		if (valid[i])
+		{
+			indexed.emplace_back(std::move(entries[i]));
+		}
+		else
+		{
+			std::cout << entries[i].path << ": Failed to read replay header!" << std::endl;
+		}
+	}
+	result.indexed = indexed.size();
+	result.reused = reused;
+	result.failed = entries.size() - indexed.size();
+
+	// The new index replaces the file previous is mapped from, which Windows doesn't allow while mapped
+	if (previous)
+	{
+		previous->close();
+	}
+
+	return writeIndexFile(indexFilename, root, format, indexed);
+}
+
+bool parseIndexFilter(const std::string &text, IndexFilter &filter)
+{
+	static const struct
+	{
+		const char *text;
+		FilterOperator op;
+	} operators[] = {
+		// Two character operators first so "<=" isn't taken for "<"
+		{ "==", FilterOperator::Equal },
+		{ "!=", FilterOperator::NotEqual },
+		{ "<=", FilterOperator::LessEqual },
+		{ ">=", FilterOperator::GreaterEqual },
+		{ "=", FilterOperator::Equal },
+		{ "<", FilterOperator::Less },
+		{ ">", FilterOperator::Greater },
+	};
+	for (const auto &candidate : operators)
+	{
+		auto position = text.find(candidate.text);
+		if (position == std::string::npos)
+		{
+			continue;
+		}
+		filter.field = getHeaderField(text.substr(0, position));
+		filter.op = candidate.op;
+		try
+		{
+			std::string value = text.substr(position + strlen(candidate.text));
+			size_t parsed = 0;
+			filter.value = value.compare(0, 2, "0x") == 0 ? std::stoul(value, &parsed, 16) : std::stod(value, &parsed);
+			return filter.field && parsed == value.size();
+		}
+		catch (const std::exception &)
+		{
+			return false;
+		}
+	}
+	return false;
+}
+
+namespace
+{
+
+// Sort key of an index record at each depth of the levelID, levelDifficulty, levelFloor order
+uint8_t getKeyValue(const IndexRecord &record, size_t depth)
+{
+	return depth == 0 ? record.header.levelID : depth == 1 ? record.header.levelDifficulty : record.header.levelFloor;
+}
+
+uint8_t getKeyValue(uint8_t value, size_t)
+{
+	return value;
+}
+
+bool matchesFilter(const ReplayFileHeader &header, const IndexFilter &filter)
+{
+	double value = getHeaderFieldValue(header, *filter.field);
+	switch (filter.op)
+	{
+	case FilterOperator::Equal:
+		return value == filter.value;
+	case FilterOperator::NotEqual:
+		return value != filter.value;
+	case FilterOperator::Less:
+		return value < filter.value;
+	case FilterOperator::LessEqual:
+		return value <= filter.value;
+	case FilterOperator::Greater:
+		return value > filter.value;
+	case FilterOperator::GreaterEqual:
+		return value >= filter.value;
+	default:
+		return false;
+	}
+}
+
+}
+
+std::vector<const IndexRecord *> queryReplayIndex(const ReplayIndex &index, const std::vector<IndexFilter> &filters,
+	const HeaderField *sortField, bool descending, size_t limit)
+{
+	// Narrow down to the range with the requested levelID, then levelDifficulty, then levelFloor,
+	// as far as there are equality filters for them
+	const IndexRecord *first = index.begin();
+	const IndexRecord *last = index.end();
+	const char *keyFields[] = { "levelID", "levelDifficulty", "levelFloor" };
+	ReplayFileHeader key;
+	memset(&key, 0, sizeof(key));
+	for (size_t depth = 0; depth < 3; ++depth)
+	{
+		const IndexFilter *keyFilter = nullptr;
+		for (const auto &filter : filters)
+		{
+			if (filter.op == FilterOperator::Equal && !strcmp(filter.field->name, keyFields[depth]))
+			{
+				keyFilter = &filter;
+			}
+		}
+		if (!keyFilter || keyFilter->value < 0. || keyFilter->value > 255. || keyFilter->value != static_cast<uint8_t>(keyFilter->value))
+		{
+			break;
+		}
+		uint8_t value = static_cast<uint8_t>(keyFilter->value);
+		auto range = std::equal_range(first, last, value, [depth](const auto &a, const auto &b)
+		{
+			return getKeyValue(a, depth) < getKeyValue(b, depth);
+		});
+		first = range.first;
+		last = range.second;
+	}
+
+	std::vector<const IndexRecord *> matches;
+	for (const IndexRecord *record = first; record != last; ++record)
+	{
+		bool matched = true;
+		for (const auto &filter : filters)
+		{
+			matched = matched && matchesFilter(record->header, filter);
+		}
+		if (matched)
+		{
+			matches.push_back(record);
+		}
+	}
+
+	if (sortField)
+	{
+		auto compare = [sortField, descending](const IndexRecord *a, const IndexRecord *b)
+		{
+			double valueA = getHeaderFieldValue(a->header, *sortField);
+			double valueB = getHeaderFieldValue(b->header, *sortField);
+			return descending ? valueA > valueB : valueA < valueB;
+		};
+		// Top k only needs the first k in order
+		if (limit && limit < matches.size())
+		{
+			std::partial_sort(matches.begin(), matches.begin() + limit, matches.end(), compare);
+		}
+		else
+		{
+			std::stable_sort(matches.begin(), matches.end(), compare);
+		}
+	}
+	if (limit && limit < matches.size())
+	{
+		matches.resize(limit);
+	}
+	return matches;
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "smb-replay.hpp"
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+// Index file layout, in the byte order of the machine that wrote it:
+//   IndexFileHeader
+//   recordCount IndexRecords sorted by levelID, levelDifficulty, levelFloor, path
+//   string table: corpus root, then the path of every record relative to it
+// Records are fixed size so the file can be mapped and searched in place.
+
+struct IndexFileHeader
+{
+	char magic[8];
+	uint32_t version;
+	// cIndexByteOrderMark as written, an index from a machine with the other byte order has to be rebuilt
+	uint32_t byteOrderMark;
+	uint32_t recordSize;
+	uint32_t inputFormat;
+	uint64_t recordCount;
+	uint64_t recordsOffset;
+	uint64_t stringsOffset;
+	uint64_t stringsSize;
+	uint32_t rootLength;
+	uint32_t reserved;
+};
+
+struct IndexRecord
+{
+	ReplayFileHeader header;
+	uint32_t pathLength;
+	uint64_t pathOffset;
+	// Used to tell which files changed when updating
+	uint64_t fileSize;
+	int64_t modifiedTime;
+};
+
+static_assert(sizeof(IndexFileHeader) == 64, "index header layout changed");
+static_assert(sizeof(ReplayFileHeader) == 0x44, "replay header layout changed");
+static_assert(sizeof(IndexRecord) == 96, "index record layout changed");
+
+static const char cIndexMagic[8] = { 'S', 'M', 'B', 'R', 'I', 'D', 'X', 0 };
+static const uint32_t cIndexVersion = 1;
+static const uint32_t cIndexByteOrderMark = 0x01020304;
+
+enum class HeaderFieldType
+{
+	UInt8,
+	UInt16,
+	UInt32,
+	Float,
+};
+
+// Header fields by name for filtering and sorting
+struct HeaderField
+{
+	const char *name;
+	HeaderFieldType type;
+	size_t offset;
+};
+
+const std::vector<HeaderField> &getHeaderFields();
+const HeaderField *getHeaderField(const std::string &name);
+double getHeaderFieldValue(const ReplayFileHeader &header, const HeaderField &field);
+
+// Read only view of an index file, mapped into memory
+class ReplayIndex
+{
+public:
+	bool open(const std::string &filename);
+	void close();
+
+	const std::string &getRoot() const { return mRoot; }
+	FileFormat getFormat() const { return static_cast<FileFormat>(mHeader->inputFormat); }
+	size_t size() const { return mHeader ? static_cast<size_t>(mHeader->recordCount) : 0; }
+	const IndexRecord *begin() const { return mRecords; }
+	const IndexRecord *end() const { return mRecords + size(); }
+	std::string getPath(const IndexRecord &record) const;
+
+private:
+	boost::interprocess::file_mapping mFile;
+	boost::interprocess::mapped_region mRegion;
+	const IndexFileHeader *mHeader = nullptr;
+	const IndexRecord *mRecords = nullptr;
+	const char *mStrings = nullptr;
+	std::string mRoot;
+};
+
+struct IndexBuildResult
+{
+	size_t indexed = 0;
+	size_t reused = 0;
+	size_t failed = 0;
+};
+
+// Scans every file of format below root and writes an index of their headers. Files that are in
+// previous with the same size and modification time are taken from there instead of read again.
+// previous is closed before the new index is written.
+bool buildReplayIndex(const std::string &root, FileFormat format, const std::string &indexFilename, unsigned jobs,
+	ReplayIndex *previous, IndexBuildResult &result);
+
+enum class FilterOperator
+{
+	Equal,
+	NotEqual,
+	Less,
+	LessEqual,
+	Greater,
+	GreaterEqual,
+};
+
+struct IndexFilter
+{
+	const HeaderField *field = nullptr;
+	FilterOperator op = FilterOperator::Equal;
+	double value = 0.;
+};
+
+// Parses field==value, field!=value, field<value etc. The value may be hex.
+bool parseIndexFilter(const std::string &text, IndexFilter &filter);
+
+// Records matching all filters, ordered by sortField (index order if null), at most limit of them
+// if limit is not 0. Equality filters on the leading sort keys narrow the search with a binary search.
+std::vector<const IndexRecord *> queryReplayIndex(const ReplayIndex &index, const std::vector<IndexFilter> &filters,
+	const HeaderField *sortField, bool descending, size_t limit);
@@ -0,0 +1,203 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <sstream>
+
+#include "smb-replay.hpp"
+#include "replay-index.hpp"
+
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+
+namespace
+{
+
+void printUsage(const boost::program_options::options_description &optionDescription)
+{
+	std::cout << "Usage:" << std::endl
+		<< "  smb-replay-index build <corpus directory> <index file> [-i format] [-j jobs]" << std::endl
+		<< "  smb-replay-index update <index file> [-j jobs]" << std::endl
+		<< "  smb-replay-index query <index file> [-w filter]... [-s field] [--desc] [-n limit] [-f fields]" << std::endl
+		<< std::endl
+		<< "Filters look like levelID==3, timeWithScore>=1000 or flags!=0x1 and must all match." << std::endl
+		<< std::endl;
+	optionDescription.print(std::cout);
+}
+
+std::vector<std::string> splitFields(const std::string &text)
+{
+	std::vector<std::string> fields;
+	std::stringstream stream(text);
+	std::string field;
+	while (std::getline(stream, field, ','))
+	{
+		fields.push_back(field);
+	}
+	return fields;
+}
+
+int runQuery(const std::string &indexFilename, const boost::program_options::variables_map &varMap)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<IndexFilter> filters;
+	if (varMap.count("where"))
+	{
+		for (const auto &text : varMap.at("where").as<std::vector<std::string>>())
+		{
+			IndexFilter filter;
+			if (!parseIndexFilter(text, filter))
+			{
+				std::cout << "Invalid filter " << text << "!" << std::endl;
+				return -1;
+			}
+			filters.push_back(filter);
+		}
+	}
+
+	const HeaderField *sortField = nullptr;
+	if (varMap.count("sort"))
+	{
+		sortField = getHeaderField(varMap.at("sort").as<std::string>());
+		if (!sortField)
+		{
+			std::cout << "Unknown sort field!" << std::endl;
+			return -1;
+		}
+	}
+
+	std::vector<const HeaderField *> outputFields;
+	for (const auto &name : splitFields(varMap.at("fields").as<std::string>()))
+	{
+		const HeaderField *field = getHeaderField(name);
+		if (!field)
+		{
+			std::cout << "Unknown field " << name << "!" << std::endl;
+			return -1;
+		}
+		outputFields.push_back(field);
+	}
+
+	ReplayIndex index;
+	if (!index.open(indexFilename))
+	{
+		std::cout << "Failed to open index file!" << std::endl;
+		return -1;
+	}
+
+	auto matches = queryReplayIndex(index, filters, sortField, varMap.count("desc") > 0, varMap.at("limit").as<size_t>());
+
+	std::cout << "path";
+	for (const auto *field : outputFields)
+	{
+		std::cout << '\t' << field->name;
+	}
+	std::cout << '\n';
+	for (const auto *record : matches)
+	{
+		std::cout << index.getPath(*record);
+		for (const auto *field : outputFields)
+		{
+			std::cout << '\t' << getHeaderFieldValue(record->header, *field);
+		}
+		std::cout << '\n';
+	}
+
+	auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+	std::cerr << matches.size() << " of " << index.size() << " replays in " << elapsed.count() / 1000. << " ms" << std::endl;
+	return 0;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	namespace po = boost::program_options;
+	po::options_description optionDescription("Valid options");
+	optionDescription.add_options()
+		("help",												"print usage")
+		("in-format,i",		po::value<std::string>()->default_value("gci"), "format of the corpus files (binary, gci, json), for build")
+		("jobs,j",			po::value<unsigned>()->default_value(std::max(1u, std::thread::hardware_concurrency())), "number of threads reading headers")
+		("where,w",			po::value<std::vector<std::string>>(), "filter on a header field, for query")
+		("sort,s",			po::value<std::string>(),			"header field to sort by, for query")
+		("desc",												"sort descending")
+		("limit,n",			po::value<size_t>()->default_value(0), "return at most this many replays, 0 for all")
+		("fields,f",		po::value<std::string>()->default_value("levelID,levelDifficulty,levelFloor,timeWithScore,scorePoints"), "comma separated header fields to print")
+		("command",			po::value<std::string>(),			"build, update or query")
+		("args",			po::value<std::vector<std::string>>(), "command arguments");
+	po::positional_options_description positionalOptionDescription;
+	positionalOptionDescription.add("command", 1);
+	positionalOptionDescription.add("args", -1);
+
+	po::variables_map varMap;
+	try
+	{
+		po::store(po::command_line_parser(argc, argv)
+			.options(optionDescription)
+			.positional(positionalOptionDescription).run(), varMap);
+		po::notify(varMap);
+	}
+	catch (const boost::exception &)
+	{
+		printUsage(optionDescription);
+		return 1;
+	}
+
+	std::vector<std::string> args;
+	if (varMap.count("args"))
+	{
+		args = varMap.at("args").as<std::vector<std::string>>();
+	}
+	std::string command = varMap.count("command") ? varMap.at("command").as<std::string>() : "";
+	if (varMap.count("help") || varMap.at("jobs").as<unsigned>() == 0
+		|| !((command == "build" && args.size() == 2) || (command == "update" && args.size() == 1) || (command == "query" && args.size() == 1)))
+	{
+		printUsage(optionDescription);
+		return 1;
+	}
+
+	if (command == "query")
+	{
+		return runQuery(args[0], varMap);
+	}
+
+	IndexBuildResult result;
+	bool built;
+	auto start = std::chrono::steady_clock::now();
+	if (command == "build")
+	{
+		FileFormat format = getFileFormatByName(varMap.at("in-format").as<std::string>());
+		if (format == FileFormat::Unknown)
+		{
+			std::cout << "Unknown input format!" << std::endl;
+			return -1;
+		}
+		// Absolute so updates work from any directory
+		std::string root = boost::filesystem::absolute(args[0]).generic_string();
+		built = buildReplayIndex(root, format, args[1], varMap.at("jobs").as<unsigned>(), nullptr, result);
+	}
+	else
+	{
+		ReplayIndex previous;
+		if (!previous.open(args[0]))
+		{
+			std::cout << "Failed to open index file!" << std::endl;
+			return -1;
+		}
+		std::string root = previous.getRoot();
+		built = buildReplayIndex(root, previous.getFormat(), args[0], varMap.at("jobs").as<unsigned>(), &previous, result);
+	}
+	if (!built)
+	{
+		std::cout << "Failed to write index file!" << std::endl;
+		return -1;
+	}
+
+	auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+	std::cout << "Indexed " << result.indexed << " replays (" << result.indexed - result.reused << " read, " << result.reused << " unchanged), "
+		<< result.failed << " failed in " << elapsed.count() << " ms" << std::endl;
+	return result.failed ? -1 : 0;
+}
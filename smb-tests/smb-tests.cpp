@@ -0,0 +1,610 @@
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <chrono>
+#include <csignal>
+#include <future>
+#include <thread>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#endif
+
+#include <boost/filesystem.hpp>
+
+#include "smb-replay.hpp"
+#include "metrics.hpp"
+#include "server.hpp"
+#include "tar-archive.hpp"
+using json = nlohmann::json;
+
+// Regression tests for malformed and unusual input, run by ctest
+
+namespace
+{
+
+int gFailures = 0;
+
+void check(bool condition, const std::string &test, const std::string &message)
+{
+	if (!condition)
+	{
+		std::cout << test << ": " << message << std::endl;
+		++gFailures;
+	}
+}
+
+// A replay as JSON text, with edit applied to the parsed document first
+std::string getReplayJSON(const std::function<void(json &)> &edit)
+{
+	// An all zero binary replay has every column at full length
+	ReplayFile replay;
+	decodeReplay(FileFormat::Binary, std::vector<uint8_t>(ReplayFile::cBinarySize), replay);
+	std::vector<uint8_t> buffer;
+	encodeReplay(FileFormat::JSON, replay, EncodeOptions(), buffer);
+	json document = json::parse(buffer.begin(), buffer.end());
+	edit(document["root"]);
+	return document.dump();
+}
+
+BufferView getView(const std::string &text)
+{
+	return BufferView(reinterpret_cast<const uint8_t *>(text.data()), text.size());
+}
+
+void testShortJSONFrames()
+{
+	const std::string test = "short-json-frames";
+	// Frames with fewer values than the column has dimensions
+	std::string text = getReplayJSON([](json &root)
+	{
+		root["playerTilt"] = json::array();
+		for (int i = 0; i < 10; ++i)
+		{
+			root["playerTilt"].push_back({ 0.5f });
+		}
+		root["stageTilt"] = { json::array(), { 0.25f } };
+	});
+	ReplayFile replay;
+	check(decodeReplay(FileFormat::JSON, getView(text), replay), test, "decode failed");
+
+	std::vector<uint8_t> binary;
+	check(encodeReplay(FileFormat::Binary, replay, EncodeOptions(), binary), test, "encode failed");
+	ReplayFile decoded;
+	check(decodeReplay(FileFormat::Binary, binary, decoded), test, "binary decode failed");
+	check(decoded.playerTilt.size() == ReplayFile::cChunkSize && decoded.stageTilt.size() == ReplayFile::cChunkSize, test, "wrong frame count");
+	if (decoded.playerTilt.size() == ReplayFile::cChunkSize && decoded.stageTilt.size() == ReplayFile::cChunkSize)
+	{
+		check(decoded.playerTilt[0][0] != 0.f, test, "value lost");
+		check(decoded.playerTilt[0][1] == 0.f && decoded.playerTilt[0][2] == 0.f, test, "missing values not zero");
+		check(decoded.stageTilt[0][0] == 0.f && decoded.stageTilt[0][1] == 0.f, test, "empty frame not zero");
+		check(decoded.stageTilt[1][0] != 0.f && decoded.stageTilt[1][1] == 0.f, test, "short frame not padded");
+	}
+}
+
+void testHugeDecompressedSize()
+{
+	const std::string test = "huge-decompressed-size";
+	ReplayFile replay;
+	decodeReplay(FileFormat::Binary, std::vector<uint8_t>(ReplayFile::cBinarySize), replay);
+	std::vector<uint8_t> gci;
+	EncodeOptions options;
+	options.gciFilename = "test";
+	check(encodeReplay(FileFormat::GCI, replay, options, gci), test, "encode failed");
+	check(decodeReplay(FileFormat::GCI, gci, replay), test, "decode of the intact GCI failed");
+
+	// A size no payload expands to has to fail as bad data, not try to allocate it
+	writeBigEndian(&gci[GCIFile::cReplayDataOffset], ~static_cast<uint64_t>(0) >> 1);
+	bool decoded = true;
+	try
+	{
+		decoded = decodeReplay(FileFormat::GCI, gci, replay);
+	}
+	catch (const std::exception &)
+	{
+		check(false, test, "decode threw");
+	}
+	check(!decoded, test, "corrupt GCI decoded");
+}
+
+
+void testReusedReplayJSON()
+{
+	const std::string test = "reused-replay-json";
+	std::string full = getReplayJSON([](json &root)
+	{
+		for (auto &value : root["data8"])
+		{
+			value = 0.5f;
+		}
+		for (auto &value : root["flags"])
+		{
+			value = 3;
+		}
+	});
+	std::string shortArrays = getReplayJSON([](json &root)
+	{
+		root["data8"] = { 0.25f };
+		root["flags"] = { 1 };
+	});
+
+	// A replay reused after a longer one has to decode the same as a fresh one
+	ReplayFile reused;
+	check(decodeReplay(FileFormat::JSON, getView(full), reused), test, "decode failed");
+	check(decodeReplay(FileFormat::JSON, getView(shortArrays), reused), test, "decode failed");
+	ReplayFile fresh;
+	check(decodeReplay(FileFormat::JSON, getView(shortArrays), fresh), test, "decode failed");
+	check(reused.data8 == fresh.data8, test, "data8 kept values of the last replay");
+	check(reused.flags == fresh.flags, test, "flags kept values of the last replay");
+}
+
+
+// Smallest RLE size by trying every tag length at every position
+size_t getMinimalRLESize(const std::vector<uint8_t> &data)
+{
+	std::vector<size_t> cost(data.size() + 1, ~static_cast<size_t>(0));
+	cost[0] = 0;
+	for (size_t i = 1; i <= data.size(); ++i)
+	{
+		bool run = true;
+		for (size_t length = 1; length <= std::min<size_t>(i, 0x7F); ++length)
+		{
+			run = run && data[i - length] == data[i - 1];
+			cost[i] = std::min(cost[i], cost[i - length] + std::min(length + 1, run ? size_t(2) : length + 1));
+		}
+	}
+	return cost[data.size()];
+}
+
+void checkOptimalRLE(const std::vector<uint8_t> &data, const std::string &test, const std::string &name)
+{
+	std::vector<uint8_t> compressed = compressBufferRLEOptimal(data);
+	check(decompressBufferRLE(compressed, data.size()) == data, test, name + ": doesn't decode to the input");
+	check(compressed.size() <= compressBufferRLE(data).size(), test, name + ": bigger than greedy");
+	check(compressed.size() == getMinimalRLESize(data), test, name + ": not minimal");
+}
+
+void testOptimalRLE()
+{
+	const std::string test = "optimal-rle";
+	checkOptimalRLE({}, test, "empty");
+	for (size_t length : { 1, 2, 3, 127, 128, 129, 254, 255 })
+	{
+		checkOptimalRLE(std::vector<uint8_t>(length, 7), test, "run of " + std::to_string(length));
+		std::vector<uint8_t> between(length, 7);
+		between.insert(between.begin(), 1);
+		between.push_back(2);
+		checkOptimalRLE(between, test, "run of " + std::to_string(length) + " between literals");
+	}
+	std::vector<uint8_t> literalThenRun;
+	for (size_t i = 0; i < 127; ++i)
+	{
+		literalThenRun.push_back(static_cast<uint8_t>(i));
+	}
+	literalThenRun.insert(literalThenRun.end(), 3, 200);
+	checkOptimalRLE(literalThenRun, test, "127 byte literal and a run");
+
+	// Run heavy data with short runs and literals mixed in, where greedy choices go wrong
+	std::mt19937 random(1);
+	for (int i = 0; i < 2000; ++i)
+	{
+		std::vector<uint8_t> data;
+		size_t pieces = random() % 40;
+		for (size_t j = 0; j < pieces; ++j)
+		{
+			size_t length = random() % 4 ? random() % 5 + 1 : random() % 300 + 1;
+			data.insert(data.end(), length, static_cast<uint8_t>(random() % 3));
+		}
+		checkOptimalRLE(data, test, "random buffer " + std::to_string(i));
+	}
+}
+
+std::vector<uint8_t> getTestData(size_t size)
+{
+	std::vector<uint8_t> data(size);
+	for (size_t i = 0; i < size; ++i)
+	{
+		data[i] = static_cast<uint8_t>(i * 7);
+	}
+	return data;
+}
+
+// Single columns decode to what the whole replay decodes to
+void testColumnDecode()
+{
+	const std::string test = "column-decode";
+	std::vector<uint8_t> binary = getTestData(ReplayFile::cBinarySize);
+	ReplayFile full;
+	decodeReplay(FileFormat::Binary, binary, full);
+	forEachColumn([&](const auto &column, auto)
+	{
+		ReplayFile partial;
+		check(deserializeBinaryColumn(binary, column.name, partial), test, std::string(column.name) + " not found");
+		check(partial.*column.member == full.*column.member, test, std::string(column.name) + " differs");
+	});
+	ReplayFile partial;
+	check(!deserializeBinaryColumn(binary, "header", partial), test, "unknown column decoded");
+	check(!deserializeBinaryColumn(BufferView(binary.data(), binary.size() - 1), "flags", partial), test, "short buffer decoded");
+
+	// What the metrics read is all they need, from a GCI too
+	std::vector<uint8_t> gci;
+	EncodeOptions options;
+	options.gciFilename = "test";
+	encodeReplay(FileFormat::GCI, full, options, gci);
+	check(decodeReplayColumns(FileFormat::GCI, gci, getReplayMetricsColumns(), partial), test, "GCI columns not decoded");
+	ReplayMetrics fullMetrics, partialMetrics;
+	computeReplayMetrics(full, fullMetrics);
+	computeReplayMetrics(partial, partialMetrics);
+	check(partialMetrics.frames == fullMetrics.frames && partialMetrics.pathLength == fullMetrics.pathLength
+		&& std::equal(partialMetrics.flagFrames, partialMetrics.flagFrames + 32, fullMetrics.flagFrames), test, "metrics differ");
+}
+
+// Batches of four run the lanes together up to the shortest buffer and finish each alone
+void testBatchedCRC()
+{
+	const std::string test = "batched-crc";
+	std::string checkText = "123456789";
+	check(getCRCForBuffer(getView(checkText)) == 0xD64E, test, "wrong check value");
+
+	std::vector<std::vector<uint8_t>> buffers;
+	for (size_t size : { 0, 1, 100, 7, 300, 300, 2, 5000, 1, 64 })
+	{
+		buffers.push_back(getTestData(size));
+		std::reverse(buffers.back().begin(), buffers.back().end());
+	}
+	std::vector<const uint8_t *> data;
+	std::vector<size_t> sizes;
+	for (const auto &buffer : buffers)
+	{
+		data.push_back(buffer.data());
+		sizes.push_back(buffer.size());
+	}
+	std::vector<uint16_t> checksums(buffers.size());
+	getCRCForBuffers(data.data(), sizes.data(), buffers.size(), checksums.data());
+	for (size_t i = 0; i < buffers.size(); ++i)
+	{
+		CRCState state;
+		state.update(buffers[i].data(), buffers[i].size());
+		check(checksums[i] == state.get() && checksums[i] == getCRCForBuffer(buffers[i]), test, "buffer " + std::to_string(i) + " differs");
+	}
+}
+
+std::string getTemporaryPath(const std::string &name)
+{
+	return (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("smb-tests-%%%%%%%%-" + name)).string();
+}
+
+// A raw ustar header, for archives TarWriter doesn't write
+std::vector<uint8_t> getTarHeader(const std::string &name, char type, uint64_t size)
+{
+	std::vector<uint8_t> header(512);
+	char *text = reinterpret_cast<char *>(header.data());
+	memcpy(text, name.data(), std::min<size_t>(name.size(), 100));
+	snprintf(text + 100, 8, "%07o", 0644);
+	snprintf(text + 124, 12, "%011llo", static_cast<unsigned long long>(size));
+	text[156] = type;
+	memcpy(text + 257, "ustar", 6);
+	memcpy(text + 263, "00", 2);
+	memset(text + 148, ' ', 8);
+	unsigned checksum = 0;
+	for (uint8_t c : header)
+	{
+		checksum += c;
+	}
+	snprintf(text + 148, 8, "%06o", checksum);
+	return header;
+}
+
+void appendTarMember(std::vector<uint8_t> &archive, const std::string &name, char type, const std::string &data)
+{
+	std::vector<uint8_t> header = getTarHeader(name, type, data.size());
+	archive.insert(archive.end(), header.begin(), header.end());
+	archive.insert(archive.end(), data.begin(), data.end());
+	archive.resize((archive.size() + 511) / 512 * 512);
+}
+
+// "<length> path=<path>\n" where length counts itself
+std::string getPaxPathRecord(const std::string &path)
+{
+	std::string rest = " path=" + path + "\n";
+	size_t length = rest.size() + 1;
+	while (std::to_string(length).size() + rest.size() != length)
+	{
+		++length;
+	}
+	return std::to_string(length) + rest;
+}
+
+// Reads every member of an archive, false if that failed
+bool readTar(TarReader &reader, std::vector<std::string> &names, std::vector<std::vector<uint8_t>> &data)
+{
+	TarMember member;
+	while (reader.next(member))
+	{
+		names.push_back(member.name);
+		data.emplace_back();
+		if (!reader.readData(data.back()))
+		{
+			return false;
+		}
+	}
+	return !reader.hasFailed();
+}
+
+bool readTar(const std::vector<uint8_t> &archive, std::vector<std::string> &names, std::vector<std::vector<uint8_t>> &data)
+{
+	std::string path = getTemporaryPath("archive.tar");
+	TarReader reader;
+	bool read = saveFile(path, archive) && reader.open(path) && readTar(reader, names, data);
+	reader.close();
+	boost::filesystem::remove(path);
+	return read;
+}
+
+void testTarLongNames()
+{
+	const std::string test = "tar-long-names";
+	// Split into the ustar prefix, too long a file name for that, and 247 characters in all
+	std::string prefixed = std::string(120, 'd') + "/" + std::string(20, 'f') + ".gci";
+	std::string gnu = std::string(100, 'd') + "/" + std::string(142, 'f') + ".gci";
+	std::vector<uint8_t> firstData = getTestData(1000);
+	std::vector<uint8_t> secondData = getTestData(512);
+
+	std::string path = getTemporaryPath("long-names.tar");
+	TarWriter writer;
+	check(writer.open(path) && writer.addFile(prefixed, firstData) && writer.addFile(gnu, secondData) && writer.close(), test, "write failed");
+	std::vector<uint8_t> archive = loadFile(path);
+	boost::filesystem::remove(path);
+	std::vector<std::string> names;
+	std::vector<std::vector<uint8_t>> data;
+	check(readTar(archive, names, data), test, "ustar/GNU read failed");
+	check(names == std::vector<std::string>{ prefixed, gnu }, test, "ustar/GNU names wrong");
+	check(data == std::vector<std::vector<uint8_t>>{ firstData, secondData }, test, "ustar/GNU data wrong");
+
+	// pax names the next member, whatever its own header says
+	std::string pax = std::string(200, 'p') + "/" + std::string(42, 'f') + ".gci";
+	archive.clear();
+	appendTarMember(archive, "PaxHeaders/x", 'x', getPaxPathRecord(pax));
+	appendTarMember(archive, "short.gci", '0', "abc");
+	appendTarMember(archive, "next.gci", '0', "de");
+	archive.resize(archive.size() + 1024);
+	names.clear();
+	data.clear();
+	check(readTar(archive, names, data), test, "pax read failed");
+	check(names == std::vector<std::string>{ pax, "next.gci" }, test, "pax names wrong");
+	check(data.size() == 2 && data[0] == stringToBuffer("abc") && data[1] == stringToBuffer("de"), test, "pax data wrong");
+}
+
+void testBrokenTar()
+{
+	const std::string test = "broken-tar";
+	std::vector<std::string> names;
+	std::vector<std::vector<uint8_t>> data;
+
+	// Ends in the middle of the data
+	std::vector<uint8_t> archive;
+	appendTarMember(archive, "a.gci", '0', std::string(2000, 'a'));
+	archive.resize(512 + 1000);
+	check(!readTar(archive, names, data), test, "truncated archive read");
+
+	// Its header promises more than the archive holds, whether the data is read or skipped
+	archive = getTarHeader("big.gci", '0', 1024 * 1024);
+	archive.resize(archive.size() + 10);
+	names.clear();
+	data.clear();
+	check(!readTar(archive, names, data), test, "oversized member read");
+	std::string path = getTemporaryPath("oversized.tar");
+	saveFile(path, archive);
+	TarReader reader;
+	TarMember member;
+	check(reader.open(path) && reader.next(member) && member.size == 1024 * 1024, test, "oversized member header not read");
+	check(!reader.next(member) && reader.hasFailed(), test, "oversized member skipped");
+	reader.close();
+	boost::filesystem::remove(path);
+
+	// More than any archive member may be, in base 256
+	archive = getTarHeader("huge.gci", '0', 0);
+	archive[124] = 0x80;
+	archive[126] = 0x10;
+	memset(&archive[148], ' ', 8);
+	unsigned checksum = 0;
+	for (uint8_t c : archive)
+	{
+		checksum += c;
+	}
+	snprintf(reinterpret_cast<char *>(&archive[148]), 8, "%06o", checksum);
+	archive.resize(archive.size() + 1024);
+	names.clear();
+	data.clear();
+	check(!readTar(archive, names, data) && names.empty(), test, "huge member accepted");
+
+	// A bad checksum
+	archive.clear();
+	appendTarMember(archive, "a.gci", '0', "abc");
+	archive[0] = 'b';
+	names.clear();
+	data.clear();
+	check(!readTar(archive, names, data) && names.empty(), test, "bad checksum accepted");
+}
+
+#ifndef _WIN32
+// Standard input can't seek, so unread members are skipped by reading past them
+void testTarFromStdin()
+{
+	const std::string test = "tar-from-stdin";
+	std::vector<uint8_t> archive;
+	appendTarMember(archive, "skipped.gci", '0', std::string(5000, 's'));
+	appendTarMember(archive, "read.gci", '0', "read");
+	archive.resize(archive.size() + 1024);
+
+	int pipeFds[2];
+	if (pipe(pipeFds) != 0 || dup2(pipeFds[0], 0) < 0)
+	{
+		check(false, test, "no pipe");
+		return;
+	}
+	close(pipeFds[0]);
+	std::thread feeder([&]()
+	{
+		ssize_t written = write(pipeFds[1], archive.data(), archive.size());
+		(void)written;
+		close(pipeFds[1]);
+	});
+
+	TarReader reader;
+	TarMember member;
+	std::vector<uint8_t> data;
+	check(reader.open("-"), test, "open failed");
+	check(reader.next(member) && member.name == "skipped.gci", test, "first member wrong");
+	check(reader.next(member) && member.name == "read.gci" && reader.readData(data) && data == stringToBuffer("read"), test, "second member wrong");
+	check(!reader.next(member) && !reader.hasFailed(), test, "end not found");
+	reader.close();
+	feeder.join();
+}
+#endif
+
+#ifndef _WIN32
+int connectToServer(const std::string &socketPath)
+{
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	memcpy(address.sun_path, socketPath.c_str(), socketPath.size());
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// A GCI to pretty JSON request, the response is much bigger than a socket buffer
+std::vector<uint8_t> getServerRequest()
+{
+	ReplayFile replay;
+	decodeReplay(FileFormat::Binary, std::vector<uint8_t>(ReplayFile::cBinarySize), replay);
+	std::vector<uint8_t> gci;
+	EncodeOptions options;
+	options.gciFilename = "test";
+	encodeReplay(FileFormat::GCI, replay, options, gci);
+
+	std::vector<uint8_t> request(16);
+	uint32_t size = static_cast<uint32_t>(12 + gci.size());
+	memcpy(&request[0], &size, 4);
+	request[4] = 2;
+	request[5] = 3;
+	request[6] = 0x1;
+	request.insert(request.end(), gci.begin(), gci.end());
+	return request;
+}
+
+// Pipelines requests without ever reading a response
+int connectStalledClient(const std::string &socketPath, const std::vector<uint8_t> &request)
+{
+	int fd = connectToServer(socketPath);
+	if (fd < 0)
+	{
+		return -1;
+	}
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	for (int i = 0; i < 40; ++i)
+	{
+		if (send(fd, request.data(), request.size(), 0) < 0)
+		{
+			break;
+		}
+	}
+	return fd;
+}
+
+// A client that stops reading its responses must neither starve the others nor keep the server
+// from stopping
+void testStalledServerClient()
+{
+	const std::string test = "stalled-server-client";
+	std::string socketPath = "/tmp/smb-tests-" + std::to_string(getpid()) + ".sock";
+	std::promise<bool> served;
+	std::future<bool> serverResult = served.get_future();
+	std::thread server([&]()
+	{
+		served.set_value(serveConversions(socketPath, 1, nullptr));
+	});
+	server.detach();
+
+	int probe = -1;
+	for (int i = 0; i < 100 && probe < 0; ++i)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		probe = connectToServer(socketPath);
+	}
+	check(probe >= 0, test, "server didn't start");
+	close(probe);
+	check(!serveConversions(socketPath, 1, nullptr), test, "second server took over the socket");
+
+	std::vector<uint8_t> request = getServerRequest();
+	int stalled = connectStalledClient(socketPath, request);
+	check(stalled >= 0, test, "stalled client didn't connect");
+	std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+	// Answered once the worker gives up on the stalled client
+	int client = connectToServer(socketPath);
+	check(client >= 0, test, "client didn't connect");
+	timeval timeout = { 30, 0 };
+	setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	check(send(client, request.data(), request.size(), 0) == static_cast<ssize_t>(request.size()), test, "request not sent");
+	uint8_t response[8] = {};
+	check(recv(client, response, sizeof(response), MSG_WAITALL) == sizeof(response) && response[4] == 0, test, "no response while another client stalled");
+	close(client);
+	close(stalled);
+
+	// Stopping with the only worker blocked on a client that reads nothing
+	stalled = connectStalledClient(socketPath, request);
+	std::this_thread::sleep_for(std::chrono::milliseconds(500));
+	kill(getpid(), SIGINT);
+	if (serverResult.wait_for(std::chrono::seconds(5)) != std::future_status::ready)
+	{
+		std::cout << test << ": server didn't stop" << std::endl;
+		std::_Exit(1);
+	}
+	check(serverResult.get(), test, "server failed");
+	close(stalled);
+}
+#endif
+
+}
+
+int main()
+{
+	testShortJSONFrames();
+	testHugeDecompressedSize();
+	testReusedReplayJSON();
+	testOptimalRLE();
+	testBatchedCRC();
+	testColumnDecode();
+	testTarLongNames();
+	testBrokenTar();
+#ifndef _WIN32
+	testTarFromStdin();
+	testStalledServerClient();
+#endif
+
+	if (gFailures)
+	{
+		std::cout << gFailures << " checks failed" << std::endl;
+		return 1;
+	}
+	std::cout << "All tests passed" << std::endl;
+	return 0;
+}